@@ -0,0 +1,91 @@
+#!/bin/sh
+#
+# bench.sh - Benchmark pnfdscan on generated trees
+#
+# Usage: bench.sh [<profile>*]
+#
+# Environment:
+#   BINDIR      Where pnfdscan, mktree & benchrun are (default: .)
+#   BENCHDIR    Scratch directory for the trees (default: ./bench.d)
+#   BENCHFLAGS  Extra pnfdscan options, for example "-j4 -Q64"
+#
+# For every profile a tree is generated with mktree (same seed, same
+# tree every time) and pnfdscan is run in scan, dry-run autofix and
+# autofix mode (the latter on a freshly generated tree). Reported are
+# objects, wall clock time, objects/s, CPU time, peak RSS (KB) and, on
+# Linux, system calls per object (from a second, traced, run). It is an
+# error if pnfdscan doesn't see every object mktree created.
+
+BINDIR="${BINDIR:-.}"
+BENCHDIR="${BENCHDIR:-./bench.d}"
+BENCHFLAGS="${BENCHFLAGS:-}"
+
+PROFILES="${*:-tree flat deep nfd}"
+
+
+profile_args() {
+    case "$1" in
+	tree)	echo "-d 3 -w 6 -e 200" ;;
+	flat)	echo "-d 0 -e 0 -F 100000" ;;
+	deep)	echo "-d 1 -w 2 -e 10 -L 400" ;;
+	nfd)	echo "-d 3 -w 5 -e 100 -c 20 -n 40 -x 10" ;;
+	*)	echo "bench.sh: Error: $1: Invalid profile" >&2; exit 1 ;;
+    esac
+}
+
+# Also sets CREATED to the number of objects in the tree
+mktree() {
+    rm -fr "$BENCHDIR/$1"
+    "$BINDIR/mktree" $(profile_args "$1") "$BENCHDIR/$1" >"$BENCHDIR/mktree.out" || exit 1
+    CREATED=$(awk '/directories,/ { print $1+$3 }' "$BENCHDIR/mktree.out")
+}
+
+# run <profile> <mode> <pnfdscan options>
+run() {
+    P="$1"; M="$2"; shift 2
+
+    [ "$M" = "autofix" ] && mktree "$P"
+    "$BINDIR/benchrun" "$BINDIR/pnfdscan" -s $BENCHFLAGS "$@" "$BENCHDIR/$P" \
+	>/dev/null 2>"$BENCHDIR/out" </dev/null
+
+    SC=""
+    if [ "$(uname -s)" = "Linux" ]; then
+	[ "$M" = "autofix" ] && mktree "$P"
+	"$BINDIR/benchrun" -c "$BINDIR/pnfdscan" -s $BENCHFLAGS "$@" "$BENCHDIR/$P" \
+	    >/dev/null 2>"$BENCHDIR/out.c" </dev/null
+	SC=$(sed -n 's/.*syscalls \([0-9]*\).*/\1/p' "$BENCHDIR/out.c")
+    fi
+
+    OBJ=$(sed -n 's/.*; \([0-9]*\) objects,.*/\1/p' "$BENCHDIR/out" | tail -1)
+    # A scan that silently skipped part of the tree would look fast
+    if [ "$OBJ" != "$CREATED" ]; then
+	echo "bench.sh: Error: $P $M: Scanned ${OBJ:-no} objects, created $CREATED" >&2
+	exit 1
+    fi
+    sed -n 's/^\[benchrun: //p' "$BENCHDIR/out" | \
+	awk -v p="$P" -v m="$M" -v o="${OBJ:-0}" -v sc="$SC" '{
+	    real = $2; user = $4; sys = $6; rss = $8;
+	    printf("%-6s %-8s %9d %8.3f %10.0f %8.3f %8.3f %8d %8s\n",
+		   p, m, o, real, (real > 0 ? o/real : 0), user, sys, rss,
+		   (sc != "" && o > 0 ? sprintf("%.2f", sc/o) : "-"));
+	}'
+}
+
+
+mkdir -p "$BENCHDIR" || exit 1
+
+printf "%-6s %-8s %9s %8s %10s %8s %8s %8s %8s\n" \
+    "tree" "mode" "objects" "real" "objects/s" "user" "sys" "maxrss" "sc/obj"
+
+for P in $PROFILES; do
+    profile_args "$P" >/dev/null || exit 1
+    mktree "$P"
+    run "$P" scan
+    run "$P" dryrun -aan
+    run "$P" autofix -aa
+    rm -fr "$BENCHDIR/$P"
+done
+
+rm -f "$BENCHDIR/out" "$BENCHDIR/out.c" "$BENCHDIR/mktree.out"
+rmdir "$BENCHDIR" 2>/dev/null
+exit 0
@@ -0,0 +1,190 @@
+/*
+ * benchrun.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Run a command and report its wall clock time, CPU time, peak RSS and
+ * (with -c, on Linux) the number of system calls made by all its
+ * threads. Used by bench.sh.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/ptrace.h>
+#endif
+
+
+char *argv0 = "benchrun";
+
+
+static double
+tv2d(const struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec/1000000.0;
+}
+
+
+#ifdef __linux__
+/* Count syscall entry stops of the child and all its threads */
+static int
+trace_child(pid_t pid,
+	    unsigned long *countp) {
+    int status;
+    pid_t tid;
+    unsigned long stops = 0;
+
+    if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status))
+	return -1;
+    if (ptrace(PTRACE_SETOPTIONS, pid, 0,
+	       PTRACE_O_TRACESYSGOOD|PTRACE_O_TRACECLONE|PTRACE_O_EXITKILL) < 0)
+	return -1;
+    ptrace(PTRACE_SYSCALL, pid, 0, 0);
+
+    while ((tid = waitpid(-1, &status, __WALL)) > 0) {
+	int sig = 0;
+
+	if (WIFEXITED(status) || WIFSIGNALED(status)) {
+	    if (tid == pid)
+		break;
+	    continue;
+	}
+
+	if (WIFSTOPPED(status)) {
+	    if (WSTOPSIG(status) == (SIGTRAP|0x80))
+		stops++;
+	    else if (status>>16 == 0 && WSTOPSIG(status) != SIGSTOP && WSTOPSIG(status) != SIGTRAP)
+		sig = WSTOPSIG(status);
+	}
+	ptrace(PTRACE_SYSCALL, tid, 0, sig);
+    }
+
+    /* One stop when entering and one when leaving each call */
+    *countp = stops/2;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128+WTERMSIG(status);
+}
+#endif
+
+
+int
+main(int argc,
+     char *argv[]) {
+    int i, f_count = 0, status, rc;
+    unsigned long syscalls = 0;
+    struct timespec t0, t1;
+    struct rusage ru;
+    pid_t pid;
+
+
+    argv0 = argv[0];
+
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+	if (strcmp(argv[i], "--") == 0) {
+	    ++i;
+	    break;
+	}
+	if (strcmp(argv[i], "-c") == 0)
+	    f_count++;
+	else {
+	    fprintf(stderr, "%s: Error: %s: Invalid switch\n", argv[0], argv[i]);
+	    exit(1);
+	}
+    }
+
+    if (i >= argc) {
+	fprintf(stderr, "Usage:\n  %s [-c] [--] <command> [<args>*]\n", argv[0]);
+	exit(1);
+    }
+
+#ifndef __linux__
+    f_count = 0;
+#endif
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    pid = fork();
+    if (pid < 0) {
+	fprintf(stderr, "%s: Error: fork: %s\n", argv[0], strerror(errno));
+	exit(1);
+    }
+    if (pid == 0) {
+#ifdef __linux__
+	if (f_count) {
+	    ptrace(PTRACE_TRACEME, 0, 0, 0);
+	    raise(SIGSTOP);
+	}
+#endif
+	execvp(argv[i], argv+i);
+	fprintf(stderr, "%s: Error: %s: %s\n", argv[0], argv[i], strerror(errno));
+	_exit(127);
+    }
+
+#ifdef __linux__
+    if (f_count) {
+	rc = trace_child(pid, &syscalls);
+	if (rc < 0) {
+	    fprintf(stderr, "%s: Error: ptrace: %s\n", argv[0], strerror(errno));
+	    kill(pid, SIGKILL);
+	    exit(1);
+	}
+    } else
+#endif
+    {
+	if (waitpid(pid, &status, 0) < 0) {
+	    fprintf(stderr, "%s: Error: waitpid: %s\n", argv[0], strerror(errno));
+	    exit(1);
+	}
+	rc = WIFEXITED(status) ? WEXITSTATUS(status) : 128+WTERMSIG(status);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    getrusage(RUSAGE_CHILDREN, &ru);
+
+    fprintf(stderr, "[benchrun: real %.3f user %.3f sys %.3f maxrss %ld",
+	    (t1.tv_sec-t0.tv_sec) + (t1.tv_nsec-t0.tv_nsec)/1e9,
+	    tv2d(&ru.ru_utime), tv2d(&ru.ru_stime), ru.ru_maxrss);
+    if (f_count)
+	fprintf(stderr, " syscalls %lu", syscalls);
+    fprintf(stderr, " status %d]\n", rc);
+
+    return rc;
+}
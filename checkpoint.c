@@ -0,0 +1,301 @@
+/*
+ * checkpoint.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "checkpoint.h"
+#include "replace.h"
+
+
+/*
+ * File format: a header followed by records, each a CKREC followed by
+ * its data padded to 8 bytes. Native byte order - like the directory
+ * cache it is only meant to be read on the machine that wrote it.
+ * A checkpoint without the final CK_END record is incomplete.
+ */
+#define CK_MAGIC	"PNFDCK\n"
+#define CK_VERSION	2
+
+typedef struct ckhdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} CKHDR;
+
+typedef struct ckrec {
+    uint32_t type;
+    uint32_t len;	/* Data length, without padding */
+} CKREC;
+
+#define CK_PAD(n)	(((n)+7) & ~(size_t) 7)
+#define CK_MAXSTR	8
+
+struct ckfile {
+    /* Writing */
+    FILE *fp;
+    char *path;
+    char *tmp;
+
+    /* Reading - the whole file */
+    char *buf;
+    size_t size;
+    size_t pos;
+};
+
+
+CKFILE *
+ckpt_create(const char *path) {
+    CKFILE *cp;
+    CKHDR h;
+
+
+    cp = calloc(1, sizeof(*cp));
+    if (!cp)
+	abort();
+    cp->path = strdup(path);
+    if (!cp->path)
+	abort();
+    cp->tmp = replace_tmpname(path);
+
+    cp->fp = fopen(cp->tmp, "w");
+    if (!cp->fp)
+	goto Fail;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CK_MAGIC, sizeof(h.magic));
+    h.version = CK_VERSION;
+    if (fwrite(&h, sizeof(h), 1, cp->fp) != 1)
+	goto Fail;
+
+    return cp;
+
+ Fail:
+    if (cp->fp) {
+	fclose(cp->fp);
+	remove(cp->tmp);
+    }
+    free(cp->path);
+    free(cp->tmp);
+    free(cp);
+    return NULL;
+}
+
+/* Write a record - the fixed part and nstr strings */
+int
+ckpt_put(CKFILE *cp,
+	 int type,
+	 const void *fixed,
+	 size_t flen,
+	 int nstr,
+	 ...) {
+    static const char pad[8];
+    const char *sv[CK_MAXSTR];
+    size_t slen[CK_MAXSTR];
+    CKREC r;
+    va_list ap;
+    int i;
+
+
+    r.type = type;
+    r.len = flen;
+
+    va_start(ap, nstr);
+    for (i = 0; i < nstr && i < CK_MAXSTR; i++) {
+	sv[i] = va_arg(ap, const char *);
+	if (!sv[i])
+	    sv[i] = "";
+	slen[i] = strlen(sv[i])+1;
+	r.len += slen[i];
+    }
+    va_end(ap);
+
+    if (fwrite(&r, sizeof(r), 1, cp->fp) != 1 ||
+	(flen > 0 && fwrite(fixed, flen, 1, cp->fp) != 1))
+	return -1;
+    for (i = 0; i < nstr && i < CK_MAXSTR; i++)
+	if (fwrite(sv[i], slen[i], 1, cp->fp) != 1)
+	    return -1;
+    if (CK_PAD(r.len) > r.len && fwrite(pad, CK_PAD(r.len)-r.len, 1, cp->fp) != 1)
+	return -1;
+
+    return 0;
+}
+
+/* Finish the file and replace the previous checkpoint with it */
+int
+ckpt_commit(CKFILE *cp) {
+    int rc = -1;
+
+    /* ckpt_close() removes it if this fails */
+    if (ckpt_put(cp, CK_END, NULL, 0, 0) == 0) {
+	rc = replace_fclose(cp->fp, cp->tmp, cp->path);
+	cp->fp = NULL;
+    }
+
+    ckpt_close(cp);
+    return rc;
+}
+
+
+CKFILE *
+ckpt_open(const char *path) {
+    CKFILE *cp;
+    FILE *fp;
+    struct stat sb;
+    CKHDR *hp;
+
+
+    fp = fopen(path, "r");
+    if (!fp)
+	return NULL;
+
+    if (fstat(fileno(fp), &sb) < 0) {
+	fclose(fp);
+	return NULL;
+    }
+
+    cp = calloc(1, sizeof(*cp));
+    if (!cp)
+	abort();
+    cp->size = sb.st_size;
+    cp->buf = malloc(cp->size+1);
+    if (!cp->buf)
+	abort();
+
+    if (fread(cp->buf, 1, cp->size, fp) != cp->size) {
+	fclose(fp);
+	goto Invalid;
+    }
+    fclose(fp);
+
+    hp = (CKHDR *) cp->buf;
+    if (cp->size < sizeof(*hp) ||
+	memcmp(hp->magic, CK_MAGIC, sizeof(hp->magic)) != 0 ||
+	hp->version != CK_VERSION)
+	goto Invalid;
+
+    cp->pos = sizeof(*hp);
+    return cp;
+
+ Invalid:
+    ckpt_close(cp);
+    errno = EINVAL;
+    return NULL;
+}
+
+/*
+ * Get the next record. Returns its type, 0 at the (complete) end of the
+ * file and -1 if the file is truncated or damaged.
+ */
+int
+ckpt_next(CKFILE *cp,
+	  const void **datap,
+	  size_t *lenp) {
+    CKREC r;
+
+    if (cp->pos+sizeof(r) > cp->size)
+	goto Invalid;
+    memcpy(&r, cp->buf+cp->pos, sizeof(r));
+    cp->pos += sizeof(r);
+
+    if (r.type == CK_END)
+	return 0;
+
+    if (r.type == 0 || r.len > cp->size-cp->pos)
+	goto Invalid;
+
+    *datap = cp->buf+cp->pos;
+    *lenp = r.len;
+    cp->pos += CK_PAD(r.len);
+    if (cp->pos > cp->size)
+	cp->pos = cp->size;
+    return r.type;
+
+ Invalid:
+    errno = EINVAL;
+    return -1;
+}
+
+/* Check that record data has a flen byte fixed part and nstr strings, and find them */
+int
+ckpt_fields(const void *data,
+	    size_t len,
+	    size_t flen,
+	    const char **strv,
+	    int nstr) {
+    const char *p = (const char *) data + flen;
+    const char *end = (const char *) data + len;
+    int i;
+
+    if (len < flen)
+	goto Invalid;
+
+    for (i = 0; i < nstr; i++) {
+	const char *nul = memchr(p, '\0', end-p);
+
+	if (!nul)
+	    goto Invalid;
+	strv[i] = p;
+	p = nul+1;
+    }
+    return 0;
+
+ Invalid:
+    errno = EINVAL;
+    return -1;
+}
+
+
+void
+ckpt_close(CKFILE *cp) {
+    if (!cp)
+	return;
+    if (cp->fp) {
+	fclose(cp->fp);
+	remove(cp->tmp);
+    }
+    free(cp->path);
+    free(cp->tmp);
+    free(cp->buf);
+    free(cp);
+}
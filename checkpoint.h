@@ -0,0 +1,131 @@
+/*
+ * checkpoint.h
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Checkpoint (state) file for resuming an interrupted scan (-K/-R).
+ *
+ * A sequence of typed records, each a fixed part followed by zero or
+ * more NUL-terminated strings. The file is written to a temporary name,
+ * synced and renamed into place, so it is always either the previous
+ * or the new complete checkpoint.
+ *
+ * A fix plan (-W/-X) is the same kind of file, with a CK_PLAN record
+ * followed by the CK_ACTIONs of a dry run.
+ */
+
+#define CK_ROOT		1	/* CKROOT, root path */
+#define CK_COUNTERS	2	/* uint64_t[CK_NCOUNTERS] */
+#define CK_DIR		3	/* CKDIR, directory path (not yet scanned) */
+#define CK_ACTION	4	/* CKACTION, dir, NFD name, NFC name, unique name */
+#define CK_END		5
+#define CK_PLAN		6	/* CKPLAN */
+
+typedef struct ckroot {
+    uint64_t seq;	/* Number of roots (arguments or -f names) before it */
+    uint64_t walked;	/* All directories scanned - only actions left */
+    int64_t output;	/* Size of the output file (stdout or -p), -1 if not a file */
+} CKROOT;
+
+#define CK_NCOUNTERS	16
+
+typedef struct ckdir {
+    uint64_t dev;
+} CKDIR;
+
+typedef struct ckstat {
+    uint64_t ino;
+    uint64_t mode;
+    uint64_t size;
+    int64_t mtime;
+    int64_t mtime_ns;
+} CKSTAT;
+
+typedef struct ckaction {
+    uint32_t type;
+    uint32_t flags;	/* CKA_xxx */
+    CKSTAT nfd;
+    CKSTAT nfc;
+} CKACTION;
+
+#define CKA_NFC_STAT	0x01
+#define CKA_UNIQUE	0x02
+
+typedef struct ckplan {
+    uint32_t flags;	/* CKP_xxx */
+    uint32_t reserved;
+} CKPLAN;
+
+#define CKP_REMOVE	0x01	/* Made with -r - remove instead of renaming */
+
+typedef struct ckfile CKFILE;
+
+
+extern CKFILE *
+ckpt_create(const char *path);
+
+extern int
+ckpt_put(CKFILE *cp,
+	 int type,
+	 const void *fixed,
+	 size_t flen,
+	 int nstr,
+	 ...);
+
+extern int
+ckpt_commit(CKFILE *cp);
+
+extern CKFILE *
+ckpt_open(const char *path);
+
+extern int
+ckpt_next(CKFILE *cp,
+	  const void **datap,
+	  size_t *lenp);
+
+extern int
+ckpt_fields(const void *data,
+	    size_t len,
+	    size_t flen,
+	    const char **strv,
+	    int nstr);
+
+extern void
+ckpt_close(CKFILE *cp);
+
+#endif
@@ -0,0 +1,514 @@
+/*
+ * classbench.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Name classifier micro benchmark and differential test.
+ *
+ * Runs the classification functions over a corpus of names (read from
+ * name lists and/or directory trees, plus random Unicode strings),
+ * reporting ns/name per stage, and checks the fast paths (every
+ * available utf8_class() implementation, utf8_nf_check() and
+ * utf8_to_nfc()) against the plain ICU reference path.
+ */
+
+/* Need d_type & DT_xxx */
+#define _DEFAULT_SOURCE 1
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <unicode/ustring.h>
+#include <unicode/utf8.h>
+
+#include "classify.h"
+
+
+char *argv0 = "classbench";
+
+unsigned int f_rounds = 3;
+unsigned int f_verbose = 0;
+
+
+/* The corpus - NUL-terminated names in one buffer */
+static char *cbuf = NULL;
+static size_t cbuf_size = 0;
+static size_t cbuf_len = 0;
+static size_t *cv = NULL;
+static size_t cv_size = 0;
+static size_t cv_len = 0;
+
+static volatile long sink;
+
+static const char *impls[] = { "scalar", "sse2", "avx2" };
+
+#define N_IMPLS		(sizeof(impls)/sizeof(impls[0]))
+#define NAME_MAXLEN	255
+
+
+static void
+add_name(const char *s,
+	 size_t len) {
+    if (len == 0 || len > NAME_MAXLEN)
+	return;
+
+    if (cbuf_len+len+1 > cbuf_size) {
+	cbuf_size = (cbuf_len+len+1)*2;
+	cbuf = realloc(cbuf, cbuf_size);
+	if (!cbuf)
+	    abort();
+    }
+    if (cv_len == cv_size) {
+	cv_size = cv_size ? cv_size*2 : 4096;
+	cv = realloc(cv, cv_size*sizeof(*cv));
+	if (!cv)
+	    abort();
+    }
+
+    cv[cv_len++] = cbuf_len;
+    memcpy(cbuf+cbuf_len, s, len);
+    cbuf[cbuf_len+len] = '\0';
+    cbuf_len += len+1;
+}
+
+#define NAME(i)		(cbuf+cv[i])
+
+
+/* Names from a file, one per line */
+static int
+add_file(const char *path) {
+    FILE *fp = fopen(path, "r");
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+
+    if (!fp)
+	return -1;
+
+    while ((len = getline(&line, &size, fp)) > 0) {
+	if (line[len-1] == '\n')
+	    --len;
+	add_name(line, len);
+    }
+
+    free(line);
+    fclose(fp);
+    return 0;
+}
+
+/* All names below a directory */
+static int
+add_dir(const char *path) {
+    DIR *dp = opendir(path);
+    struct dirent *dep;
+
+    if (!dp)
+	return -1;
+
+    while ((dep = readdir(dp)) != NULL) {
+	if (strcmp(dep->d_name, ".") == 0 || strcmp(dep->d_name, "..") == 0)
+	    continue;
+
+	add_name(dep->d_name, strlen(dep->d_name));
+
+	if (dep->d_type == DT_DIR) {
+	    size_t plen = strlen(path), nlen = strlen(dep->d_name);
+	    char *sub = malloc(plen+nlen+2);
+
+	    if (!sub)
+		abort();
+	    sprintf(sub, "%s/%s", path, dep->d_name);
+	    (void) add_dir(sub);
+	    free(sub);
+	}
+    }
+
+    closedir(dp);
+    return 0;
+}
+
+
+static uint64_t rng_state = 1;
+
+static uint32_t
+rnd(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t) ((rng_state * 2685821657736338717ULL) >> 32);
+}
+
+/* Code point ranges to pick random characters from */
+static const struct {
+    UChar32 lo, hi;
+    unsigned int weight;
+} ranges[] = {
+    { 0x20, 0x7e, 40 },		/* ASCII */
+    { 0xc0, 0x17f, 15 },	/* Latin-1 & Extended-A */
+    { 0x300, 0x36f, 15 },	/* Combining diacritics */
+    { 0x1e00, 0x1eff, 5 },	/* Latin Extended Additional */
+    { 0x370, 0x3ff, 3 },	/* Greek */
+    { 0x5b0, 0x5ea, 2 },	/* Hebrew points & letters */
+    { 0x900, 0x97f, 2 },	/* Devanagari */
+    { 0x1100, 0x11ff, 3 },	/* Hangul Jamo */
+    { 0xac00, 0xd7a3, 3 },	/* Hangul syllables */
+    { 0x3040, 0x30ff, 3 },	/* Kana (with voicing marks) */
+    { 0x4e00, 0x9fff, 3 },	/* CJK */
+    { 0x1d15e, 0x1d1c0, 1 },	/* Musical symbols (composition exclusions) */
+    { 0x1f300, 0x1f6ff, 3 },	/* Emoji */
+    { 0x2000, 0x2bff, 2 },	/* Punctuation, symbols */
+};
+
+#define N_RANGES	(sizeof(ranges)/sizeof(ranges[0]))
+
+
+/* Random names - mostly valid, some with broken UTF-8 */
+static void
+add_random(unsigned long n) {
+    unsigned int total = 0, i;
+    unsigned long k;
+
+    for (i = 0; i < N_RANGES; i++)
+	total += ranges[i].weight;
+
+    for (k = 0; k < n; k++) {
+	char s[NAME_MAXLEN+8];
+	int32_t len = 0;
+	unsigned int nc = 1 + rnd() % 40;
+
+	while (nc-- > 0 && len+4 <= NAME_MAXLEN) {
+	    unsigned int w = rnd() % total;
+	    UChar32 c;
+
+	    for (i = 0; w >= ranges[i].weight; i++)
+		w -= ranges[i].weight;
+	    c = ranges[i].lo + rnd() % (ranges[i].hi - ranges[i].lo + 1);
+	    if (c == '/')
+		c = '_';
+	    U8_APPEND_UNSAFE(s, len, c);
+	}
+
+	/* Break some of them */
+	if (rnd() % 50 == 0) {
+	    int32_t pos = rnd() % len;
+
+	    switch (rnd() % 3) {
+	    case 0:
+		s[pos] = (char) (0x80 + rnd() % 0x80);
+		break;
+	    case 1:
+		len = pos > 0 ? pos : 1;	/* Possibly in the middle of a sequence */
+		s[0] = s[0] ? s[0] : 'x';
+		break;
+	    default:
+		s[pos] = (char) 0xc0;		/* Overlong */
+		break;
+	    }
+	}
+
+	add_name(s, len);
+    }
+}
+
+
+static double
+now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+
+/* Reference classification, straight from the definitions & ICU */
+static int
+ref_class(const char *s) {
+    const unsigned char *p;
+    UChar u[NAME_MAXLEN*2+2];
+    int32_t ulen;
+    UErrorCode status = U_ZERO_ERROR;
+
+    for (p = (const unsigned char *) s; *p && *p < 0x80; p++)
+	;
+    if (!*p)
+	return NC_ASCII;
+
+    u_strFromUTF8(u, sizeof(u)/sizeof(u[0]), &ulen, s, -1, &status);
+    return U_FAILURE(status) ? NC_INVALID : NC_UTF8;
+}
+
+
+static unsigned long n_errors = 0;
+
+static void
+mismatch(const char *what,
+	 const char *s) {
+    const unsigned char *p;
+
+    if (n_errors++ >= 20)
+	return;
+
+    fprintf(stderr, "%s: MISMATCH: %s:", argv0, what);
+    for (p = (const unsigned char *) s; *p; p++)
+	fprintf(stderr, " %02x", *p);
+    putc('\n', stderr);
+}
+
+
+static void
+verify(void) {
+    size_t i, k;
+    int avail[N_IMPLS];
+
+    for (k = 0; k < N_IMPLS; k++)
+	avail[k] = (classify_simd(impls[k]) == 0);
+
+    for (i = 0; i < cv_len; i++) {
+	const char *s = NAME(i);
+	int rc = ref_class(s);
+
+	for (k = 0; k < N_IMPLS; k++)
+	    if (avail[k]) {
+		classify_simd(impls[k]);
+		if (utf8_class(s, strlen(s)) != rc)
+		    mismatch(impls[k], s);
+		if (is_ascii(s) != (rc == NC_ASCII) ||
+		    is_valid_utf8(s) != (rc != NC_INVALID))
+		    mismatch("is_ascii/is_valid_utf8", s);
+	    }
+
+	if (rc == NC_UTF8) {
+	    UChar u[8192];
+	    int32_t ulen, l1, l2;
+	    char o1[8192], o2[NFBUFSIZE];
+	    int r_nfd, r_nfc, f_nfd, f_nfc;
+
+	    if (utf8_to_utf16(s, u, &ulen) < 0) {
+		mismatch("utf8_to_utf16", s);
+		continue;
+	    }
+	    r_nfd = is_nfd(u, ulen);
+	    r_nfc = is_nfc(u, ulen);
+	    to_nfc(u, ulen, o1, &l1);
+
+	    if (utf8_nf_check(s, &f_nfd, &f_nfc) < 0 || f_nfd != r_nfd || f_nfc != r_nfc)
+		mismatch("utf8_nf_check", s);
+	    if (utf8_to_nfc(s, o2, sizeof(o2), &l2) < 0 || l1 != l2 || strcmp(o1, o2) != 0)
+		mismatch("utf8_to_nfc", s);
+	}
+    }
+
+    /* Back to the default */
+    classify_simd(NULL);
+}
+
+
+/* Time one stage over the whole corpus (best of f_rounds) */
+#define STAGE(label, only_utf8, ...) do {				\
+	double best = 0;						\
+	unsigned int r;							\
+	size_t i, n = 0;						\
+	for (r = 0; r < f_rounds; r++) {				\
+	    double t0 = now_ns(), dt;					\
+	    for (i = n = 0; i < cv_len; i++) {				\
+		const char *s = NAME(i);				\
+		if (only_utf8 && !is_utf8[i])				\
+		    continue;						\
+		n++;							\
+		(void) s;						\
+		__VA_ARGS__;						\
+	    }								\
+	    dt = now_ns() - t0;						\
+	    if (r == 0 || dt < best)					\
+		best = dt;						\
+	}								\
+	printf("  %-24s %10zu names %9.1f ns/name\n", label, n, n ? best/n : 0.0); \
+    } while (0)
+
+
+static void
+benchmark(void) {
+    unsigned char *is_utf8;
+    UChar (*uv)[NAME_MAXLEN*2+2];
+    int32_t *ulv;
+    size_t i, k;
+
+
+    is_utf8 = malloc(cv_len);
+    uv = malloc(cv_len*sizeof(*uv));
+    ulv = malloc(cv_len*sizeof(*ulv));
+    if (!is_utf8 || !uv || !ulv)
+	abort();
+
+    for (i = 0; i < cv_len; i++) {
+	UErrorCode status = U_ZERO_ERROR;
+
+	is_utf8[i] = (ref_class(NAME(i)) == NC_UTF8);
+	ulv[i] = 0;
+	if (is_utf8[i])
+	    u_strFromUTF8(uv[i], NAME_MAXLEN*2+2, &ulv[i], NAME(i), -1, &status);
+    }
+
+    printf("Fast path:\n");
+    for (k = 0; k < N_IMPLS; k++) {
+	char label[64];
+
+	if (classify_simd(impls[k]) < 0)
+	    continue;
+	snprintf(label, sizeof(label), "utf8_class (%s)", impls[k]);
+	STAGE(label, 0, sink += utf8_class(s, strlen(s)));
+    }
+    classify_simd(NULL);
+
+    STAGE("is_ascii", 0, sink += is_ascii(s));
+    STAGE("is_valid_utf8", 0, sink += is_valid_utf8(s));
+    STAGE("utf8_nf_check", 1, { int a, b; utf8_nf_check(s, &a, &b); sink += a+b; });
+    STAGE("utf8_to_nfc", 1, { char o[NFBUFSIZE]; int32_t l; utf8_to_nfc(s, o, sizeof(o), &l); sink += l; });
+
+    printf("ICU reference path:\n");
+    STAGE("utf8_to_utf16", 1, { UChar u[8192]; int32_t l; utf8_to_utf16(s, u, &l); sink += l; });
+    STAGE("is_nfd", 1, sink += is_nfd(uv[i], ulv[i]));
+    STAGE("is_nfc", 1, sink += is_nfc(uv[i], ulv[i]));
+    STAGE("to_nfc", 1, { char o[8192]; int32_t l; to_nfc(uv[i], ulv[i], o, &l); sink += l; });
+
+    free(is_utf8);
+    free(uv);
+    free(ulv);
+}
+
+
+int
+main(int argc,
+     char *argv[]) {
+    int i;
+    unsigned long n_random = 200000;
+    size_t n_ascii = 0, n_invalid = 0;
+
+
+    argv0 = argv[0];
+    if (classify_setup() < 0) {
+	fprintf(stderr, "%s: Error: ICU normalization setup: %s\n", argv0, strerror(errno));
+	exit(1);
+    }
+
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+	int c = argv[i][1];
+	const char *arg = NULL;
+
+	if (c == 'h') {
+	    printf("Usage:\n  %s [<options>*]\n", argv[0]);
+	    puts("\nOptions:");
+	    puts("  -h          Display this");
+	    puts("  -v          Show the corpus composition");
+	    puts("  -f <file>   Add the names in <file> (one per line)");
+	    puts("  -d <dir>    Add all names below <dir>");
+	    puts("  -n <n>      Number of random names (default: 200000)");
+	    puts("  -s <n>      Random seed (default: 1)");
+	    puts("  -r <n>      Timing rounds, best is reported (default: 3)");
+	    exit(0);
+	}
+	if (c == 'v' && !argv[i][2]) {
+	    f_verbose++;
+	    continue;
+	}
+
+	if (!c || argv[i][2] || i+1 >= argc) {
+	    fprintf(stderr, "%s: Error: %s: Invalid switch\n", argv[0], argv[i]);
+	    exit(1);
+	}
+	arg = argv[++i];
+
+	switch (c) {
+	case 'f':
+	    if (add_file(arg) < 0) {
+		fprintf(stderr, "%s: Error: %s: %s\n", argv[0], arg, strerror(errno));
+		exit(1);
+	    }
+	    break;
+	case 'd':
+	    if (add_dir(arg) < 0) {
+		fprintf(stderr, "%s: Error: %s: %s\n", argv[0], arg, strerror(errno));
+		exit(1);
+	    }
+	    break;
+	case 'n':
+	    n_random = strtoul(arg, NULL, 0);
+	    break;
+	case 's':
+	    rng_state = strtoull(arg, NULL, 0);
+	    if (!rng_state)
+		rng_state = 1;
+	    break;
+	case 'r':
+	    if (sscanf(arg, "%u", &f_rounds) != 1 || f_rounds < 1) {
+		fprintf(stderr, "%s: Error: -r: %s: Invalid number\n", argv[0], arg);
+		exit(1);
+	    }
+	    break;
+	default:
+	    fprintf(stderr, "%s: Error: -%c: Invalid switch\n", argv[0], c);
+	    exit(1);
+	}
+    }
+
+    add_random(n_random);
+
+    if (f_verbose) {
+	size_t k;
+
+	for (k = 0; k < cv_len; k++)
+	    switch (ref_class(NAME(k))) {
+	    case NC_ASCII:
+		n_ascii++;
+		break;
+	    case NC_INVALID:
+		n_invalid++;
+		break;
+	    }
+	printf("Corpus: %zu names (%zu ASCII, %zu other UTF-8, %zu invalid)\n",
+	       cv_len, n_ascii, cv_len-n_ascii-n_invalid, n_invalid);
+    }
+
+    verify();
+    printf("Verification: %s (%lu mismatches in %zu names)\n",
+	   n_errors ? "FAILED" : "OK", n_errors, cv_len);
+
+    benchmark();
+
+    return n_errors ? 1 : 0;
+}
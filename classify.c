@@ -0,0 +1,602 @@
+/*
+ * classify.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unicode/utypes.h>
+#include <unicode/utf8.h>
+#include <unicode/unorm2.h>
+#include <unicode/ustring.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#include "classify.h"
+#include "unitabdef.h"
+#include "unitab.h"
+
+
+static const UNormalizer2 *nfd;
+static const UNormalizer2 *nfc;
+
+
+/*
+ * This is also part of libpnfd, so nothing here prints anything -
+ * ICU errors are returned as -1 with errno set, for the caller to
+ * report.
+ */
+static int
+icu_error(UErrorCode status) {
+    switch (status) {
+    case U_MEMORY_ALLOCATION_ERROR:
+	errno = ENOMEM;
+	break;
+    case U_BUFFER_OVERFLOW_ERROR:
+    case U_STRING_NOT_TERMINATED_WARNING:
+	errno = ENAMETOOLONG;
+	break;
+    case U_INVALID_CHAR_FOUND:
+    case U_ILLEGAL_CHAR_FOUND:
+    case U_TRUNCATED_CHAR_FOUND:
+	errno = EILSEQ;
+	break;
+    case U_FILE_ACCESS_ERROR:
+    case U_MISSING_RESOURCE_ERROR:
+	errno = ENOENT;
+	break;
+    default:
+	errno = EINVAL;
+    }
+    return -1;
+}
+
+
+int
+classify_setup(void) {
+    UErrorCode status = U_ZERO_ERROR;
+
+    nfd = unorm2_getInstance(NULL, "nfc", UNORM2_DECOMPOSE, &status);
+    nfc = unorm2_getInstance(NULL, "nfc", UNORM2_COMPOSE, &status);
+
+    if (U_FAILURE(status))
+	return icu_error(status);
+
+    classify_simd(NULL);
+    return 0;
+}
+
+
+int
+utf8_to_utf16(const char *utf8_input,
+	      UChar utf16_input[8192],
+	      int32_t *utf16_len) {
+    UErrorCode status = U_ZERO_ERROR;
+
+    u_strFromUTF8(utf16_input, 8192, utf16_len, utf8_input, -1, &status);
+    if (U_FAILURE(status))
+        return icu_error(status);
+
+    return 0;
+}
+
+
+int
+is_nfd(UChar utf16_input[8192],
+       int32_t utf16_len) {
+    UErrorCode status = U_ZERO_ERROR;
+    UBool r;
+
+    r = unorm2_isNormalized(nfd, utf16_input, utf16_len, &status);
+    if (U_FAILURE(status))
+        return icu_error(status);
+
+    return r;
+}
+
+
+
+int
+is_nfc(UChar utf16_input[8192],
+       int32_t utf16_len) {
+    UErrorCode status = U_ZERO_ERROR;
+    UBool r;
+
+    r = unorm2_isNormalized(nfc, utf16_input, utf16_len, &status);
+    if (U_FAILURE(status))
+        return icu_error(status);
+
+    return r;
+}
+
+
+
+
+int
+to_nfc(UChar utf16_input[8192],
+       int32_t utf16_len,
+       char utf8_output[8192],
+       int32_t *utf8_output_len) {
+    UErrorCode status = U_ZERO_ERROR;
+    UChar utf16_output[8192];
+    int32_t output_len;
+
+    output_len = unorm2_normalize(nfc, utf16_input, utf16_len, utf16_output, 8192, &status);
+    if (U_FAILURE(status))
+        return icu_error(status);
+
+    // Convert UTF-16 back to UTF-8
+    u_strToUTF8(utf8_output, 8192, utf8_output_len, utf16_output, output_len, &status);
+    if (U_FAILURE(status))
+        return icu_error(status);
+
+    return 0;
+}
+
+
+/*
+ * Name encoding classification.
+ *
+ * utf8_class() checks if a name is plain ASCII, valid (non-ASCII) UTF-8
+ * or something else in a single pass. There are SSE2 and AVX2 versions
+ * (the latter also validates the UTF-8 32 bytes at a time using the
+ * Keiser & Lemire range lookup algorithm) and a portable scalar one,
+ * selected at runtime by classify_setup() depending on what the CPU
+ * supports.
+ */
+
+static int
+is_valid_utf8_scalar(const char *str) {
+    const unsigned char *bytes = (const unsigned char *)str;
+
+    while (*bytes) {
+        if (*bytes <= 0x7F) {
+            // ASCII
+            bytes += 1;
+        } else if ((*bytes & 0xE0) == 0xC0) {
+            // 2-byte sequence
+            if ((bytes[1] & 0xC0) != 0x80) return 0;
+            if (*bytes < 0xC2) return 0; // Overlong encoding
+            bytes += 2;
+        } else if ((*bytes & 0xF0) == 0xE0) {
+            // 3-byte sequence
+            if ((bytes[1] & 0xC0) != 0x80 || (bytes[2] & 0xC0) != 0x80) return 0;
+            if (*bytes == 0xE0 && bytes[1] < 0xA0) return 0; // Overlong
+            if (*bytes == 0xED && bytes[1] >= 0xA0) return 0; // Surrogates
+            bytes += 3;
+        } else if ((*bytes & 0xF8) == 0xF0) {
+            // 4-byte sequence
+            if ((bytes[1] & 0xC0) != 0x80 ||
+                (bytes[2] & 0xC0) != 0x80 ||
+                (bytes[3] & 0xC0) != 0x80) return 0;
+            if (*bytes == 0xF0 && bytes[1] < 0x90) return 0; // Overlong
+            if (*bytes == 0xF4 && bytes[1] > 0x8F) return 0; // Above U+10FFFF
+            if (*bytes > 0xF4) return 0; // Invalid
+            bytes += 4;
+        } else {
+            return 0; // Invalid leading byte
+        }
+    }
+    return 1;
+}
+
+
+static int
+utf8_class_scalar(const char *s,
+		  size_t len) {
+    const char *end = s+len;
+    uint64_t w;
+
+    /* 8 bytes at a time while everything is ASCII */
+    for (; s+8 <= end; s += 8) {
+	memcpy(&w, s, 8);
+	if (w & UINT64_C(0x8080808080808080))
+	    break;
+    }
+    for (; s < end; s++)
+	if (*s & 0x80)
+	    break;
+    if (s == end)
+	return NC_ASCII;
+
+    /* s is at a character boundary since the previous byte is ASCII */
+    return is_valid_utf8_scalar(s) ? NC_UTF8 : NC_INVALID;
+}
+
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static int
+utf8_class_sse2(const char *s,
+		size_t len) {
+    const char *end = s+len;
+
+    for (; s+16 <= end; s += 16)
+	if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i *) s)))
+	    break;
+    for (; s < end; s++)
+	if (*s & 0x80)
+	    break;
+    if (s == end)
+	return NC_ASCII;
+
+    return is_valid_utf8_scalar(s) ? NC_UTF8 : NC_INVALID;
+}
+
+
+/* Error bits for the range lookup tables */
+#define U8_TOO_SHORT	(1<<0)
+#define U8_TOO_LONG	(1<<1)
+#define U8_OVERLONG_3	(1<<2)
+#define U8_TOO_LARGE	(1<<3)
+#define U8_SURROGATE	(1<<4)
+#define U8_OVERLONG_2	(1<<5)
+#define U8_TOO_LARGE_1000 (1<<6)
+#define U8_OVERLONG_4	(1<<6)
+#define U8_TWO_CONTS	(1<<7)
+#define U8_CARRY	(U8_TOO_SHORT|U8_TOO_LONG|U8_TWO_CONTS)
+
+#define LOOKUP16(v, a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p)			\
+    _mm256_shuffle_epi8(_mm256_setr_epi8(a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p, \
+					 a,b,c,d,e,f,g,h,i,j,k,l,m,n,o,p), v)
+
+/* The 32 bytes ending N bytes before the end of the current block */
+#define PREV(cur, prev, n)						\
+    _mm256_alignr_epi8(cur, _mm256_permute2x128_si256(prev, cur, 0x21), 16-(n))
+
+
+__attribute__((target("avx2")))
+static inline __m256i
+u8_block_errors(__m256i cur,
+		__m256i prev) {
+    const __m256i lo4 = _mm256_set1_epi8(0x0F);
+    __m256i prev1 = PREV(cur, prev, 1);
+    __m256i prev2, prev3, b1h, b1l, b2h, sc, must23;
+
+    b1h = LOOKUP16(_mm256_and_si256(_mm256_srli_epi16(prev1, 4), lo4),
+		   /* 0_______ ________ <ASCII in byte 1> */
+		   U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+		   U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+		   /* 10______ ________ <continuation in byte 1> */
+		   U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS,
+		   /* 1100____ ________ <two byte lead in byte 1> */
+		   U8_TOO_SHORT|U8_OVERLONG_2,
+		   /* 1101____ ________ <two byte lead in byte 1> */
+		   U8_TOO_SHORT,
+		   /* 1110____ ________ <three byte lead in byte 1> */
+		   U8_TOO_SHORT|U8_OVERLONG_3|U8_SURROGATE,
+		   /* 1111____ ________ <four+ byte lead in byte 1> */
+		   U8_TOO_SHORT|U8_TOO_LARGE|U8_TOO_LARGE_1000|U8_OVERLONG_4);
+
+    b1l = LOOKUP16(_mm256_and_si256(prev1, lo4),
+		   /* ____0000 ________ */
+		   U8_CARRY|U8_OVERLONG_3|U8_OVERLONG_2|U8_OVERLONG_4,
+		   /* ____0001 ________ */
+		   U8_CARRY|U8_OVERLONG_2,
+		   /* ____001_ ________ */
+		   U8_CARRY,
+		   U8_CARRY,
+		   /* ____0100 ________ */
+		   U8_CARRY|U8_TOO_LARGE,
+		   /* ____0101 ________ */
+		   U8_CARRY|U8_TOO_LARGE|U8_TOO_LARGE_1000,
+		   /* ____011_ ________ */
+		   U8_CARRY|U8_TOO_LARGE|U8_TOO_LARGE_1000,
+		   U8_CARRY|U8_TOO_LARGE|U8_TOO_LARGE_1000,
+		   /* ____1___ ________ */
+		   U8_CARRY|U8_TOO_LARGE|U8_TOO_LARGE_1000,
+		   U8_CARRY|U8_TOO_LARGE|U8_TOO_LARGE_1000,
+		   U8_CARRY|U8_TOO_LARGE|U8_TOO_LARGE_1000,
+		   U8_CARRY|U8_TOO_LARGE|U8_TOO_LARGE_1000,
+		   U8_CARRY|U8_TOO_LARGE|U8_TOO_LARGE_1000,
+		   /* ____1101 ________ */
+		   U8_CARRY|U8_TOO_LARGE|U8_TOO_LARGE_1000|U8_SURROGATE,
+		   U8_CARRY|U8_TOO_LARGE|U8_TOO_LARGE_1000,
+		   U8_CARRY|U8_TOO_LARGE|U8_TOO_LARGE_1000);
+
+    b2h = LOOKUP16(_mm256_and_si256(_mm256_srli_epi16(cur, 4), lo4),
+		   /* ________ 0_______ <ASCII in byte 2> */
+		   U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+		   U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+		   /* ________ 1000____ */
+		   U8_TOO_LONG|U8_OVERLONG_2|U8_TWO_CONTS|U8_OVERLONG_3|U8_TOO_LARGE_1000|U8_OVERLONG_4,
+		   /* ________ 1001____ */
+		   U8_TOO_LONG|U8_OVERLONG_2|U8_TWO_CONTS|U8_OVERLONG_3|U8_TOO_LARGE,
+		   /* ________ 101_____ */
+		   U8_TOO_LONG|U8_OVERLONG_2|U8_TWO_CONTS|U8_SURROGATE|U8_TOO_LARGE,
+		   U8_TOO_LONG|U8_OVERLONG_2|U8_TWO_CONTS|U8_SURROGATE|U8_TOO_LARGE,
+		   /* ________ 11______ */
+		   U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT);
+
+    sc = _mm256_and_si256(_mm256_and_si256(b1h, b1l), b2h);
+
+    /* Bytes that must be the 2nd or 3rd continuation of a 3 or 4 byte sequence */
+    prev2 = PREV(cur, prev, 2);
+    prev3 = PREV(cur, prev, 3);
+    must23 = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8((char) (0xE0-0x80))),
+			     _mm256_subs_epu8(prev3, _mm256_set1_epi8((char) (0xF0-0x80))));
+
+    return _mm256_xor_si256(_mm256_and_si256(must23, _mm256_set1_epi8((char) 0x80)), sc);
+}
+
+
+__attribute__((target("avx2")))
+static int
+utf8_class_avx2(const char *s,
+		size_t len) {
+    /* A sequence may not start in the last 1-3 bytes of the input */
+    const __m256i max = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+					 -1, -1, -1, -1, -1, -1, -1, -1,
+					 -1, -1, -1, -1, -1, -1, -1, -1,
+					 -1, -1, -1, -1, -1,
+					 (char) (0xF0-1), (char) (0xE0-1), (char) (0xC0-1));
+    __m256i prev = _mm256_setzero_si256();
+    __m256i incomplete = _mm256_setzero_si256();
+    __m256i errors = _mm256_setzero_si256();
+    __m256i cur;
+    int nonascii = 0;
+    size_t i;
+
+
+    for (i = 0; i < len; i += 32) {
+	if (i+32 <= len)
+	    cur = _mm256_loadu_si256((const __m256i *) (s+i));
+	else {
+	    /* Don't read beyond the end of the string - pad with NULs */
+	    char buf[32];
+
+	    memset(buf, 0, sizeof(buf));
+	    memcpy(buf, s+i, len-i);
+	    cur = _mm256_loadu_si256((const __m256i *) buf);
+	}
+
+	if (!_mm256_movemask_epi8(cur))
+	    errors = _mm256_or_si256(errors, incomplete);
+	else {
+	    nonascii = 1;
+	    errors = _mm256_or_si256(errors, u8_block_errors(cur, prev));
+	    incomplete = _mm256_subs_epu8(cur, max);
+	}
+	prev = cur;
+    }
+    /*
+     * A padded last block ends in NULs which flags any unfinished
+     * sequence as too short. Otherwise check the last block ending.
+     */
+    errors = _mm256_or_si256(errors, incomplete);
+
+    if (!_mm256_testz_si256(errors, errors))
+	return NC_INVALID;
+
+    return nonascii ? NC_UTF8 : NC_ASCII;
+}
+
+#endif
+
+
+static int (*utf8_class_fn)(const char *s, size_t len) = utf8_class_scalar;
+
+
+/*
+ * Select classifier implementation: "scalar", "sse2", "avx2" or NULL
+ * (the best one the CPU supports). Returns -1 if not available.
+ */
+int
+classify_simd(const char *impl) {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+
+    if (!impl) {
+	if (__builtin_cpu_supports("avx2"))
+	    impl = "avx2";
+	else if (__builtin_cpu_supports("sse2"))
+	    impl = "sse2";
+	else
+	    impl = "scalar";
+    }
+
+    if (strcmp(impl, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+	utf8_class_fn = utf8_class_avx2;
+	return 0;
+    }
+    if (strcmp(impl, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+	utf8_class_fn = utf8_class_sse2;
+	return 0;
+    }
+#endif
+
+    if (!impl || strcmp(impl, "scalar") == 0) {
+	utf8_class_fn = utf8_class_scalar;
+	return 0;
+    }
+
+    return -1;
+}
+
+
+int
+utf8_class(const char *s,
+	   size_t len) {
+    return utf8_class_fn(s, len);
+}
+
+
+int
+is_ascii(const char *s) {
+    return utf8_class_fn(s, strlen(s)) == NC_ASCII;
+}
+
+
+int
+is_valid_utf8(const char *str) {
+    return utf8_class_fn(str, strlen(str)) != NC_INVALID;
+}
+
+
+
+/* Normalization properties of a code point, from the generated table */
+#define UNITAB_LOOKUP(c) \
+    unitab_props[unitab_stage2[(unitab_stage1[(c) >> UNITAB_SHIFT] << UNITAB_SHIFT) | ((c) & UNITAB_MASK)]]
+
+
+/*
+ * Check if a valid UTF-8 string is in NFD and/or NFC form, working
+ * directly on the UTF-8 bytes in one pass using the per code point
+ * quick check properties and combining classes (UAX #15) from the
+ * table generated by mkunitab at build time. NFD answers are
+ * definitive. For NFC a "maybe" answer (combining characters that
+ * might compose with what precedes them) requires a real normalization
+ * check, which is done by ICU on a small UTF-16 copy.
+ */
+int
+utf8_nf_check(const char *s,
+	      int *nfdp,
+	      int *nfcp) {
+    const uint8_t *u = (const uint8_t *) s;
+    int32_t i = 0, len = strlen(s);
+    unsigned int p, ccc, last_ccc = 0, bad_order;
+    unsigned int nfd_no = 0, nfc_no = 0, nfc_maybe = 0;
+    UChar32 c;
+
+
+    while (i < len) {
+	if (u[i] < 0x80) {
+	    last_ccc = 0;
+	    i++;
+	    continue;
+	}
+
+	U8_NEXT_UNSAFE(u, i, c);
+
+	p = UNITAB_LOOKUP(c);
+	ccc = p & UT_CCC_MASK;
+
+	bad_order = (ccc != 0) & (last_ccc > ccc);
+	nfd_no |= (p & UT_NFD_NO) | bad_order;
+	nfc_no |= (p & UT_NFC_NO) | bad_order;
+	nfc_maybe |= (p & UT_NFC_MAYBE);
+	last_ccc = ccc;
+    }
+
+    if (!nfc_no && nfc_maybe) {
+	UErrorCode status = U_ZERO_ERROR;
+	UChar buf[NFBUFSIZE];
+	int32_t buflen;
+
+	u_strFromUTF8(buf, NFBUFSIZE, &buflen, s, len, &status);
+	if (U_SUCCESS(status))
+	    nfc_no = !unorm2_isNormalized(nfc, buf, buflen, &status);
+	if (U_FAILURE(status))
+	    return icu_error(status);
+    }
+
+    *nfdp = !nfd_no;
+    *nfcp = !nfc_no;
+    return 0;
+}
+
+
+/*
+ * Convert a (valid) UTF-8 string to NFC. The leading part that passes
+ * the NFC quick check (up to the last normalization boundary, i.e. the
+ * last starter that can't combine with what precedes it) is found with
+ * the same table as utf8_nf_check() and copied as-is, and only the rest
+ * is converted to UTF-16 and normalized by ICU.
+ */
+int
+utf8_to_nfc(const char *s,
+	    char *utf8_output,
+	    int32_t utf8_output_size,
+	    int32_t *utf8_output_len) {
+    const uint8_t *u = (const uint8_t *) s;
+    int32_t i = 0, j, len = strlen(s), start = 0, tail = -1;
+    unsigned int p, ccc, last_ccc = 0;
+    UErrorCode status = U_ZERO_ERROR;
+    UChar ibuf[NFBUFSIZE], obuf[NFBUFSIZE];
+    int32_t ilen, olen, tlen;
+    UChar32 c;
+
+
+    while (i < len) {
+	if (u[i] < 0x80) {
+	    start = i++;
+	    last_ccc = 0;
+	    continue;
+	}
+
+	j = i;
+	U8_NEXT_UNSAFE(u, i, c);
+
+	p = UNITAB_LOOKUP(c);
+	ccc = p & UT_CCC_MASK;
+	if ((p & (UT_NFC_NO|UT_NFC_MAYBE)) || (ccc != 0 && last_ccc > ccc)) {
+	    tail = start;
+	    break;
+	}
+	if (ccc == 0)
+	    start = j;
+	last_ccc = ccc;
+    }
+
+    if (tail < 0)
+	tail = len;
+    if (tail >= utf8_output_size)
+	return icu_error(U_BUFFER_OVERFLOW_ERROR);
+    memcpy(utf8_output, s, tail);
+    utf8_output[tail] = '\0';
+    *utf8_output_len = tail;
+    if (tail == len)
+	return 0;
+
+    u_strFromUTF8(ibuf, NFBUFSIZE, &ilen, s+tail, len-tail, &status);
+    if (U_FAILURE(status))
+        return icu_error(status);
+
+    olen = unorm2_normalize(nfc, ibuf, ilen, obuf, NFBUFSIZE, &status);
+    if (U_FAILURE(status))
+        return icu_error(status);
+
+    u_strToUTF8(utf8_output+tail, utf8_output_size-tail, &tlen, obuf, olen, &status);
+    *utf8_output_len = tail+tlen;
+    if (U_FAILURE(status) || *utf8_output_len >= utf8_output_size)
+	return icu_error(U_FAILURE(status) ? status : U_BUFFER_OVERFLOW_ERROR);
+
+    return 0;
+}
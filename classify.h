@@ -0,0 +1,100 @@
+/*
+ * classify.h
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CLASSIFY_H
+#define CLASSIFY_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unicode/utypes.h>
+
+
+/* Size of the name conversion buffers (a name is at most NAME_MAX bytes) */
+#define NFBUFSIZE	1024
+
+
+/* utf8_class() results */
+#define NC_ASCII	0
+#define NC_UTF8		1	/* Valid UTF-8, not plain ASCII */
+#define NC_INVALID	-1
+
+
+extern int
+classify_setup(void);
+
+extern int
+classify_simd(const char *impl);
+
+extern int
+utf8_class(const char *s,
+	   size_t len);
+
+extern int
+is_ascii(const char *s);
+
+extern int
+is_valid_utf8(const char *str);
+
+extern int
+utf8_nf_check(const char *s,
+	      int *nfdp,
+	      int *nfcp);
+
+extern int
+utf8_to_nfc(const char *s,
+	    char *utf8_output,
+	    int32_t utf8_output_size,
+	    int32_t *utf8_output_len);
+
+
+/* The plain ICU (via UTF-16) reference implementation */
+extern int
+utf8_to_utf16(const char *utf8_input,
+	      UChar utf16_input[8192],
+	      int32_t *utf16_len);
+
+extern int
+is_nfd(UChar utf16_input[8192],
+       int32_t utf16_len);
+
+extern int
+is_nfc(UChar utf16_input[8192],
+       int32_t utf16_len);
+
+extern int
+to_nfc(UChar utf16_input[8192],
+       int32_t utf16_len,
+       char utf8_output[8192],
+       int32_t *utf8_output_len);
+
+#endif
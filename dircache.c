@@ -0,0 +1,311 @@
+/*
+ * dircache.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "pnfdscan.h"
+#include "dircache.h"
+#include "replace.h"
+
+
+int dircache_enabled = 0;
+
+
+/*
+ * File format: a header followed by DCREC records, each followed by
+ * its subdirectory names and padded to 8 bytes. Native byte order -
+ * the cache is only meant to be read on the machine that wrote it.
+ */
+#define DC_MAGIC	"PNFDDC\n"
+#define DC_VERSION	1
+
+typedef struct dchdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t recsize;	/* sizeof(DCREC), catches ABI/byte order changes */
+    uint64_t nrecs;
+} DCHDR;
+
+#define DC_PAD(n)	(((n)+7) & ~(size_t) 7)
+
+
+/* Previous scan, read-only after dircache_load() */
+static char *old_buf = NULL;
+static const DCREC **old_tab = NULL;
+static size_t old_size = 0;	/* Power of 2 */
+
+/* This scan */
+static pthread_mutex_t new_mtx = PTHREAD_MUTEX_INITIALIZER;
+static char *new_buf = NULL;
+static size_t new_size = 0;
+static size_t new_len = 0;
+static uint64_t new_nrecs = 0;
+
+/*
+ * Directories modified at (or after) the time we started may change
+ * again within the same timestamp granularity without us noticing,
+ * so they are never cached.
+ */
+static time_t dc_start = 0;
+
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+#define ST_MTIME_NS(sp)	((sp)->st_mtim.tv_nsec)
+#define ST_CTIME_NS(sp)	((sp)->st_ctim.tv_nsec)
+#else
+#define ST_MTIME_NS(sp)	0
+#define ST_CTIME_NS(sp)	0
+#endif
+
+
+static size_t
+dc_hash(uint64_t dev,
+	uint64_t ino) {
+    uint64_t h = (ino ^ (dev * 0x9E3779B97F4A7C15ULL)) * 0xBF58476D1CE4E5B9ULL;
+
+    return (size_t) (h ^ (h >> 31));
+}
+
+
+int
+dircache_load(const char *path) {
+    FILE *fp;
+    struct stat sb;
+    DCHDR *hp;
+    size_t pos, i;
+    uint64_t n, nsubs;
+
+
+    dc_start = time(NULL);
+
+    fp = fopen(path, "r");
+    if (!fp)
+	return errno == ENOENT ? 0 : -1;
+
+    if (fstat(fileno(fp), &sb) < 0) {
+	fclose(fp);
+	return -1;
+    }
+
+    old_buf = malloc(sb.st_size+1);
+    if (!old_buf)
+	abort();
+
+    if (fread(old_buf, 1, sb.st_size, fp) != (size_t) sb.st_size) {
+	fclose(fp);
+	goto Invalid;
+    }
+    fclose(fp);
+
+    hp = (DCHDR *) old_buf;
+    if ((size_t) sb.st_size < sizeof(*hp) ||
+	memcmp(hp->magic, DC_MAGIC, sizeof(hp->magic)) != 0 ||
+	hp->version != DC_VERSION ||
+	hp->recsize != sizeof(DCREC) ||
+	/* Before sizing the table by it */
+	hp->nrecs > ((size_t) sb.st_size - sizeof(*hp)) / sizeof(DCREC))
+	goto Invalid;
+
+    for (old_size = 64; old_size < hp->nrecs*2; old_size *= 2)
+	;
+    old_tab = calloc(old_size, sizeof(*old_tab));
+    if (!old_tab)
+	abort();
+
+    pos = sizeof(*hp);
+    for (n = 0; n < hp->nrecs; n++) {
+	const DCREC *rp = (const DCREC *) (old_buf+pos);
+
+	if (pos+sizeof(*rp) > (size_t) sb.st_size ||
+	    pos+sizeof(*rp)+rp->subslen > (size_t) sb.st_size ||
+	    (rp->subslen > 0 && DCREC_SUBS(rp)[rp->subslen-1] != '\0'))
+	    goto Invalid;
+
+	/* scan_cached() steps through exactly nsubs names */
+	for (nsubs = 0, i = 0; i < rp->subslen; i++)
+	    if (DCREC_SUBS(rp)[i] == '\0')
+		nsubs++;
+	if (nsubs != rp->nsubs)
+	    goto Invalid;
+
+	for (i = dc_hash(rp->dev, rp->ino) & (old_size-1); old_tab[i]; i = (i+1) & (old_size-1))
+	    ;
+	old_tab[i] = rp;
+	pos += DC_PAD(sizeof(*rp)+rp->subslen);
+    }
+
+    return 0;
+
+ Invalid:
+    fprintf(stderr, "%s: Error: %s: Invalid directory cache - ignored\n",
+	    argv0, path);
+    free(old_tab);
+    old_tab = NULL;
+    old_size = 0;
+    free(old_buf);
+    old_buf = NULL;
+    return 0;
+}
+
+
+int
+dircache_save(const char *path) {
+    char *tmp;
+    FILE *fp;
+    DCHDR h;
+    int rc;
+
+
+    tmp = replace_tmpname(path);
+
+    fp = fopen(tmp, "w");
+    if (!fp)
+	goto Fail;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, DC_MAGIC, sizeof(h.magic));
+    h.version = DC_VERSION;
+    h.recsize = sizeof(DCREC);
+    h.nrecs = new_nrecs;
+
+    if (fwrite(&h, sizeof(h), 1, fp) != 1 ||
+	(new_len > 0 && fwrite(new_buf, new_len, 1, fp) != 1)) {
+	fclose(fp);
+	goto Fail;
+    }
+
+    rc = replace_fclose(fp, tmp, path);
+    free(tmp);
+    return rc;
+
+ Fail:
+    remove(tmp);
+    free(tmp);
+    return -1;
+}
+
+
+const DCREC *
+dircache_lookup(const struct stat *sp) {
+    const DCREC *rp;
+    size_t i;
+
+    if (!old_tab)
+	return NULL;
+
+    for (i = dc_hash(sp->st_dev, sp->st_ino) & (old_size-1);
+	 (rp = old_tab[i]) != NULL;
+	 i = (i+1) & (old_size-1))
+	if (rp->dev == (uint64_t) sp->st_dev && rp->ino == (uint64_t) sp->st_ino) {
+	    if (rp->mtime != sp->st_mtime || rp->mtime_ns != ST_MTIME_NS(sp) ||
+		rp->ctime != sp->st_ctime || rp->ctime_ns != ST_CTIME_NS(sp))
+		return NULL;
+	    return rp;
+	}
+
+    return NULL;
+}
+
+
+static void
+dc_append(const DCREC *rp,
+	  const char *subs) {
+    size_t len = DC_PAD(sizeof(*rp)+rp->subslen);
+
+    pthread_mutex_lock(&new_mtx);
+    if (new_len+len > new_size) {
+	new_size = (new_len+len)*2 + 64*1024;
+	new_buf = realloc(new_buf, new_size);
+	if (!new_buf)
+	    abort();
+    }
+    memcpy(new_buf+new_len, rp, sizeof(*rp));
+    memcpy(new_buf+new_len+sizeof(*rp), subs, rp->subslen);
+    memset(new_buf+new_len+sizeof(*rp)+rp->subslen, 0, len-sizeof(*rp)-rp->subslen);
+    new_len += len;
+    new_nrecs++;
+    pthread_mutex_unlock(&new_mtx);
+}
+
+
+/* Record a scanned directory - unless it had something to report */
+void
+dircache_add(const struct stat *sp,
+	     const COUNTERS *cp,
+	     unsigned long objects,
+	     const char *subs,
+	     size_t subslen,
+	     unsigned int nsubs) {
+    DCREC r;
+
+    if (!dircache_enabled)
+	return;
+
+    if (cp->nfd || cp->unknown || cp->coll || cp->unread)
+	return;
+
+    if (sp->st_mtime >= dc_start || sp->st_ctime >= dc_start)
+	return;
+
+    memset(&r, 0, sizeof(r));
+    r.dev = sp->st_dev;
+    r.ino = sp->st_ino;
+    r.mtime = sp->st_mtime;
+    r.mtime_ns = ST_MTIME_NS(sp);
+    r.ctime = sp->st_ctime;
+    r.ctime_ns = ST_CTIME_NS(sp);
+    r.objects = objects;
+    r.ascii = cp->ascii;
+    r.nfc = cp->nfc;
+    r.other = cp->other;
+    r.nsubs = nsubs;
+    r.subslen = subslen;
+
+    dc_append(&r, subs);
+}
+
+/* Carry an unchanged directory over to the new cache */
+void
+dircache_keep(const DCREC *rp) {
+    dc_append(rp, DCREC_SUBS(rp));
+}
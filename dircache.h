@@ -0,0 +1,93 @@
+/*
+ * dircache.h
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DIRCACHE_H
+#define DIRCACHE_H 1
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "pnfdscan.h"
+
+/*
+ * Persistent directory state cache, for incremental scans.
+ *
+ * Directories where nothing needed to be reported are recorded by
+ * (st_dev, st_ino) together with their mtime/ctime, the classification
+ * counts and the names of their subdirectories. If a directory is
+ * unchanged on the next run its entries are not read at all - only its
+ * subdirectories are visited.
+ */
+
+typedef struct dcrec {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime;
+    int64_t mtime_ns;
+    int64_t ctime;
+    int64_t ctime_ns;
+    uint64_t objects;
+    uint64_t ascii;
+    uint64_t nfc;
+    uint64_t other;
+    uint32_t nsubs;
+    uint32_t subslen;	/* NUL-terminated subdirectory names following the record */
+} DCREC;
+
+#define DCREC_SUBS(rp)	((const char *) ((rp)+1))
+
+
+extern int dircache_enabled;
+
+extern int
+dircache_load(const char *path);
+
+extern int
+dircache_save(const char *path);
+
+extern const DCREC *
+dircache_lookup(const struct stat *sp);
+
+extern void
+dircache_add(const struct stat *sp,
+	     const COUNTERS *cp,
+	     unsigned long objects,
+	     const char *subs,
+	     size_t subslen,
+	     unsigned int nsubs);
+
+extern void
+dircache_keep(const DCREC *rp);
+
+#endif
@@ -0,0 +1,808 @@
+/*
+ * index.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "pnfdscan.h"
+#include "output.h"
+#include "index.h"
+#include "replace.h"
+
+
+/*
+ * File format (native byte order, like the directory cache): IXHDR,
+ * then the node, directory, child and string tables, each 8-byte
+ * aligned. Node 0 is an unnamed top node with the roots below it.
+ */
+#define IX_MAGIC	"PNFDIDX\n"
+#define IX_VERSION	1
+#define IX_ORDER	0x01020304
+#define IX_NONE		0xffffffffU
+#define IXC_NONE	0xff		/* Not scanned - above a root */
+
+typedef struct ixhdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t order;
+    int64_t created;
+    uint64_t nodes;
+    uint64_t dirs;
+    uint64_t children;
+    uint64_t strings;	/* Size of the string table */
+    uint64_t nodes_off;
+    uint64_t dirs_off;
+    uint64_t children_off;
+    uint64_t strings_off;
+} IXHDR;
+
+typedef struct ixnode {
+    uint32_t parent;
+    uint32_t name;	/* Offset in the string table */
+    uint32_t end;	/* First node after everything below this one */
+    uint32_t dir;	/* IXDIR, or IX_NONE if nothing is below it */
+    int64_t mtime;	/* 0 = not known */
+    int64_t size;
+    uint8_t cls;	/* OC_xxx or IXC_NONE */
+    uint8_t coll;	/* OCOLL_xxx */
+    uint8_t reserved[6];
+} IXNODE;
+
+typedef struct ixdir {
+    uint32_t first;	/* Children (node numbers), sorted by name, in the child table */
+    uint32_t n;
+    uint64_t counts[IX_NCOUNTS];
+} IXDIR;
+
+struct ixfile {
+    char *map;
+    size_t size;
+    const IXHDR *hdr;
+    const IXNODE *nodes;
+    const IXDIR *dirs;
+    const uint32_t *children;
+    const char *strings;
+};
+
+
+/*
+ * Recorded objects - an IXREC followed by the path, padded to 8
+ * bytes, in per-thread chunks that are handed over to ix_chunks as
+ * they fill up (or the thread exits).
+ */
+#define IX_CHUNK	(1024*1024)
+#define IX_PAD(n)	(((n)+7) & ~(size_t) 7)
+
+typedef struct ixrec {
+    int64_t mtime;
+    int64_t size;
+    uint8_t cls;
+    uint8_t coll;
+    uint16_t reserved;
+    uint32_t len;	/* Record length, with the path and padding */
+} IXREC;
+
+typedef struct ixchunk {
+    struct ixchunk *next;
+    size_t size;
+    size_t len;
+    char buf[];
+} IXCHUNK;
+
+int index_enabled = 0;
+
+static pthread_once_t ix_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ix_key;
+static pthread_mutex_t ix_mtx = PTHREAD_MUTEX_INITIALIZER;
+static IXCHUNK *ix_chunks = NULL;
+
+
+static void
+ix_retire(void *vp) {
+    IXCHUNK *cp = (IXCHUNK *) vp;
+
+    pthread_mutex_lock(&ix_mtx);
+    cp->next = ix_chunks;
+    ix_chunks = cp;
+    pthread_mutex_unlock(&ix_mtx);
+}
+
+static void
+ix_key_create(void) {
+    if (pthread_key_create(&ix_key, ix_retire) != 0)
+	abort();
+}
+
+void
+index_add(const char *path,
+	  int cls,
+	  int coll,
+	  const struct stat *sp) {
+    IXCHUNK *cp;
+    IXREC *rp;
+    size_t plen, rlen;
+    char *dst;
+
+    if (!index_enabled)
+	return;
+
+    pthread_once(&ix_once, ix_key_create);
+    plen = strlen(path)+1;
+    rlen = IX_PAD(sizeof(IXREC)+plen);
+
+    cp = pthread_getspecific(ix_key);
+    if (!cp || cp->len+rlen > cp->size) {
+	size_t size = rlen > IX_CHUNK ? rlen : IX_CHUNK;
+
+	if (cp)
+	    ix_retire(cp);
+	cp = malloc(sizeof(*cp)+size);
+	if (!cp)
+	    abort();
+	cp->next = NULL;
+	cp->size = size;
+	cp->len = 0;
+	pthread_setspecific(ix_key, cp);
+    }
+
+    rp = (IXREC *) (cp->buf+cp->len);
+    rp->mtime = sp ? sp->st_mtime : 0;
+    rp->size = sp ? sp->st_size : 0;
+    rp->cls = cls;
+    rp->coll = coll;
+    rp->reserved = 0;
+    rp->len = rlen;
+
+    /* Without repeated or trailing slashes, so path order is tree order */
+    for (dst = (char *) (rp+1); *path; path++)
+	if (*path != '/' || (path[1] != '/' && (path[1] || dst == (char *) (rp+1))))
+	    *dst++ = *path;
+    *dst = '\0';
+    cp->len += rlen;
+}
+
+
+#define REC_PATH(rp)	((const char *) ((rp)+1))
+
+/*
+ * Path order, component by component - "a/b" before "a-b". Also the
+ * order of names in a directory (where the top one may have "/").
+ */
+static int
+path_cmp(const char *sa,
+	 const char *sb) {
+    const unsigned char *a = (const unsigned char *) sa;
+    const unsigned char *b = (const unsigned char *) sb;
+    int ca, cb;
+
+    while (*a && *a == *b)
+	a++, b++;
+    ca = (*a == '/' ? 1 : *a ? *a+1 : 0);
+    cb = (*b == '/' ? 1 : *b ? *b+1 : 0);
+    return ca - cb;
+}
+
+static int
+rec_cmp(const void *va,
+	const void *vb) {
+    return path_cmp(REC_PATH(*(const IXREC *const *) va), REC_PATH(*(const IXREC *const *) vb));
+}
+
+/*
+ * Split a path into components in place - "/a//b/" is "/", "a", "b".
+ * Returns the number of components, at most max.
+ */
+static int
+split_path(char *path,
+	   char **cv,
+	   int max) {
+    int n = 0;
+
+    if (*path == '/' && n < max) {
+	cv[n++] = "/";
+	while (*path == '/')
+	    path++;
+    }
+    while (*path && n < max) {
+	cv[n++] = path;
+	while (*path && *path != '/')
+	    path++;
+	while (*path == '/')
+	    *path++ = '\0';
+    }
+    return n;
+}
+
+
+/* Index being built */
+typedef struct ixbuild {
+    IXNODE *nodes;
+    size_t nodes_size;
+    size_t nnodes;
+    IXDIR *dirs;
+    size_t dirs_size;
+    size_t ndirs;
+    char *strings;
+    size_t strings_size;
+    size_t strings_len;
+    uint32_t *stab;	/* Interned strings hash table, offset+1 */
+    size_t stab_size;
+} IXBUILD;
+
+static uint32_t
+str_hash(const char *s) {
+    uint32_t h = 2166136261U;
+
+    while (*s)
+	h = (h ^ (unsigned char) *s++) * 16777619U;
+    return h;
+}
+
+static uint32_t
+intern(IXBUILD *bp,
+       const char *s) {
+    size_t i, len;
+    uint32_t off;
+
+    if (bp->strings_len*2 >= bp->stab_size) {
+	/* Grow (and rehash) the table - keep it at most half full */
+	size_t nsize = bp->stab_size ? bp->stab_size*2 : 64*1024;
+	uint32_t *ntab = calloc(nsize, sizeof(*ntab));
+	size_t k;
+
+	if (!ntab)
+	    abort();
+	for (k = 0; k < bp->stab_size; k++)
+	    if (bp->stab[k]) {
+		for (i = str_hash(bp->strings+bp->stab[k]-1) & (nsize-1); ntab[i]; i = (i+1) & (nsize-1))
+		    ;
+		ntab[i] = bp->stab[k];
+	    }
+	free(bp->stab);
+	bp->stab = ntab;
+	bp->stab_size = nsize;
+    }
+
+    for (i = str_hash(s) & (bp->stab_size-1); bp->stab[i]; i = (i+1) & (bp->stab_size-1))
+	if (strcmp(bp->strings+bp->stab[i]-1, s) == 0)
+	    return bp->stab[i]-1;
+
+    len = strlen(s)+1;
+    if (bp->strings_len+len > bp->strings_size) {
+	bp->strings_size = (bp->strings_size+len)*2;
+	bp->strings = realloc(bp->strings, bp->strings_size);
+	if (!bp->strings)
+	    abort();
+    }
+    off = bp->strings_len;
+    memcpy(bp->strings+off, s, len);
+    bp->strings_len += len;
+    bp->stab[i] = off+1;
+    return off;
+}
+
+static uint32_t
+add_node(IXBUILD *bp,
+	 uint32_t parent,
+	 const char *name) {
+    IXNODE *np;
+
+    if (bp->nnodes == bp->nodes_size) {
+	bp->nodes_size = bp->nodes_size ? bp->nodes_size*2 : 64*1024;
+	bp->nodes = realloc(bp->nodes, bp->nodes_size*sizeof(*bp->nodes));
+	if (!bp->nodes)
+	    abort();
+    }
+
+    if (parent != IX_NONE && bp->nodes[parent].dir == IX_NONE) {
+	if (bp->ndirs == bp->dirs_size) {
+	    bp->dirs_size = bp->dirs_size ? bp->dirs_size*2 : 16*1024;
+	    bp->dirs = realloc(bp->dirs, bp->dirs_size*sizeof(*bp->dirs));
+	    if (!bp->dirs)
+		abort();
+	}
+	memset(&bp->dirs[bp->ndirs], 0, sizeof(bp->dirs[0]));
+	bp->nodes[parent].dir = bp->ndirs++;
+    }
+
+    np = &bp->nodes[bp->nnodes];
+    memset(np, 0, sizeof(*np));
+    np->parent = parent;
+    np->name = intern(bp, name);
+    np->end = IX_NONE;
+    np->dir = IX_NONE;
+    np->cls = IXC_NONE;
+    return bp->nnodes++;
+}
+
+static void
+add_counts(uint64_t *counts,
+	   const IXNODE *np) {
+    switch (np->cls) {
+    case IXC_NONE:
+	return;
+    case OC_ASCII:
+	counts[IX_ASCII]++;
+	break;
+    case OC_NFC:
+	counts[IX_NFC]++;
+	break;
+    case OC_NFD:
+	counts[IX_NFD]++;
+	break;
+    case OC_UTF8:
+	/* Neither NFC nor NFD - the scan fixes (and counts) them as NFD too */
+	counts[IX_OTHER]++;
+	counts[IX_NFD]++;
+	break;
+    case OC_INVALID:
+	counts[IX_UNKNOWN]++;
+	break;
+    }
+    if (np->coll != OCOLL_NONE)
+	counts[IX_COLL]++;
+    counts[IX_OBJECTS]++;
+}
+
+static int
+write_section(FILE *fp,
+	      const void *buf,
+	      size_t len,
+	      uint64_t *offp) {
+    static const char zeros[8];
+    long pos = ftell(fp);
+
+    if (pos < 0)
+	return -1;
+    if (pos % 8) {
+	if (fwrite(zeros, 1, 8 - pos%8, fp) != 8 - (size_t) (pos%8))
+	    return -1;
+	pos += 8 - pos%8;
+    }
+    *offp = pos;
+    return (len == 0 || fwrite(buf, 1, len, fp) == len) ? 0 : -1;
+}
+
+int
+index_save(const char *path) {
+    IXBUILD b;
+    IXCHUNK *cp;
+    IXREC **rv;
+    IXHDR h;
+    uint32_t *children = NULL, *stack = NULL;
+    char **cv = NULL, *tmp, *pbuf = NULL;
+    size_t nrecs = 0, i, pos, cv_size = 0, pbuf_size = 0, sdepth, plen;
+    FILE *fp = NULL;
+    int rc = -1;
+
+
+    memset(&b, 0, sizeof(b));
+
+    /* The calling thread's records are still its own */
+    pthread_once(&ix_once, ix_key_create);
+    cp = pthread_getspecific(ix_key);
+    if (cp) {
+	pthread_setspecific(ix_key, NULL);
+	ix_retire(cp);
+    }
+
+    for (cp = ix_chunks; cp; cp = cp->next)
+	for (pos = 0; pos < cp->len; pos += ((IXREC *) (cp->buf+pos))->len)
+	    nrecs++;
+    rv = malloc((nrecs ? nrecs : 1)*sizeof(*rv));
+    if (!rv)
+	abort();
+    nrecs = 0;
+    for (cp = ix_chunks; cp; cp = cp->next)
+	for (pos = 0; pos < cp->len; pos += ((IXREC *) (cp->buf+pos))->len)
+	    rv[nrecs++] = (IXREC *) (cp->buf+pos);
+    qsort(rv, nrecs, sizeof(*rv), rec_cmp);
+
+    /*
+     * Build the tree. The stack holds the nodes of the previous path,
+     * which in path order shares a prefix with the next one and the
+     * nodes below that prefix are done (everything below them seen).
+     */
+    add_node(&b, IX_NONE, "");
+    stack = malloc(64*sizeof(*stack));
+    if (!stack)
+	abort();
+    stack[0] = 0;
+    sdepth = 1;
+
+    for (i = 0; i < nrecs; i++) {
+	IXREC *rp = rv[i];
+	size_t k, n;
+
+	plen = strlen(REC_PATH(rp))+1;
+	if (plen > pbuf_size) {
+	    pbuf_size = plen*2;
+	    pbuf = realloc(pbuf, pbuf_size);
+	    if (!pbuf)
+		abort();
+	}
+	memcpy(pbuf, REC_PATH(rp), plen);
+	if (plen > cv_size) {
+	    /* Never more components than half the length (+ "/") */
+	    cv_size = plen+1;
+	    cv = realloc(cv, cv_size*sizeof(*cv));
+	    stack = realloc(stack, (cv_size+1)*sizeof(*stack));
+	    if (!cv || !stack)
+		abort();
+	}
+	n = split_path(pbuf, cv, cv_size);
+	if (n == 0)
+	    continue;
+
+	for (k = 0; k < n && k+1 < sdepth &&
+		 strcmp(b.strings+b.nodes[stack[k+1]].name, cv[k]) == 0; k++)
+	    ;
+	while (sdepth > k+1)
+	    b.nodes[stack[--sdepth]].end = b.nnodes;
+	for (; k < n; k++) {
+	    uint32_t nn = add_node(&b, stack[sdepth-1], cv[k]);
+
+	    stack[sdepth++] = nn;
+	}
+
+	/* The same object recorded twice (overlapping roots) - first one wins */
+	if (b.nodes[stack[sdepth-1]].cls == IXC_NONE) {
+	    IXNODE *np = &b.nodes[stack[sdepth-1]];
+
+	    np->cls = rp->cls;
+	    np->coll = rp->coll;
+	    np->mtime = rp->mtime;
+	    np->size = rp->size;
+	}
+    }
+    while (sdepth > 0)
+	b.nodes[stack[--sdepth]].end = b.nnodes;
+
+    /* The objects are in the tree now */
+    free(rv);
+    while (ix_chunks) {
+	cp = ix_chunks;
+	ix_chunks = cp->next;
+	free(cp);
+    }
+
+    /* Children in name (= node) order, and counters from the bottom up */
+    for (i = 1; i < b.nnodes; i++)
+	b.dirs[b.nodes[b.nodes[i].parent].dir].n++;
+    for (pos = 0, i = 0; i < b.ndirs; i++) {
+	b.dirs[i].first = pos;
+	pos += b.dirs[i].n;
+	b.dirs[i].n = 0;
+    }
+    children = malloc((pos ? pos : 1)*sizeof(*children));
+    if (!children)
+	abort();
+    for (i = 1; i < b.nnodes; i++) {
+	IXDIR *dp = &b.dirs[b.nodes[b.nodes[i].parent].dir];
+
+	children[dp->first + dp->n++] = i;
+    }
+    for (i = b.nnodes; i-- > 1; ) {
+	IXNODE *np = &b.nodes[i];
+	IXDIR *pdp = &b.dirs[b.nodes[np->parent].dir];
+
+	add_counts(pdp->counts, np);
+	if (np->dir != IX_NONE) {
+	    int j;
+
+	    for (j = 0; j < IX_NCOUNTS; j++)
+		pdp->counts[j] += b.dirs[np->dir].counts[j];
+	}
+    }
+
+    /* Write it */
+    tmp = replace_tmpname(path);
+
+    fp = fopen(tmp, "w");
+    if (!fp)
+	goto End;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, IX_MAGIC, sizeof(h.magic));
+    h.version = IX_VERSION;
+    h.order = IX_ORDER;
+    h.created = time(NULL);
+    h.nodes = b.nnodes;
+    h.dirs = b.ndirs;
+    h.children = pos;
+    h.strings = b.strings_len;
+    if (fwrite(&h, sizeof(h), 1, fp) != 1 ||
+	write_section(fp, b.nodes, b.nnodes*sizeof(*b.nodes), &h.nodes_off) < 0 ||
+	write_section(fp, b.dirs, b.ndirs*sizeof(*b.dirs), &h.dirs_off) < 0 ||
+	write_section(fp, children, pos*sizeof(*children), &h.children_off) < 0 ||
+	write_section(fp, b.strings, b.strings_len, &h.strings_off) < 0 ||
+	fseek(fp, 0, SEEK_SET) < 0 ||
+	fwrite(&h, sizeof(h), 1, fp) != 1)
+	goto End;
+
+    rc = replace_fclose(fp, tmp, path);
+    fp = NULL;
+
+ End:
+    if (fp) {
+	fclose(fp);
+	remove(tmp);
+    }
+    free(tmp);
+    free(children);
+    free(stack);
+    free(cv);
+    free(pbuf);
+    free(b.nodes);
+    free(b.dirs);
+    free(b.strings);
+    free(b.stab);
+    return rc;
+}
+
+
+IXFILE *
+index_open(const char *path) {
+    IXFILE *ip;
+    struct stat sb;
+    const IXHDR *hp;
+    int fd;
+
+
+    fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+	return NULL;
+    if (fstat(fd, &sb) < 0) {
+	close(fd);
+	return NULL;
+    }
+
+    ip = calloc(1, sizeof(*ip));
+    if (!ip)
+	abort();
+    ip->size = sb.st_size;
+    if (ip->size < sizeof(IXHDR))
+	goto Invalid;
+
+    ip->map = mmap(NULL, ip->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    fd = -1;
+    if (ip->map == MAP_FAILED) {
+	free(ip);
+	return NULL;
+    }
+
+    hp = ip->hdr = (const IXHDR *) ip->map;
+    if (memcmp(hp->magic, IX_MAGIC, sizeof(hp->magic)) != 0 ||
+	hp->version != IX_VERSION || hp->order != IX_ORDER || hp->nodes < 1 || hp->dirs < 1 ||
+	hp->nodes_off > ip->size || hp->nodes > (ip->size - hp->nodes_off)/sizeof(IXNODE) ||
+	hp->dirs_off > ip->size || hp->dirs > (ip->size - hp->dirs_off)/sizeof(IXDIR) ||
+	hp->children_off > ip->size || hp->children > (ip->size - hp->children_off)/sizeof(uint32_t) ||
+	hp->strings_off > ip->size || hp->strings > ip->size - hp->strings_off ||
+	hp->strings < 1 || ip->map[hp->strings_off + hp->strings - 1] != '\0')
+	goto Invalid;
+
+    ip->nodes = (const IXNODE *) (ip->map + hp->nodes_off);
+    ip->dirs = (const IXDIR *) (ip->map + hp->dirs_off);
+    ip->children = (const uint32_t *) (ip->map + hp->children_off);
+    ip->strings = ip->map + hp->strings_off;
+    return ip;
+
+ Invalid:
+    if (fd >= 0)
+	close(fd);
+    index_close(ip);
+    errno = EINVAL;
+    return NULL;
+}
+
+void
+index_close(IXFILE *ip) {
+    if (!ip)
+	return;
+    if (ip->map && ip->map != MAP_FAILED)
+	munmap(ip->map, ip->size);
+    free(ip);
+}
+
+
+/* Node number of the named child of node p, or IX_NONE */
+static uint32_t
+find_child(const IXFILE *ip,
+	   uint32_t p,
+	   const char *name) {
+    const IXDIR *dp;
+    size_t lo, hi;
+
+    if (ip->nodes[p].dir >= ip->hdr->dirs)
+	return IX_NONE;
+    dp = &ip->dirs[ip->nodes[p].dir];
+    if (dp->first > ip->hdr->children || dp->n > ip->hdr->children - dp->first)
+	return IX_NONE;
+
+    for (lo = 0, hi = dp->n; lo < hi; ) {
+	size_t mid = (lo+hi)/2;
+	uint32_t c = ip->children[dp->first+mid];
+	int d;
+
+	if (c >= ip->hdr->nodes || ip->nodes[c].name >= ip->hdr->strings)
+	    return IX_NONE;
+	d = path_cmp(ip->strings+ip->nodes[c].name, name);
+	if (d == 0)
+	    return c;
+	if (d < 0)
+	    lo = mid+1;
+	else
+	    hi = mid;
+    }
+    return IX_NONE;
+}
+
+static const char *
+node_name(const IXFILE *ip,
+	  uint32_t i) {
+    return ip->nodes[i].name < ip->hdr->strings ? ip->strings+ip->nodes[i].name : "?";
+}
+
+/* Append a name to a path being built */
+static size_t
+path_add(char **bufp,
+	 size_t *sizep,
+	 size_t len,
+	 const char *name) {
+    size_t nlen = strlen(name);
+
+    if (len+nlen+2 > *sizep) {
+	*sizep = (len+nlen+2)*2;
+	*bufp = realloc(*bufp, *sizep);
+	if (!*bufp)
+	    abort();
+    }
+    if (len > 0 && (*bufp)[len-1] != '/')
+	(*bufp)[len++] = '/';
+    memcpy(*bufp+len, name, nlen+1);
+    return len+nlen;
+}
+
+int
+index_query(IXFILE *ip,
+	    const char *path,
+	    uint64_t *counts,
+	    void (*fn)(const char *path, int cls, int coll, const struct stat *sp, void *arg),
+	    void *arg) {
+    char *pcopy, **cv, *buf = NULL;
+    size_t *lenv = NULL, bsize = 0, len = 0;
+    uint32_t node = 0, *chain = NULL, i, end;
+    int n, k, j, depth;
+
+
+    pcopy = strdup(path);
+    cv = malloc((strlen(path)+2)*sizeof(*cv));
+    if (!pcopy || !cv)
+	abort();
+    n = split_path(pcopy, cv, strlen(path)+1);
+    for (k = 0; k < n && node != IX_NONE; k++)
+	node = find_child(ip, node, cv[k]);
+    free(pcopy);
+    free(cv);
+    if (node == IX_NONE) {
+	errno = ENOENT;
+	return -1;
+    }
+
+    memset(counts, 0, IX_NCOUNTS*sizeof(*counts));
+    add_counts(counts, &ip->nodes[node]);
+    if (ip->nodes[node].dir < ip->hdr->dirs)
+	for (j = 0; j < IX_NCOUNTS; j++)
+	    counts[j] += ip->dirs[ip->nodes[node].dir].counts[j];
+
+    if (!fn)
+	return 0;
+
+    /* The path of the node we start at */
+    for (depth = 0, i = node; i != 0 && i < ip->hdr->nodes; i = ip->nodes[i].parent)
+	depth++;
+    chain = malloc((depth+1)*sizeof(*chain));
+    if (!chain)
+	abort();
+    for (k = depth, i = node; k > 0; i = ip->nodes[i].parent)
+	chain[--k] = i;
+    for (k = 0; k < depth-1; k++)
+	len = path_add(&buf, &bsize, len, node_name(ip, chain[k]));
+    free(chain);
+
+    /*
+     * Walk the range in preorder. lenv[d] is the length of the path of
+     * the ancestor at relative depth d, found by following the parents
+     * back to one we have seen.
+     */
+    end = ip->nodes[node].end;
+    if (end > ip->hdr->nodes || end <= node)
+	end = node+1;
+    lenv = malloc(64*sizeof(*lenv));
+    if (!lenv)
+	abort();
+    {
+	size_t lsize = 64;
+	uint32_t *anc = malloc(64*sizeof(*anc));
+
+	if (!anc)
+	    abort();
+	depth = 0;
+	for (i = node; i < end; i++) {
+	    const IXNODE *np = &ip->nodes[i];
+
+	    /* Back up to the parent (always on the stack, in preorder) */
+	    while (depth > 0 && anc[depth-1] != np->parent)
+		depth--;
+	    if (i == node)
+		depth = 0;
+	    if ((size_t) depth+1 >= lsize) {
+		lsize *= 2;
+		lenv = realloc(lenv, lsize*sizeof(*lenv));
+		anc = realloc(anc, lsize*sizeof(*anc));
+		if (!lenv || !anc)
+		    abort();
+	    }
+
+	    lenv[depth] = path_add(&buf, &bsize, depth > 0 ? lenv[depth-1] : len, node_name(ip, i));
+	    anc[depth++] = i;
+
+	    if (np->cls != IXC_NONE) {
+		struct stat sb;
+
+		memset(&sb, 0, sizeof(sb));
+		sb.st_mtime = np->mtime;
+		sb.st_size = np->size;
+		fn(buf, np->cls, np->coll, np->mtime ? &sb : NULL, arg);
+	    }
+	}
+	free(anc);
+    }
+
+    free(lenv);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * index.h
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef INDEX_H
+#define INDEX_H 1
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * Scan result index (-y), for answering questions about a past scan
+ * (-q) without touching the filesystem.
+ *
+ * Every object classified by the walker is recorded (per thread, no
+ * locking) and when the scan is done they are sorted into a tree of
+ * path components, stored in preorder so that everything below an
+ * object is a contiguous range. Names are interned, directories have
+ * their children sorted by name (for binary search) and the counters
+ * of everything below them precomputed, so a subtree count is a few
+ * lookups in the mmap()ed file and a listing a linear walk.
+ */
+
+/* Subtree counters, as the scan counts them (IXDIR) */
+#define IX_ASCII	0
+#define IX_NFC		1
+#define IX_NFD		2
+#define IX_OTHER	3
+#define IX_UNKNOWN	4
+#define IX_COLL		5
+#define IX_OBJECTS	6
+#define IX_NCOUNTS	7
+
+typedef struct ixfile IXFILE;
+
+extern int index_enabled;
+
+/* Record an object (OC_xxx, OCOLL_xxx from output.h), sp may be NULL */
+extern void
+index_add(const char *path,
+	  int cls,
+	  int coll,
+	  const struct stat *sp);
+
+/* Build the index from everything recorded and write it */
+extern int
+index_save(const char *path);
+
+extern IXFILE *
+index_open(const char *path);
+
+extern void
+index_close(IXFILE *ip);
+
+/*
+ * Counters for everything at and below path ("" = all) and, if fn
+ * isn't NULL, call it for every object there in path order (sp has
+ * only the mtime & size, NULL if not known). -1 with
+ * errno ENOENT if the path isn't in the index.
+ */
+extern int
+index_query(IXFILE *ip,
+	    const char *path,
+	    uint64_t *counts,
+	    void (*fn)(const char *path, int cls, int coll, const struct stat *sp, void *arg),
+	    void *arg);
+
+#endif
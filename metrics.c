@@ -0,0 +1,505 @@
+/*
+ * metrics.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "pnfdscan.h"
+#include "metrics.h"
+#include "throttle.h"
+#include "replace.h"
+
+
+#define MH_BUCKETS	40	/* Bucket b counts [2^b, 2^(b+1)) ns */
+#define M_TICK_NS	100000000ULL		/* Reporter wakeup */
+#define M_PROGRESS_NS	1000000000ULL
+#define M_PROM_NS	10000000000ULL		/* Textfile rewrite */
+
+typedef struct mphase {
+    uint64_t started;	/* Timed operations started */
+    uint64_t count;	/* All operations */
+    uint64_t timed;	/* Timed operations done */
+    uint64_t ns;
+    uint64_t max_ns;
+    uint64_t hist[MH_BUCKETS];
+} MPHASE;
+
+typedef struct mthread {
+    MPHASE p[MP_PHASES];
+    unsigned int sample;
+    struct mthread *prev;
+    struct mthread *next;
+} MTHREAD;
+
+
+int metrics_enabled = 0;
+
+static const char *phase_names[MP_PHASES] = {
+    "readdir", "stat", "classify", "normalize", "collision", "rename"
+};
+
+static pthread_once_t m_once = PTHREAD_ONCE_INIT;
+static pthread_key_t m_key;
+static pthread_mutex_t m_mtx = PTHREAD_MUTEX_INITIALIZER;
+static MTHREAD *m_threads = NULL;
+static MPHASE m_retired[MP_PHASES];
+
+static uint64_t m_t0 = 0;
+static int m_tty = 0;
+static const char *m_promfile = NULL;
+static volatile sig_atomic_t m_signalled = 0;
+
+static pthread_t m_tid;
+static int m_running = 0;
+static int m_quit = 0;
+static pthread_mutex_t m_cv_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t m_cv = PTHREAD_COND_INITIALIZER;
+
+
+/* Updates of our own counters that the reporter thread may read at any time */
+#define M_ADD(x, n)	__atomic_store_n(&(x), (x)+(n), __ATOMIC_RELAXED)
+#define M_GET(x)	__atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+
+static uint64_t
+now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec*1000000000ULL + ts.tv_nsec + 1;
+}
+
+static void
+m_add_phases(MPHASE *dst,
+	     MPHASE *src) {
+    int i, b;
+
+    for (i = 0; i < MP_PHASES; i++) {
+	MPHASE *d = &dst[i], *s = &src[i];
+	uint64_t max_ns = M_GET(s->max_ns);
+
+	d->started += M_GET(s->started);
+	d->count += M_GET(s->count);
+	d->timed += M_GET(s->timed);
+	d->ns += M_GET(s->ns);
+	if (max_ns > d->max_ns)
+	    d->max_ns = max_ns;
+	for (b = 0; b < MH_BUCKETS; b++)
+	    d->hist[b] += M_GET(s->hist[b]);
+    }
+}
+
+/* Thread exit - keep what it counted */
+static void
+m_thread_free(void *vp) {
+    MTHREAD *mt = (MTHREAD *) vp;
+
+    pthread_mutex_lock(&m_mtx);
+    m_add_phases(m_retired, mt->p);
+    if (mt->prev)
+	mt->prev->next = mt->next;
+    else
+	m_threads = mt->next;
+    if (mt->next)
+	mt->next->prev = mt->prev;
+    pthread_mutex_unlock(&m_mtx);
+
+    free(mt);
+}
+
+static void
+m_key_create(void) {
+    if (pthread_key_create(&m_key, m_thread_free) != 0)
+	abort();
+}
+
+static MTHREAD *
+m_get(void) {
+    MTHREAD *mt;
+
+    pthread_once(&m_once, m_key_create);
+    mt = pthread_getspecific(m_key);
+    if (mt)
+	return mt;
+
+    mt = calloc(1, sizeof(*mt));
+    if (!mt)
+	abort();
+
+    pthread_mutex_lock(&m_mtx);
+    mt->next = m_threads;
+    if (m_threads)
+	m_threads->prev = mt;
+    m_threads = mt;
+    pthread_mutex_unlock(&m_mtx);
+
+    pthread_setspecific(m_key, mt);
+    return mt;
+}
+
+static void
+m_sum(MPHASE *pv) {
+    MTHREAD *mt;
+
+    memset(pv, 0, MP_PHASES*sizeof(*pv));
+    pthread_mutex_lock(&m_mtx);
+    m_add_phases(pv, m_retired);
+    for (mt = m_threads; mt; mt = mt->next)
+	m_add_phases(pv, mt->p);
+    pthread_mutex_unlock(&m_mtx);
+}
+
+
+/*
+ * Start timing an operation. Returns 0 if this one isn't timed, which
+ * is then just counted by m_stop().
+ */
+uint64_t
+m_start(int phase) {
+    MTHREAD *mt;
+
+    if (!metrics_enabled)
+	return 0;
+
+    mt = m_get();
+    if (phase == MP_CLASSIFY || phase == MP_NORMALIZE) {
+	if (++mt->sample < MS_SAMPLE)
+	    return 0;
+	mt->sample = 0;
+    }
+
+    M_ADD(mt->p[phase].started, 1);
+    return now_ns();
+}
+
+/*
+ * Count n operations, and their latency if t0 is from m_start(). The
+ * metadata phases are also where the throttle (-T) gets to sleep.
+ */
+void
+m_stop(int phase,
+       uint64_t t0,
+       unsigned int n) {
+    MPHASE *pp = &m_get()->p[phase];
+    uint64_t dt = 0;
+    int b;
+
+    M_ADD(pp->count, n);
+    if (t0) {
+	dt = now_ns() - t0;
+	for (b = 0; b < MH_BUCKETS-1 && (dt >> (b+1)) != 0; b++)
+	    ;
+
+	M_ADD(pp->timed, 1);
+	M_ADD(pp->ns, dt);
+	M_ADD(pp->hist[b], 1);
+	if (dt > pp->max_ns)
+	    __atomic_store_n(&pp->max_ns, dt, __ATOMIC_RELAXED);
+    }
+
+    if (throttle_enabled && phase != MP_CLASSIFY && phase != MP_NORMALIZE)
+	throttle_ops(phase, n, dt);
+}
+
+
+static char *
+fmt_ns(char *buf,
+       size_t size,
+       double ns) {
+    if (ns < 1000)
+	snprintf(buf, size, "%.0fns", ns);
+    else if (ns < 1e6)
+	snprintf(buf, size, "%.1fus", ns/1e3);
+    else if (ns < 1e9)
+	snprintf(buf, size, "%.1fms", ns/1e6);
+    else
+	snprintf(buf, size, "%.2fs", ns/1e9);
+    return buf;
+}
+
+/* Upper bound of the bucket holding the q:th quantile */
+static double
+m_quantile(const MPHASE *pp,
+	   double q) {
+    uint64_t n = 0, want = (uint64_t) (q*pp->timed + 0.5);
+    int b;
+
+    if (want < 1)
+	want = 1;
+    for (b = 0; b < MH_BUCKETS; b++) {
+	n += pp->hist[b];
+	if (n >= want)
+	    break;
+    }
+    return b < MH_BUCKETS && (1ULL << (b+1)) < pp->max_ns ? (double) (1ULL << (b+1)) : (double) pp->max_ns;
+}
+
+
+/* Dump the counters & latencies to stderr */
+void
+metrics_dump(void) {
+    MPHASE pv[MP_PHASES];
+    double dt = (now_ns() - m_t0)/1e9;
+    unsigned long objects = __atomic_load_n(&n_objects, __ATOMIC_RELAXED);
+    int i;
+
+
+    m_sum(pv);
+
+    fprintf(stderr, "[metrics: %.1f s, %lu objects (%.0f o/s)]\n",
+	    dt, objects, dt > 0 ? objects/dt : 0.0);
+    fprintf(stderr, "  %-10s %12s %10s %8s %9s %9s %9s %9s %9s\n",
+	    "phase", "ops", "timed", "inflight", "avg", "p50", "p90", "p99", "max");
+
+    for (i = 0; i < MP_PHASES; i++) {
+	MPHASE *pp = &pv[i];
+	char b1[32], b2[32], b3[32], b4[32], b5[32];
+
+	if (!pp->timed) {
+	    fprintf(stderr, "  %-10s %12llu %10s %8s\n",
+		    phase_names[i], (unsigned long long) pp->count, "-", "-");
+	    continue;
+	}
+
+	fprintf(stderr, "  %-10s %12llu %10llu %8llu %9s %9s %9s %9s %9s\n",
+		phase_names[i],
+		(unsigned long long) pp->count,
+		(unsigned long long) pp->timed,
+		(unsigned long long) (pp->started > pp->timed ? pp->started - pp->timed : 0),
+		fmt_ns(b1, sizeof(b1), (double) pp->ns/pp->timed),
+		fmt_ns(b2, sizeof(b2), m_quantile(pp, 0.50)),
+		fmt_ns(b3, sizeof(b3), m_quantile(pp, 0.90)),
+		fmt_ns(b4, sizeof(b4), m_quantile(pp, 0.99)),
+		fmt_ns(b5, sizeof(b5), (double) pp->max_ns));
+    }
+}
+
+
+/* Prometheus node_exporter textfile, replaced atomically */
+static int
+m_write_prom(const char *path) {
+    MPHASE pv[MP_PHASES];
+    char *tmp;
+    FILE *fp;
+    int i, b;
+
+
+    m_sum(pv);
+
+    tmp = replace_tmpname(path);
+
+    fp = fopen(tmp, "w");
+    if (!fp) {
+	free(tmp);
+	return -1;
+    }
+
+    fprintf(fp, "# HELP pnfdscan_elapsed_seconds Time since the scan started.\n");
+    fprintf(fp, "# TYPE pnfdscan_elapsed_seconds gauge\n");
+    fprintf(fp, "pnfdscan_elapsed_seconds %.3f\n", (now_ns() - m_t0)/1e9);
+    fprintf(fp, "# HELP pnfdscan_objects_total Objects scanned.\n");
+    fprintf(fp, "# TYPE pnfdscan_objects_total counter\n");
+    fprintf(fp, "pnfdscan_objects_total %lu\n", __atomic_load_n(&n_objects, __ATOMIC_RELAXED));
+
+    fprintf(fp, "# HELP pnfdscan_phase_operations_total Operations per phase.\n");
+    fprintf(fp, "# TYPE pnfdscan_phase_operations_total counter\n");
+    for (i = 0; i < MP_PHASES; i++)
+	fprintf(fp, "pnfdscan_phase_operations_total{phase=\"%s\"} %llu\n",
+		phase_names[i], (unsigned long long) pv[i].count);
+
+    fprintf(fp, "# HELP pnfdscan_phase_inflight Timed operations in progress per phase.\n");
+    fprintf(fp, "# TYPE pnfdscan_phase_inflight gauge\n");
+    for (i = 0; i < MP_PHASES; i++)
+	fprintf(fp, "pnfdscan_phase_inflight{phase=\"%s\"} %llu\n",
+		phase_names[i],
+		(unsigned long long) (pv[i].started > pv[i].timed ? pv[i].started - pv[i].timed : 0));
+
+    fprintf(fp, "# HELP pnfdscan_phase_seconds Latency of the timed (sampled) operations per phase.\n");
+    fprintf(fp, "# TYPE pnfdscan_phase_seconds histogram\n");
+    for (i = 0; i < MP_PHASES; i++) {
+	uint64_t n = 0;
+
+	for (b = 0; b < MH_BUCKETS; b++) {
+	    n += pv[i].hist[b];
+	    fprintf(fp, "pnfdscan_phase_seconds_bucket{phase=\"%s\",le=\"%g\"} %llu\n",
+		    phase_names[i], (double) (1ULL << (b+1))/1e9, (unsigned long long) n);
+	}
+	fprintf(fp, "pnfdscan_phase_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %llu\n",
+		phase_names[i], (unsigned long long) pv[i].timed);
+	fprintf(fp, "pnfdscan_phase_seconds_sum{phase=\"%s\"} %.9f\n",
+		phase_names[i], pv[i].ns/1e9);
+	fprintf(fp, "pnfdscan_phase_seconds_count{phase=\"%s\"} %llu\n",
+		phase_names[i], (unsigned long long) pv[i].timed);
+    }
+
+    i = replace_fclose(fp, tmp, path);
+    free(tmp);
+    return i;
+}
+
+
+/* Objects scanned and the rate, as a one-line status on a terminal */
+void
+metrics_progress(int last_f) {
+    static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+    static uint64_t last = 0;
+    static unsigned long last_n_objects = 0;
+    unsigned long objects;
+    uint64_t now;
+    double dt;
+
+    if (!m_tty)
+	return;
+
+    pthread_mutex_lock(&mtx);
+
+    now = now_ns();
+    if (!last)
+	last = m_t0;
+    objects = __atomic_load_n(&n_objects, __ATOMIC_RELAXED);
+
+    if (last_f) {
+	dt = (now - m_t0)/1e9;
+	fprintf(stderr, "[%lu scanned, %.0f o/s]       \n", objects, dt > 0 ? objects/dt : 0.0);
+    } else {
+	dt = (now - last)/1e9;
+	fprintf(stderr, "[%lu scanned, %.0f o/s]       \r",
+		objects, dt > 0 ? (objects - last_n_objects)/dt : 0.0);
+    }
+    last_n_objects = objects;
+    last = now;
+
+    pthread_mutex_unlock(&mtx);
+}
+
+
+static void
+m_signal(int sig) {
+    (void) sig;
+    m_signalled = 1;
+}
+
+static void *
+m_reporter(void *vp) {
+    uint64_t last_progress, last_prom, now;
+    struct timespec ts;
+
+    (void) vp;
+    last_progress = last_prom = now_ns();
+
+    pthread_mutex_lock(&m_cv_mtx);
+    while (!m_quit) {
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += M_TICK_NS;
+	if (ts.tv_nsec >= 1000000000) {
+	    ts.tv_sec++;
+	    ts.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait(&m_cv, &m_cv_mtx, &ts);
+	if (m_quit)
+	    break;
+	pthread_mutex_unlock(&m_cv_mtx);
+
+	now = now_ns();
+	if (m_signalled) {
+	    m_signalled = 0;
+	    metrics_dump();
+	}
+	if (now - last_progress >= M_PROGRESS_NS) {
+	    metrics_progress(0);
+	    last_progress = now;
+	}
+	if (m_promfile && now - last_prom >= M_PROM_NS) {
+	    if (m_write_prom(m_promfile) < 0)
+		fprintf(stderr, "%s: Error: %s: Writing metrics: %s\n",
+			argv0, m_promfile, strerror(errno));
+	    last_prom = now;
+	}
+
+	pthread_mutex_lock(&m_cv_mtx);
+    }
+    pthread_mutex_unlock(&m_cv_mtx);
+
+    return NULL;
+}
+
+
+/* Start the reporter thread. promfile is the Prometheus textfile, or NULL */
+int
+metrics_start(const char *promfile) {
+    struct sigaction sa;
+
+    m_t0 = now_ns();
+    m_tty = isatty(fileno(stderr));
+    m_promfile = promfile;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = m_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+#ifdef SIGINFO
+    sigaction(SIGINFO, &sa, NULL);
+#endif
+
+    if (pthread_create(&m_tid, NULL, m_reporter, NULL) != 0)
+	return -1;
+    m_running = 1;
+    return 0;
+}
+
+/* Stop the reporter thread and write the final textfile */
+void
+metrics_stop(void) {
+    if (m_running) {
+	pthread_mutex_lock(&m_cv_mtx);
+	m_quit = 1;
+	pthread_cond_signal(&m_cv);
+	pthread_mutex_unlock(&m_cv_mtx);
+	pthread_join(m_tid, NULL);
+	m_running = 0;
+    }
+
+    if (m_promfile && m_write_prom(m_promfile) < 0)
+	fprintf(stderr, "%s: Error: %s: Writing metrics: %s\n",
+		argv0, m_promfile, strerror(errno));
+}
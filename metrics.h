@@ -0,0 +1,85 @@
+/*
+ * metrics.h
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H 1
+
+#include <stdint.h>
+
+/*
+ * Progress & per-phase instrumentation.
+ *
+ * Every phase keeps an operation count. With metrics enabled (-m or
+ * -M) operations are also timed with the monotonic clock - all the
+ * ones that make system calls, every MS_SAMPLE:th of the pure CPU
+ * phases - into log2 latency histograms.
+ *
+ * Each thread updates its own counters. A reporter thread does the
+ * progress display, dumps the metrics on SIGUSR1 (and SIGINFO) and
+ * rewrites the Prometheus textfile, so nothing of that is done in
+ * the scanning threads.
+ */
+
+#define MP_READDIR	0	/* Reading a directory */
+#define MP_STAT		1	/* Object metadata (single or batched) */
+#define MP_CLASSIFY	2	/* ASCII / UTF-8 check of a name */
+#define MP_NORMALIZE	3	/* NFC/NFD check & conversion */
+#define MP_COLLISION	4	/* Looking for an NFC twin */
+#define MP_RENAME	5	/* Renames & removals */
+#define MP_PHASES	6
+
+#define MS_SAMPLE	32	/* Time one out of this many CPU phase operations */
+
+extern int metrics_enabled;
+
+extern uint64_t
+m_start(int phase);
+
+extern void
+m_stop(int phase,
+       uint64_t t0,
+       unsigned int n);
+
+extern int
+metrics_start(const char *promfile);
+
+extern void
+metrics_progress(int last_f);
+
+extern void
+metrics_dump(void);
+
+extern void
+metrics_stop(void);
+
+#endif
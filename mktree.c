@@ -0,0 +1,360 @@
+/*
+ * mktree.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Generate reproducible synthetic directory trees for benchmarking.
+ *
+ * The same seed and parameters always give the same names, the same
+ * NFC/NFD mix and the same timestamps.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+char *argv0 = "mktree";
+
+unsigned int depth = 3;
+unsigned int fanout = 4;
+unsigned int entries = 100;
+unsigned int flat = 0;
+unsigned int deep = 0;
+unsigned int p_nfc = 10;
+unsigned int p_nfd = 10;
+unsigned int p_coll = 2;
+
+unsigned long n_dirs = 0;
+unsigned long n_files = 0;
+
+static uint64_t rng_state = 1;
+
+
+/* Accented letters as NFC and NFD UTF-8 */
+static const struct {
+    const char *nfc;
+    const char *nfd;
+} accents[] = {
+    { "\xc3\xa5", "a\xcc\x8a" },	/* å */
+    { "\xc3\xa4", "a\xcc\x88" },	/* ä */
+    { "\xc3\xb6", "o\xcc\x88" },	/* ö */
+    { "\xc3\xa9", "e\xcc\x81" },	/* é */
+    { "\xc3\xbc", "u\xcc\x88" },	/* ü */
+    { "\xc3\xb1", "n\xcc\x83" },	/* ñ */
+    { "\xc3\xa7", "c\xcc\xa7" },	/* ç */
+    { "\xc3\x85", "A\xcc\x8a" },	/* Å */
+};
+
+#define N_ACCENTS	(sizeof(accents)/sizeof(accents[0]))
+
+#define NAME_ASCII	0
+#define NAME_NFC	1
+#define NAME_NFD	2
+#define NAME_COLL	3
+
+
+/* xorshift64* */
+static uint32_t
+rnd(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t) ((rng_state * 2685821657736338717ULL) >> 32);
+}
+
+static int
+rnd_kind(void) {
+    unsigned int r = rnd() % 100;
+
+    if (r < p_coll)
+	return NAME_COLL;
+    if (r < p_coll+p_nfd)
+	return NAME_NFD;
+    if (r < p_coll+p_nfd+p_nfc)
+	return NAME_NFC;
+    return NAME_ASCII;
+}
+
+/*
+ * Build a name in both forms. Names are made unique within their
+ * directory by the sequence number.
+ */
+static void
+mkname(char *nfc,
+       char *nfd,
+       size_t size,
+       const char *prefix,
+       unsigned int seq,
+       int accented) {
+    size_t clen, dlen;
+    unsigned int i, len = 3 + rnd() % 10;
+
+    clen = dlen = snprintf(nfc, size, "%s%u-", prefix, seq);
+    memcpy(nfd, nfc, clen+1);
+
+    for (i = 0; i < len && clen+4 < size && dlen+4 < size; i++) {
+	if (accented && (i == 0 || rnd() % 3 == 0)) {
+	    unsigned int a = rnd() % N_ACCENTS;
+
+	    strcpy(nfc+clen, accents[a].nfc);
+	    strcpy(nfd+dlen, accents[a].nfd);
+	    clen += strlen(accents[a].nfc);
+	    dlen += strlen(accents[a].nfd);
+	} else {
+	    nfc[clen++] = nfd[dlen++] = 'a' + rnd() % 26;
+	    nfc[clen] = nfd[dlen] = '\0';
+	}
+    }
+}
+
+static void
+set_mtime(int dfd,
+	  const char *name,
+	  time_t t) {
+    struct timespec tv[2];
+
+    tv[0].tv_sec = tv[1].tv_sec = t;
+    tv[0].tv_nsec = tv[1].tv_nsec = 0;
+    (void) utimensat(dfd, name, tv, AT_SYMLINK_NOFOLLOW);
+}
+
+static void
+mkfile(int dfd,
+       const char *name) {
+    int fd = openat(dfd, name, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+	if (errno == EEXIST)
+	    return;
+	fprintf(stderr, "%s: Error: %s: Create: %s\n", argv0, name, strerror(errno));
+	exit(1);
+    }
+    close(fd);
+    set_mtime(dfd, name, 1500000000 + rnd() % 100000000);
+    n_files++;
+}
+
+static int
+mkdir_at(int dfd,
+	 const char *name) {
+    int fd;
+
+    if (mkdirat(dfd, name, 0755) < 0 && errno != EEXIST) {
+	fprintf(stderr, "%s: Error: %s: Mkdir: %s\n", argv0, name, strerror(errno));
+	exit(1);
+    }
+    fd = openat(dfd, name, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd < 0) {
+	fprintf(stderr, "%s: Error: %s: Open: %s\n", argv0, name, strerror(errno));
+	exit(1);
+    }
+    n_dirs++;
+    return fd;
+}
+
+/* Create an object named according to a random kind */
+static void
+mkentry(int dfd,
+	const char *prefix,
+	unsigned int seq,
+	int is_dir,
+	int *fdp) {
+    char nfc[256], nfd[256];
+    int kind = rnd_kind();
+
+    mkname(nfc, nfd, sizeof(nfc), prefix, seq, kind != NAME_ASCII);
+
+    if (kind == NAME_COLL) {
+	/* Both forms - with different timestamps */
+	if (is_dir)
+	    close(mkdir_at(dfd, nfc));
+	else
+	    mkfile(dfd, nfc);
+	set_mtime(dfd, nfc, 1400000000 + rnd() % 200000000);
+    }
+
+    if (is_dir)
+	*fdp = mkdir_at(dfd, kind == NAME_NFC ? nfc : nfd);
+    else
+	mkfile(dfd, kind == NAME_NFC ? nfc : nfd);
+}
+
+static void
+mklevel(int dfd,
+	unsigned int level) {
+    unsigned int i;
+
+    for (i = 0; i < entries; i++)
+	mkentry(dfd, "f", i, 0, NULL);
+
+    if (level >= depth)
+	return;
+
+    for (i = 0; i < fanout; i++) {
+	int fd;
+
+	mkentry(dfd, "d", i, 1, &fd);
+	mklevel(fd, level+1);
+	close(fd);
+    }
+}
+
+
+int
+main(int argc,
+     char *argv[]) {
+    int i, fd;
+    unsigned long seed = 1;
+    unsigned int *vp;
+
+
+    argv0 = argv[0];
+
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+	int c = argv[i][1];
+	const char *arg;
+
+	if (c == 'h') {
+	    printf("Usage:\n  %s [<options>*] <dir>\n", argv[0]);
+	    puts("\nOptions:");
+	    puts("  -h          Display this");
+	    puts("  -s <n>      Random seed (default: 1)");
+	    puts("  -d <n>      Directory depth (default: 3)");
+	    puts("  -w <n>      Subdirectories per directory (default: 4)");
+	    puts("  -e <n>      Files per directory (default: 100)");
+	    puts("  -F <n>      Also create a flat directory with <n> files");
+	    puts("  -L <n>      Also create a chain of <n> nested directories");
+	    puts("  -c <pct>    Percentage of NFC names (default: 10)");
+	    puts("  -n <pct>    Percentage of NFD names (default: 10)");
+	    puts("  -x <pct>    Percentage of NFD names with an NFC twin (default: 2)");
+	    exit(0);
+	}
+
+	if (!c || argv[i][2] || i+1 >= argc) {
+	    fprintf(stderr, "%s: Error: %s: Invalid switch\n", argv[0], argv[i]);
+	    exit(1);
+	}
+	arg = argv[++i];
+
+	switch (c) {
+	case 's':
+	    seed = strtoul(arg, NULL, 0);
+	    continue;
+	case 'd':
+	    vp = &depth;
+	    break;
+	case 'w':
+	    vp = &fanout;
+	    break;
+	case 'e':
+	    vp = &entries;
+	    break;
+	case 'F':
+	    vp = &flat;
+	    break;
+	case 'L':
+	    vp = &deep;
+	    break;
+	case 'c':
+	    vp = &p_nfc;
+	    break;
+	case 'n':
+	    vp = &p_nfd;
+	    break;
+	case 'x':
+	    vp = &p_coll;
+	    break;
+	default:
+	    fprintf(stderr, "%s: Error: -%c: Invalid switch\n", argv[0], c);
+	    exit(1);
+	}
+
+	if (sscanf(arg, "%u", vp) != 1) {
+	    fprintf(stderr, "%s: Error: -%c: %s: Invalid number\n", argv[0], c, arg);
+	    exit(1);
+	}
+    }
+
+    if (i+1 != argc) {
+	fprintf(stderr, "%s: Error: Missing or extra arguments (use -h for help)\n", argv[0]);
+	exit(1);
+    }
+    if (p_nfc+p_nfd+p_coll > 100) {
+	fprintf(stderr, "%s: Error: NFC, NFD and collision percentages add up to more than 100\n", argv[0]);
+	exit(1);
+    }
+
+    rng_state = seed ? seed : 1;
+
+    fd = mkdir_at(AT_FDCWD, argv[i]);
+    mklevel(fd, 0);
+
+    if (flat > 0) {
+	unsigned int saved = entries;
+	int ffd = mkdir_at(fd, "flat");
+
+	entries = flat;
+	mklevel(ffd, depth);
+	entries = saved;
+	close(ffd);
+    }
+
+    if (deep > 0) {
+	int dfd = dup(fd);
+	unsigned int k;
+
+	for (k = 0; k < deep; k++) {
+	    char name[64];
+	    int nfd;
+
+	    snprintf(name, sizeof(name), "deep-%03u-abcdefghijklmnopqrstuvwxyz", k);
+	    nfd = mkdir_at(dfd, name);
+	    mkentry(nfd, "f", 0, 0, NULL);
+	    close(dfd);
+	    dfd = nfd;
+	}
+	close(dfd);
+    }
+
+    close(fd);
+    printf("%lu directories, %lu files\n", n_dirs, n_files);
+    return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * mkunitab.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Generate unitab.h - a two-level lookup table with the normalization
+ * properties of all Unicode code points, as known by the ICU library we
+ * are linked with.
+ *
+ * Each code point maps to a 16 bit property word with the canonical
+ * combining class in the low 8 bits and UT_xxx flags above it. Since
+ * there are only a few distinct property words the second level stores
+ * 8 bit indexes into a property word table, and identical second level
+ * blocks are shared.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unicode/utypes.h>
+#include <unicode/uchar.h>
+#include <unicode/unorm2.h>
+#include <unicode/uversion.h>
+
+#include "unitabdef.h"
+
+
+#define MAXCP		0x110000
+#define NBLOCKS		(MAXCP >> UNITAB_SHIFT)
+#define BLOCKSIZE	(1 << UNITAB_SHIFT)
+
+
+static uint16_t props[256];
+static int n_props = 0;
+
+static uint8_t blocks[NBLOCKS][BLOCKSIZE];
+static int n_blocks = 0;
+
+static uint16_t stage1[NBLOCKS];
+
+
+static int
+prop_index(uint16_t p) {
+    int i;
+
+    for (i = 0; i < n_props; i++)
+	if (props[i] == p)
+	    return i;
+
+    if (n_props == 256) {
+	fprintf(stderr, "mkunitab: Error: Too many distinct property words\n");
+	exit(1);
+    }
+    props[n_props] = p;
+    return n_props++;
+}
+
+
+static uint16_t
+cp_props(UChar32 c) {
+    uint16_t p = u_getCombiningClass(c);
+
+    if (u_getIntPropertyValue(c, UCHAR_NFD_QUICK_CHECK) != UNORM_YES)
+	p |= UT_NFD_NO;
+
+    switch (u_getIntPropertyValue(c, UCHAR_NFC_QUICK_CHECK)) {
+    case UNORM_NO:
+	p |= UT_NFC_NO;
+	break;
+    case UNORM_MAYBE:
+	p |= UT_NFC_MAYBE;
+	break;
+    }
+
+    return p;
+}
+
+
+int
+main(int argc,
+     char *argv[]) {
+    UVersionInfo uv;
+    char uvbuf[U_MAX_VERSION_STRING_LENGTH];
+    uint8_t block[BLOCKSIZE];
+    int b, i;
+
+
+    /* Make sure the property word for "nothing special" gets index 0 */
+    prop_index(0);
+
+    for (b = 0; b < NBLOCKS; b++) {
+	for (i = 0; i < BLOCKSIZE; i++)
+	    block[i] = prop_index(cp_props((b << UNITAB_SHIFT) | i));
+
+	for (i = 0; i < n_blocks && memcmp(blocks[i], block, BLOCKSIZE) != 0; i++)
+	    ;
+	if (i == n_blocks)
+	    memcpy(blocks[n_blocks++], block, BLOCKSIZE);
+	stage1[b] = i;
+    }
+
+    u_getUnicodeVersion(uv);
+    u_versionToString(uv, uvbuf);
+
+    printf("/*\n * unitab.h - generated by mkunitab (Unicode %s) - do not edit\n */\n\n", uvbuf);
+    printf("#define UNITAB_NPROPS\t%d\n", n_props);
+    printf("#define UNITAB_NBLOCKS\t%d\n\n", n_blocks);
+
+    printf("static const uint16_t unitab_props[%d] = {", n_props);
+    for (i = 0; i < n_props; i++)
+	printf("%s0x%04x,", i % 8 ? " " : "\n    ", props[i]);
+    printf("\n};\n\n");
+
+    printf("static const %s unitab_stage1[%d] = {",
+	   n_blocks > 256 ? "uint16_t" : "uint8_t", NBLOCKS);
+    for (i = 0; i < NBLOCKS; i++)
+	printf("%s%u,", i % 16 ? " " : "\n    ", stage1[i]);
+    printf("\n};\n\n");
+
+    printf("static const uint8_t unitab_stage2[%d] = {", n_blocks*BLOCKSIZE);
+    for (b = 0; b < n_blocks; b++)
+	for (i = 0; i < BLOCKSIZE; i++)
+	    printf("%s%u,", i % 16 ? " " : "\n    ", blocks[b][i]);
+    printf("\n};\n");
+
+    return 0;
+}
@@ -0,0 +1,452 @@
+/*
+ * output.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "pnfdscan.h"
+#include "classify.h"
+#include "output.h"
+
+
+#define OUTBUF_SIZE	(256*1024)
+
+typedef struct outbuf {
+    char *buf;
+    size_t size;
+    size_t len;
+    struct outbuf *prev;
+    struct outbuf *next;
+} OUTBUF;
+
+
+int out_format = OUT_TEXT;
+
+static pthread_key_t out_key;
+static pthread_mutex_t out_mtx = PTHREAD_MUTEX_INITIALIZER;
+static OUTBUF *out_bufs = NULL;
+
+static const char *class_names[] = { "ascii", "utf8", "nfc", "nfd", "invalid" };
+static const char *coll_names[] = { "none", "newer", "older" };
+static const char *action_names[] = {
+    "none", "rename-nfd", "move-nfd", "remove-nfd", "move-nfc", "replace-nfc"
+};
+
+static const char digits2[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const char hexdigits[] = "0123456789abcdef";
+
+
+/* Must be called with out_mtx held */
+static void
+outbuf_write(OUTBUF *ob) {
+    size_t pos = 0;
+    ssize_t rc;
+
+    while (pos < ob->len) {
+	rc = write(STDOUT_FILENO, ob->buf+pos, ob->len-pos);
+	if (rc < 0) {
+	    if (errno == EINTR)
+		continue;
+	    fprintf(stderr, "%s: Error: <stdout>: write: %s\n", argv0, strerror(errno));
+	    out_format = OUT_TEXT;	/* Nothing more to flush at exit() */
+	    exit(1);
+	}
+	pos += rc;
+    }
+    ob->len = 0;
+}
+
+static void
+outbuf_free(void *vp) {
+    OUTBUF *ob = (OUTBUF *) vp;
+
+    pthread_mutex_lock(&out_mtx);
+    outbuf_write(ob);
+    if (ob->prev)
+	ob->prev->next = ob->next;
+    else
+	out_bufs = ob->next;
+    if (ob->next)
+	ob->next->prev = ob->prev;
+    pthread_mutex_unlock(&out_mtx);
+
+    free(ob->buf);
+    free(ob);
+}
+
+/* The calling thread's buffer, with room for at least need more bytes */
+static OUTBUF *
+outbuf_get(size_t need) {
+    OUTBUF *ob = pthread_getspecific(out_key);
+
+    if (!ob) {
+	ob = calloc(1, sizeof(*ob));
+	if (!ob)
+	    abort();
+	ob->size = OUTBUF_SIZE;
+	ob->buf = malloc(ob->size);
+	if (!ob->buf)
+	    abort();
+
+	pthread_mutex_lock(&out_mtx);
+	ob->next = out_bufs;
+	if (out_bufs)
+	    out_bufs->prev = ob;
+	out_bufs = ob;
+	pthread_mutex_unlock(&out_mtx);
+	pthread_setspecific(out_key, ob);
+    }
+
+    if (ob->len+need > ob->size) {
+	pthread_mutex_lock(&out_mtx);
+	outbuf_write(ob);
+	pthread_mutex_unlock(&out_mtx);
+
+	if (need > ob->size) {
+	    ob->size = need;
+	    ob->buf = realloc(ob->buf, ob->size);
+	    if (!ob->buf)
+		abort();
+	}
+    }
+
+    return ob;
+}
+
+
+static char *
+put_str(char *p,
+	const char *s) {
+    size_t len = strlen(s);
+
+    memcpy(p, s, len);
+    return p+len;
+}
+
+static char *
+put_u64(char *p,
+	uint64_t v) {
+    char tmp[20], *t = tmp+sizeof(tmp);
+    size_t len;
+
+    while (v >= 100) {
+	t -= 2;
+	memcpy(t, digits2+(v%100)*2, 2);
+	v /= 100;
+    }
+    if (v >= 10) {
+	t -= 2;
+	memcpy(t, digits2+v*2, 2);
+    } else
+	*--t = '0'+v;
+
+    len = tmp+sizeof(tmp)-t;
+    memcpy(p, t, len);
+    return p+len;
+}
+
+static char *
+put_i64(char *p,
+	int64_t v) {
+    if (v < 0) {
+	*p++ = '-';
+	return put_u64(p, -(uint64_t) v);
+    }
+    return put_u64(p, v);
+}
+
+/* JSON string contents, at most 6 bytes per input byte */
+static char *
+put_json(char *p,
+	 const char *s) {
+    const unsigned char *u;
+
+    for (u = (const unsigned char *) s; *u; u++) {
+	switch (*u) {
+	case '"':
+	case '\\':
+	    *p++ = '\\';
+	    *p++ = *u;
+	    break;
+	case '\n':
+	    *p++ = '\\';
+	    *p++ = 'n';
+	    break;
+	case '\t':
+	    *p++ = '\\';
+	    *p++ = 't';
+	    break;
+	default:
+	    if (*u < 0x20) {
+		memcpy(p, "\\u00", 4);
+		p[4] = hexdigits[*u >> 4];
+		p[5] = hexdigits[*u & 15];
+		p += 6;
+	    } else
+		*p++ = *u;
+	}
+    }
+    return p;
+}
+
+static char *
+put_hex(char *p,
+	const char *s) {
+    const unsigned char *u;
+
+    for (u = (const unsigned char *) s; *u; u++) {
+	*p++ = hexdigits[*u >> 4];
+	*p++ = hexdigits[*u & 15];
+    }
+    return p;
+}
+
+/* ,"key":"dir/name" - or ,"key_hex":"..." if not valid UTF-8 */
+static char *
+put_name(char *p,
+	 const char *key,
+	 const char *dir,
+	 const char *name) {
+    *p++ = ',';
+    *p++ = '"';
+    p = put_str(p, key);
+
+    if (is_valid_utf8(dir) && (!name || is_valid_utf8(name))) {
+	p = put_str(p, "\":\"");
+	p = put_json(p, dir);
+	if (name) {
+	    *p++ = '/';
+	    p = put_json(p, name);
+	}
+    } else {
+	p = put_str(p, "_hex\":\"");
+	p = put_hex(p, dir);
+	if (name) {
+	    *p++ = '2';
+	    *p++ = 'f';
+	    p = put_hex(p, name);
+	}
+    }
+
+    *p++ = '"';
+    return p;
+}
+
+static char *
+put_stat(char *p,
+	 const struct stat *sp) {
+    if (sp) {
+	p = put_str(p, ",\"mtime\":");
+	p = put_i64(p, sp->st_mtime);
+	p = put_str(p, ",\"size\":");
+	p = put_u64(p, sp->st_size);
+    }
+    return p;
+}
+
+
+static void
+put_bin(int type,
+	int cls,
+	int coll,
+	int action,
+	int done,
+	const char *dir,
+	const char *name,
+	const char *nfc,
+	const struct stat *sp) {
+    OUTBIN h;
+    OUTBUF *ob;
+    size_t dlen = strlen(dir);
+    size_t nlen = name ? strlen(name)+1 : 0;
+    size_t tlen = nfc ? strlen(nfc) : 0;
+    char *p;
+
+    memset(&h, 0, sizeof(h));
+    h.len = sizeof(h)+dlen+nlen+tlen;
+    h.type = type;
+    h.cls = cls;
+    h.coll = coll;
+    h.action = action;
+    if (sp) {
+	h.flags |= OB_STAT;
+	h.mtime = sp->st_mtime;
+	h.size = sp->st_size;
+    }
+    if (done)
+	h.flags |= OB_DONE;
+    h.path_len = dlen+nlen;
+    h.name_len = tlen;
+
+    ob = outbuf_get(h.len);
+    p = ob->buf+ob->len;
+    memcpy(p, &h, sizeof(h));
+    p += sizeof(h);
+    memcpy(p, dir, dlen);
+    p += dlen;
+    if (name) {
+	*p++ = '/';
+	memcpy(p, name, nlen-1);
+	p += nlen-1;
+    }
+    memcpy(p, nfc, tlen);
+    ob->len += h.len;
+}
+
+
+int
+out_open(const char *format) {
+    if (strcmp(format, "text") == 0)
+	out_format = OUT_TEXT;
+    else if (strcmp(format, "json") == 0)
+	out_format = OUT_JSON;
+    else if (strcmp(format, "binary") == 0)
+	out_format = OUT_BINARY;
+    else {
+	errno = EINVAL;
+	return -1;
+    }
+
+    if (out_format == OUT_TEXT)
+	return 0;
+
+    if (pthread_key_create(&out_key, outbuf_free) != 0)
+	return -1;
+    atexit(out_flush);
+
+    if (out_format == OUT_BINARY) {
+	OUTBUF *ob = outbuf_get(sizeof(OUT_MAGIC)-1);
+
+	memcpy(ob->buf, OUT_MAGIC, sizeof(OUT_MAGIC)-1);
+	ob->len += sizeof(OUT_MAGIC)-1;
+    }
+    return 0;
+}
+
+
+void
+out_object(const char *path,
+	   int cls,
+	   int coll,
+	   const char *nfc,
+	   const struct stat *sp) {
+    OUTBUF *ob;
+    char *p;
+
+    if (out_format == OUT_BINARY) {
+	put_bin(OR_OBJECT, cls, coll, OA_NONE, 0, path, NULL, nfc, sp);
+	return;
+    }
+
+    ob = outbuf_get(6*(strlen(path) + (nfc ? strlen(nfc) : 0)) + 256);
+    p = ob->buf+ob->len;
+
+    p = put_str(p, "{\"type\":\"object\"");
+    p = put_name(p, "path", path, NULL);
+    p = put_str(p, ",\"class\":\"");
+    p = put_str(p, class_names[cls]);
+    *p++ = '"';
+    if (nfc) {
+	p = put_name(p, "nfc", nfc, NULL);
+	p = put_str(p, ",\"collision\":\"");
+	p = put_str(p, coll_names[coll]);
+	*p++ = '"';
+    }
+    p = put_stat(p, sp);
+    *p++ = '}';
+    *p++ = '\n';
+
+    ob->len = p - ob->buf;
+}
+
+
+void
+out_action(const char *dir,
+	   const char *name,
+	   const char *to,
+	   int action,
+	   int done,
+	   const struct stat *sp) {
+    OUTBUF *ob;
+    char *p;
+
+    if (out_format == OUT_BINARY) {
+	put_bin(OR_ACTION, 0, OCOLL_NONE, action, done, dir, name, to, sp);
+	return;
+    }
+
+    ob = outbuf_get(6*(strlen(dir) + strlen(name) + (to ? strlen(to) : 0)) + 256);
+    p = ob->buf+ob->len;
+
+    p = put_str(p, "{\"type\":\"action\"");
+    p = put_name(p, "path", dir, name);
+    if (to)
+	p = put_name(p, "to", to, NULL);
+    p = put_str(p, ",\"action\":\"");
+    p = put_str(p, action_names[action]);
+    p = put_str(p, done ? "\",\"done\":true" : "\",\"done\":false");
+    p = put_stat(p, sp);
+    *p++ = '}';
+    *p++ = '\n';
+
+    ob->len = p - ob->buf;
+}
+
+
+/* Write out all buffered records. Only safe when no walker thread is running */
+void
+out_flush(void) {
+    OUTBUF *ob;
+
+    if (out_format == OUT_TEXT)
+	return;
+
+    fflush(stdout);
+    pthread_mutex_lock(&out_mtx);
+    for (ob = out_bufs; ob; ob = ob->next)
+	outbuf_write(ob);
+    pthread_mutex_unlock(&out_mtx);
+}
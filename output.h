@@ -0,0 +1,135 @@
+/*
+ * output.h
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H 1
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * Machine readable output (-o json|binary).
+ *
+ * Each walker thread formats its records into its own large buffer
+ * which is written out with a single write() (under a lock, so records
+ * are never split) when it fills up, when the thread exits and at the
+ * end of the run.
+ *
+ * json - One object per line:
+ *
+ *   {"type":"object","path":"a/b","class":"nfd","nfc":"b","collision":"newer","mtime":1700000000,"size":42}
+ *   {"type":"action","path":"a/b","to":"b","action":"rename-nfd","done":true,"mtime":1700000000,"size":42}
+ *
+ *   Names that are not valid UTF-8 are written as "path_hex"/"nfc_hex"/"to_hex"
+ *   with the bytes in hex instead. mtime/size are left out if the object has
+ *   not been stat()ed.
+ *
+ * binary - OUT_MAGIC followed by records, each an OUTBIN header (host byte
+ *   order, not aligned in the stream) followed by path_len bytes of path and
+ *   name_len bytes of the NFC/new name, without NUL bytes.
+ */
+
+#define OUT_TEXT	0
+#define OUT_JSON	1
+#define OUT_BINARY	2
+
+/* Record types */
+#define OR_OBJECT	1
+#define OR_ACTION	2
+
+/* Object classes */
+#define OC_ASCII	0
+#define OC_UTF8		1	/* Neither NFC nor NFD */
+#define OC_NFC		2
+#define OC_NFD		3
+#define OC_INVALID	4	/* Not valid UTF-8 */
+
+/* Collisions with an existing NFC object */
+#define OCOLL_NONE	0
+#define OCOLL_NEWER	1	/* The NFC object is newer (or as old) */
+#define OCOLL_OLDER	2
+
+/* Actions */
+#define OA_NONE		0
+#define OA_RENAME_NFD	1	/* NFD renamed to NFC */
+#define OA_MOVE_NFD	2	/* NFD renamed to a unique name, NFC kept */
+#define OA_REMOVE_NFD	3	/* NFD removed, NFC kept */
+#define OA_MOVE_NFC	4	/* NFC renamed to a unique name (NFD renamed next) */
+#define OA_REPLACE_NFC	5	/* NFC removed & NFD renamed to NFC */
+
+/* OUTBIN flags */
+#define OB_STAT		0x01	/* mtime & size are valid */
+#define OB_DONE		0x02	/* Action was performed (not a dry run) */
+
+#define OUT_MAGIC	"PNFDOUT\n"
+
+typedef struct outbin {
+    uint32_t len;	/* Record length, including this header */
+    uint8_t type;	/* OR_xxx */
+    uint8_t cls;	/* OC_xxx (objects) */
+    uint8_t coll;	/* OCOLL_xxx (objects) */
+    uint8_t action;	/* OA_xxx (actions) */
+    uint32_t flags;	/* OB_xxx */
+    uint32_t path_len;
+    int64_t mtime;
+    uint64_t size;
+    uint32_t name_len;
+    uint32_t reserved;
+} OUTBIN;
+
+
+extern int out_format;
+
+extern int
+out_open(const char *format);
+
+extern void
+out_object(const char *path,
+	   int cls,
+	   int coll,
+	   const char *nfc,
+	   const struct stat *sp);
+
+extern void
+out_action(const char *dir,
+	   const char *name,
+	   const char *to,
+	   int action,
+	   int done,
+	   const struct stat *sp);
+
+extern void
+out_flush(void);
+
+#endif
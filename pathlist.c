@@ -0,0 +1,198 @@
+/*
+ * pathlist.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "pathlist.h"
+
+
+#define PL_BLOCKSIZE	(1024*1024)
+
+struct pathlist {
+    int fd;
+    int sep;
+    int eof;
+
+    /* Either the whole file (mmap) or the read buffer */
+    char *buf;
+    size_t size;
+    size_t len;
+    size_t pos;
+    int mapped;
+
+    /* Copy of a final name without separator at the end of a mapping */
+    char *tail;
+};
+
+
+PATHLIST *
+pathlist_open(int fd,
+	      int sep) {
+    PATHLIST *pp;
+    struct stat sb;
+
+
+    pp = calloc(1, sizeof(*pp));
+    if (!pp)
+	return NULL;
+
+    pp->fd = fd;
+    pp->sep = sep;
+
+    if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+	/* Private & writable so separators can be replaced by NULs (copy-on-write) */
+	void *p = mmap(NULL, sb.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+	if (p != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+	    (void) madvise(p, sb.st_size, MADV_SEQUENTIAL);
+#endif
+	    pp->buf = p;
+	    pp->size = pp->len = sb.st_size;
+	    pp->mapped = 1;
+	    pp->eof = 1;
+	    return pp;
+	}
+    }
+
+    pp->size = PL_BLOCKSIZE;
+    pp->buf = malloc(pp->size);
+    if (!pp->buf) {
+	free(pp);
+	return NULL;
+    }
+
+    return pp;
+}
+
+
+/* Move the unused data to the start of the buffer and read more */
+static int
+pathlist_fill(PATHLIST *pp) {
+    ssize_t n;
+
+    if (pp->pos > 0) {
+	memmove(pp->buf, pp->buf+pp->pos, pp->len-pp->pos);
+	pp->len -= pp->pos;
+	pp->pos = 0;
+    }
+
+    /* A name longer than the buffer (one byte is kept for a final NUL) */
+    if (pp->len+1 >= pp->size) {
+	char *nbuf = realloc(pp->buf, pp->size*2);
+
+	if (!nbuf)
+	    return -1;
+	pp->buf = nbuf;
+	pp->size *= 2;
+    }
+
+    do {
+	n = read(pp->fd, pp->buf+pp->len, pp->size-pp->len-1);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+	return -1;
+    if (n == 0)
+	pp->eof = 1;
+    pp->len += n;
+    return 0;
+}
+
+
+/* Returns 1 with the next (non-empty) name, 0 at the end or -1 on error */
+int
+pathlist_next(PATHLIST *pp,
+	      const char **namep,
+	      size_t *lenp) {
+    for (;;) {
+	char *start = pp->buf+pp->pos;
+	size_t avail = pp->len-pp->pos;
+	char *end = memchr(start, pp->sep, avail);
+
+	if (end) {
+	    pp->pos += end-start+1;
+	    if (end == start)
+		continue;	/* Skip empty lines */
+	    *end = '\0';
+	    *namep = start;
+	    *lenp = end-start;
+	    return 1;
+	}
+
+	if (!pp->eof) {
+	    if (pathlist_fill(pp) < 0)
+		return -1;
+	    continue;
+	}
+
+	/* Last name, without a separator */
+	if (avail == 0)
+	    return 0;
+	pp->pos = pp->len;
+
+	if (!pp->mapped)
+	    start[avail] = '\0';
+	else {
+	    free(pp->tail);
+	    pp->tail = malloc(avail+1);
+	    if (!pp->tail)
+		return -1;
+	    memcpy(pp->tail, start, avail);
+	    pp->tail[avail] = '\0';
+	    start = pp->tail;
+	}
+	*namep = start;
+	*lenp = avail;
+	return 1;
+    }
+}
+
+
+void
+pathlist_close(PATHLIST *pp) {
+    if (pp->mapped)
+	munmap(pp->buf, pp->size);
+    else
+	free(pp->buf);
+    free(pp->tail);
+    free(pp);
+}
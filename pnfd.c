@@ -0,0 +1,580 @@
+/*
+ * pnfd.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "classify.h"
+#include "xstat.h"
+#include "pnfd.h"
+
+
+struct pnfd {
+    PNFD_OPTIONS o;
+    PNFD_CALLBACK *cb;
+    void *arg;
+    PNFD_COUNTERS c;
+
+    /* Names read from a directory, or NFC forms, reused between calls */
+    char *buf;
+    size_t size;
+    size_t len;
+    size_t *ov;
+    char **names;
+    size_t nsize;
+
+    /* Unique name picked by pnfd_fix_object() */
+    char to[PNFD_NAMEBUF];
+};
+
+static pthread_once_t pnfd_once = PTHREAD_ONCE_INIT;
+static int pnfd_setup_rc = -1;
+
+
+static void
+pnfd_setup(void) {
+    pnfd_setup_rc = classify_setup();
+}
+
+PNFD *
+pnfd_create(const PNFD_OPTIONS *op,
+	    PNFD_CALLBACK *cb,
+	    void *arg) {
+    PNFD *pp;
+
+    pthread_once(&pnfd_once, pnfd_setup);
+    if (pnfd_setup_rc < 0) {
+	errno = ENOSYS;
+	return NULL;
+    }
+    if (op && (op->fix < 0 || op->fix > 2)) {
+	errno = EINVAL;
+	return NULL;
+    }
+
+    pp = calloc(1, sizeof(*pp));
+    if (!pp)
+	return NULL;
+    if (op)
+	pp->o = *op;
+    pp->cb = cb;
+    pp->arg = arg;
+    return pp;
+}
+
+void
+pnfd_destroy(PNFD *pp) {
+    if (!pp)
+	return;
+    free(pp->buf);
+    free(pp->ov);
+    free(pp->names);
+    free(pp);
+}
+
+void
+pnfd_counters(PNFD *pp,
+	      PNFD_COUNTERS *cp) {
+    *cp = pp->c;
+}
+
+
+int
+pnfd_newer(const struct stat *a,
+	   const struct stat *b) {
+    if (a->st_mtim.tv_sec > b->st_mtim.tv_sec ||
+	(a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+	 a->st_mtim.tv_nsec > b->st_mtim.tv_nsec))
+	return 1;
+    if (a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+	a->st_mtim.tv_nsec == b->st_mtim.tv_nsec)
+	return 0;
+    return -1;
+}
+
+int
+pnfd_unique(const char *name,
+	    int isdir,
+	    unsigned int i,
+	    char *buf,
+	    size_t size) {
+    const char *cp = isdir ? NULL : strrchr(name, '.');
+    int len;
+
+    if (!cp) {
+	/* aaa -> aaa (0) */
+	len = snprintf(buf, size, "%s (%u)", name, i);
+    } else {
+	/* aaa.doc -> aaa (0).doc */
+	len = snprintf(buf, size, "%.*s (%u)%s", (int) (cp-name), name, i, cp);
+    }
+    if (len < 0 || (size_t) len >= size) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+    return len;
+}
+
+
+/* Add a string to the context buffer, returns its offset */
+static size_t
+buf_add(PNFD *pp,
+	const char *s) {
+    size_t len = strlen(s)+1, off;
+
+    if (pp->len+len > pp->size) {
+	size_t nsize = (pp->len+len)*2;
+	char *nbuf = realloc(pp->buf, nsize);
+
+	if (!nbuf)
+	    return (size_t) -1;
+	pp->buf = nbuf;
+	pp->size = nsize;
+    }
+    off = pp->len;
+    memcpy(pp->buf+off, s, len);
+    pp->len += len;
+    return off;
+}
+
+/* Room for n names (offsets & pointers) */
+static int
+names_room(PNFD *pp,
+	   size_t n) {
+    if (n > pp->nsize) {
+	size_t nsize = n*2;
+	size_t *nov = realloc(pp->ov, nsize*sizeof(*nov));
+	char **nnames;
+
+	if (!nov)
+	    return -1;
+	pp->ov = nov;
+	nnames = realloc(pp->names, nsize*sizeof(*nnames));
+	if (!nnames)
+	    return -1;
+	pp->names = nnames;
+	pp->nsize = nsize;
+    }
+    return 0;
+}
+
+int
+pnfd_utf8_class(const char *name,
+		char *nfc,
+		size_t size) {
+    int rc_nfd, rc_nfc;
+    int32_t len;
+
+    if (utf8_nf_check(name, &rc_nfd, &rc_nfc) < 0)
+	return -1;
+    if (rc_nfc)
+	return PNFD_NFC;
+
+    if (utf8_to_nfc(name, nfc, size, &len) < 0)
+	return -1;
+    if (strcmp(nfc, name) == 0)
+	return PNFD_NFC;
+    return rc_nfd ? PNFD_NFD : PNFD_UTF8;
+}
+
+/* Class of a name and, if it isn't NFC (or ASCII), its NFC form */
+static int
+name_class(const char *name,
+	   char *nfc,
+	   size_t size) {
+    switch (utf8_class(name, strlen(name))) {
+    case NC_ASCII:
+	return PNFD_ASCII;
+    case NC_INVALID:
+	return PNFD_INVALID;
+    }
+    return pnfd_utf8_class(name, nfc, size);
+}
+
+int
+pnfd_collision(const struct stat *nfc_sp,
+	       const struct stat *sp) {
+    return pnfd_newer(nfc_sp, sp) >= 0 ? PNFD_COLL_NEWER : PNFD_COLL_OLDER;
+}
+
+int
+pnfd_action(const PNFD_OPTIONS *op,
+	    int coll) {
+    if (op->fix < 1 || (coll != PNFD_COLL_NONE && op->fix < 2))
+	return PNFD_ACT_NONE;
+
+    switch (coll) {
+    case PNFD_COLL_NEWER:
+	/* Keep the newer NFC object */
+	return op->remove ? PNFD_ACT_REMOVE_NFD : PNFD_ACT_MOVE_NFD;
+    case PNFD_COLL_OLDER:
+	/* Replace the older NFC object */
+	return op->remove ? PNFD_ACT_REPLACE_NFC : PNFD_ACT_MOVE_NFC;
+    }
+    return PNFD_ACT_RENAME_NFD;
+}
+
+static void
+count(PNFD *pp,
+      const PNFD_RESULT *rp) {
+    switch (rp->cls) {
+    case PNFD_ASCII:
+	pp->c.ascii++;
+	break;
+    case PNFD_NFC:
+	pp->c.nfc++;
+	break;
+    case PNFD_UTF8:
+	pp->c.other++;
+	/* Fall through - fixed like NFD names */
+    case PNFD_NFD:
+	pp->c.nfd++;
+	break;
+    case PNFD_INVALID:
+	pp->c.unknown++;
+	break;
+    }
+    if (rp->coll != PNFD_COLL_NONE)
+	pp->c.coll++;
+    pp->c.objects++;
+}
+
+
+int
+pnfd_classify(PNFD *pp,
+	      const char *const *names,
+	      size_t n,
+	      PNFD_RESULT *rv) {
+    char nfc[PNFD_NAMEBUF];
+    size_t i;
+    int rc = 0;
+
+    if (names_room(pp, n) < 0)
+	return -1;
+    pp->len = 0;
+
+    for (i = 0; i < n; i++) {
+	PNFD_RESULT *rp = &rv[i];
+
+	memset(rp, 0, sizeof(*rp));
+	rp->name = names[i];
+	pp->ov[i] = (size_t) -1;
+
+	rp->cls = name_class(names[i], nfc, sizeof(nfc));
+	if (rp->cls < 0) {
+	    rp->cls = PNFD_INVALID;
+	    rp->error = errno;
+	    pp->c.unread++;
+	    pp->c.objects++;
+	    continue;
+	}
+	if (rp->cls == PNFD_NFD || rp->cls == PNFD_UTF8) {
+	    pp->ov[i] = buf_add(pp, nfc);
+	    if (pp->ov[i] == (size_t) -1)
+		rc = -1;
+	}
+	count(pp, rp);
+    }
+
+    /* The buffer may have moved */
+    for (i = 0; i < n; i++)
+	if (pp->ov[i] != (size_t) -1)
+	    rv[i].nfc = pp->buf+pp->ov[i];
+    return rc;
+}
+
+
+static int
+name_cmp(const void *va,
+	 const void *vb) {
+    return strcmp(*(char *const *) va, *(char *const *) vb);
+}
+
+/* A unique name in the directory, based on name */
+static int
+unique_name(int fd,
+	    const char *name,
+	    int isdir,
+	    char *buf,
+	    size_t size) {
+    struct stat sb;
+    unsigned int i;
+
+    for (i = 0; ; i++) {
+	if (pnfd_unique(name, isdir, i, buf, size) < 0)
+	    return -1;
+	if (xstatat(fd, buf, &sb, XS_SYNC) < 0) {
+	    if (errno == ENOENT)
+		return 0;
+	    return -1;
+	}
+    }
+}
+
+/* The name to move an object to, unless the caller has picked one */
+static int
+pick_to(PNFD *pp,
+	int fd,
+	PNFD_RESULT *rp,
+	const struct stat *sp) {
+    if (rp->to)
+	return 0;
+    if (unique_name(fd, rp->nfc, S_ISDIR(sp->st_mode), pp->to, sizeof(pp->to)) < 0)
+	return -1;
+    rp->to = pp->to;
+    return 0;
+}
+
+int
+pnfd_fix_object(PNFD *pp,
+		int fd,
+		PNFD_RESULT *rp,
+		const struct stat *nfc_sp) {
+    int update = !pp->o.dry_run;
+    struct stat sb;
+
+    rp->error = 0;
+    rp->partial = 0;
+
+    switch (rp->action) {
+    case PNFD_ACT_RENAME_NFD:
+	if (!update)
+	    break;
+	/* Never overwrite an NFC object (one may have appeared) */
+	if (xstatat(fd, rp->nfc, &sb, XS_SYNC) == 0) {
+	    rp->error = EEXIST;
+	    break;
+	}
+	if (renameat(fd, rp->name, fd, rp->nfc) < 0) {
+	    rp->error = errno;
+	    break;
+	}
+	pp->c.renamed++;
+	break;
+
+    case PNFD_ACT_REMOVE_NFD:
+	if (!update)
+	    break;
+	if (unlinkat(fd, rp->name, S_ISDIR(rp->sp->st_mode) ? AT_REMOVEDIR : 0) < 0) {
+	    rp->error = errno;
+	    break;
+	}
+	pp->c.removed++;
+	break;
+
+    case PNFD_ACT_MOVE_NFD:
+	if (pick_to(pp, fd, rp, rp->sp) < 0) {
+	    rp->error = errno;
+	    break;
+	}
+	if (!update)
+	    break;
+	if (renameat(fd, rp->name, fd, rp->to) < 0) {
+	    rp->error = errno;
+	    break;
+	}
+	pp->c.renamed++;
+	break;
+
+    case PNFD_ACT_MOVE_NFC:
+	if (pick_to(pp, fd, rp, nfc_sp) < 0) {
+	    rp->error = errno;
+	    break;
+	}
+	if (!update)
+	    break;
+	if (renameat(fd, rp->nfc, fd, rp->to) < 0) {
+	    rp->error = errno;
+	    break;
+	}
+	pp->c.renamed++;
+	/* Fall through - the NFC name is free now */
+    case PNFD_ACT_REPLACE_NFC:
+	if (!update)
+	    break;
+	if (renameat(fd, rp->name, fd, rp->nfc) < 0) {
+	    rp->error = errno;
+	    rp->partial = (rp->action == PNFD_ACT_MOVE_NFC);
+	    break;
+	}
+	pp->c.renamed++;
+	if (rp->action == PNFD_ACT_REPLACE_NFC)
+	    pp->c.removed++;
+	break;
+
+    default:
+	rp->error = EINVAL;
+    }
+
+    if (rp->error) {
+	pp->c.errors++;
+	errno = rp->error;
+	return -1;
+    }
+    return 0;
+}
+
+int
+pnfd_fix_dir(PNFD *pp,
+	     int dfd,
+	     const char *dir) {
+    DIR *dp;
+    struct dirent *dep;
+    size_t n = 0, i;
+    int fd, dfd2, renamed = 0;
+
+
+    fd = openat(dfd, dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd < 0)
+	return -1;
+    dfd2 = dup(fd);
+    if (dfd2 < 0 || (dp = fdopendir(dfd2)) == NULL) {
+	int err = errno;
+
+	if (dfd2 >= 0)
+	    close(dfd2);
+	close(fd);
+	errno = err;
+	return -1;
+    }
+
+    /* All the names first - for collisions, and as we'll be renaming things */
+    pp->len = 0;
+    while ((errno = 0, dep = readdir(dp)) != NULL) {
+	if (strcmp(dep->d_name, ".") == 0 || strcmp(dep->d_name, "..") == 0)
+	    continue;
+	if (names_room(pp, n+1) < 0 ||
+	    (pp->ov[n] = buf_add(pp, dep->d_name)) == (size_t) -1)
+	    break;
+	n++;
+    }
+    if (errno) {
+	int err = errno;
+
+	closedir(dp);
+	close(fd);
+	errno = err;
+	return -1;
+    }
+    closedir(dp);
+
+    for (i = 0; i < n; i++)
+	pp->names[i] = pp->buf+pp->ov[i];
+    qsort(pp->names, n, sizeof(*pp->names), name_cmp);
+
+    for (i = 0; i < n; i++) {
+	char nfc[PNFD_NAMEBUF];
+	const char *np = nfc;
+	struct stat sb, nfc_sb;
+	PNFD_RESULT r;
+	int rc;
+
+	memset(&r, 0, sizeof(r));
+	r.name = pp->names[i];
+	r.cls = name_class(r.name, nfc, sizeof(nfc));
+	if (r.cls < 0) {
+	    /* Counted as by pnfdscan */
+	    r.cls = PNFD_INVALID;
+	    r.error = errno;
+	    pp->c.unread++;
+	    pp->c.objects++;
+	    goto Report;
+	}
+
+	if (r.cls == PNFD_ASCII || r.cls == PNFD_INVALID) {
+	    count(pp, &r);
+	    if (r.cls == PNFD_INVALID || pp->o.all)
+		goto Report;
+	    continue;
+	}
+
+	if (fstatat(fd, r.name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+	    r.error = errno;
+	    pp->c.unread++;
+	    pp->c.objects++;
+	    goto Report;
+	}
+	r.sp = &sb;
+
+	if (r.cls == PNFD_NFC) {
+	    count(pp, &r);
+	    if (pp->o.all)
+		goto Report;
+	    continue;
+	}
+	r.nfc = nfc;
+
+	/* Only ask the filesystem if the name is listed or something may have been renamed to it */
+	if (renamed || bsearch(&np, pp->names, n, sizeof(*pp->names), name_cmp))
+	    rc = fstatat(fd, nfc, &nfc_sb, AT_SYMLINK_NOFOLLOW);
+	else {
+	    rc = -1;
+	    errno = ENOENT;
+	}
+	if (rc < 0 && errno != ENOENT) {
+	    /* Better safe than sorry - don't risk overwriting an existing NFC object */
+	    r.error = errno;
+	    pp->c.unread++;
+	    pp->c.objects++;
+	    goto Report;
+	}
+	if (rc == 0)
+	    r.coll = pnfd_collision(&nfc_sb, &sb);
+	count(pp, &r);
+
+	r.action = pnfd_action(&pp->o, r.coll);
+	if (r.action != PNFD_ACT_NONE) {
+	    pnfd_fix_object(pp, fd, &r, &nfc_sb);
+	    if (!pp->o.dry_run)
+		renamed = 1;
+	}
+
+    Report:
+	if (pp->cb)
+	    pp->cb(pp->arg, dir, &r);
+    }
+
+    close(fd);
+    return 0;
+}
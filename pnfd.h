@@ -0,0 +1,207 @@
+/*
+ * pnfd.h
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PNFD_H
+#define PNFD_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * libpnfd - the name checks and fixes of pnfdscan, for programs that
+ * want to do them themselves (instead of running pnfdscan and parsing
+ * its output).
+ *
+ * All state is in a PNFD context, created with the options to use and
+ * a function to call with the result for each object. A context may
+ * only be used by one thread at a time but any number of them can be
+ * used in parallel. Errors are returned (with errno set), never
+ * printed, and nothing makes the process exit.
+ *
+ * pnfd_classify() checks a batch of names (no filesystem access) and
+ * pnfd_fix_dir() checks (and, depending on the options, fixes) all
+ * the objects in one directory - walking a tree is up to the caller
+ * (pnfdfix.c is a small example).
+ */
+
+/* Classes of names (same as the scan output) */
+#define PNFD_ASCII		0
+#define PNFD_UTF8		1	/* Neither NFC nor NFD */
+#define PNFD_NFC		2
+#define PNFD_NFD		3
+#define PNFD_INVALID		4	/* Not valid UTF-8 */
+
+/* NFC collisions - an object with the NFC name already exists */
+#define PNFD_COLL_NONE		0
+#define PNFD_COLL_NEWER		1	/* The NFC object is newer (or as old) */
+#define PNFD_COLL_OLDER		2
+
+/* Actions, done or (with dry_run) that would have been */
+#define PNFD_ACT_NONE		0
+#define PNFD_ACT_RENAME_NFD	1	/* NFD renamed to NFC */
+#define PNFD_ACT_MOVE_NFD	2	/* NFD renamed to a unique name, NFC kept */
+#define PNFD_ACT_REMOVE_NFD	3	/* NFD removed, NFC kept */
+#define PNFD_ACT_MOVE_NFC	4	/* NFC renamed to a unique name & NFD renamed to NFC */
+#define PNFD_ACT_REPLACE_NFC	5	/* NFC removed & NFD renamed to NFC */
+
+/* Longest NFC form of a name (incl. the NUL) */
+#define PNFD_NAMEBUF		1024
+
+
+typedef struct pnfd PNFD;
+
+typedef struct pnfd_options {
+    int fix;		/* 0 = check, 1 = rename NFD names, 2 = also collisions (pnfdscan -a/-aa) */
+    int remove;		/* Remove the older of colliding objects instead of renaming it (-r) */
+    int dry_run;	/* Only report what would have been done (-n) */
+    int all;		/* Report ASCII & NFC objects too */
+} PNFD_OPTIONS;
+
+/* As counted (and printed with -s) by pnfdscan */
+typedef struct pnfd_counters {
+    uint64_t ascii;
+    uint64_t nfc;
+    uint64_t nfd;	/* Incl. "other", which are fixed like NFD names */
+    uint64_t other;
+    uint64_t unknown;
+    uint64_t coll;
+    uint64_t objects;
+    uint64_t unread;
+    uint64_t renamed;
+    uint64_t removed;
+    uint64_t errors;	/* Fixes that failed */
+} PNFD_COUNTERS;
+
+typedef struct pnfd_result {
+    const char *name;
+    int cls;			/* PNFD_xxx */
+    int coll;			/* PNFD_COLL_xxx */
+    const char *nfc;		/* NFC form (UTF8 & NFD names), else NULL */
+    const struct stat *sp;	/* NULL if not needed (ASCII & invalid names) */
+    int action;			/* PNFD_ACT_xxx */
+    const char *to;		/* Unique name for PNFD_ACT_MOVE_xxx */
+    int error;			/* errno if the object couldn't be checked or fixed */
+    int partial;		/* PNFD_ACT_MOVE_NFC failed after moving the NFC object */
+} PNFD_RESULT;
+
+/* Called with the result for each object (dir as given to pnfd_fix_dir()) */
+typedef void (PNFD_CALLBACK)(void *arg,
+			     const char *dir,
+			     const PNFD_RESULT *rp);
+
+
+extern PNFD *
+pnfd_create(const PNFD_OPTIONS *op,
+	    PNFD_CALLBACK *cb,
+	    void *arg);
+
+extern void
+pnfd_destroy(PNFD *pp);
+
+/*
+ * Classify n names. rv[i].nfc points into the context and is valid
+ * until the next call. The callback isn't called.
+ */
+extern int
+pnfd_classify(PNFD *pp,
+	      const char *const *names,
+	      size_t n,
+	      PNFD_RESULT *rv);
+
+/*
+ * Check (and fix) the objects in the directory dir (relative to dfd,
+ * or AT_FDCWD), calling the callback for each one that isn't plain
+ * ASCII or NFC (unless the "all" option is set). -1 if the directory
+ * can't be read - problems with single objects are in their results.
+ */
+extern int
+pnfd_fix_dir(PNFD *pp,
+	     int dfd,
+	     const char *dir);
+
+extern void
+pnfd_counters(PNFD *pp,
+	      PNFD_COUNTERS *cp);
+
+
+/* Shared with pnfdscan */
+
+/*
+ * Class of a valid, non-ASCII UTF-8 name (PNFD_UTF8, _NFC or _NFD)
+ * and, unless NFC, its NFC form in nfc. -1 on ICU errors.
+ */
+extern int
+pnfd_utf8_class(const char *name,
+		char *nfc,
+		size_t size);
+
+/* PNFD_COLL_xxx for an NFC object (nfc_sp) colliding with an NFD one (sp) */
+extern int
+pnfd_collision(const struct stat *nfc_sp,
+	       const struct stat *sp);
+
+/* PNFD_ACT_xxx to take for an NFD (or UTF8) name, as the options say */
+extern int
+pnfd_action(const PNFD_OPTIONS *op,
+	    int coll);
+
+/*
+ * Do rp->action (unless dry_run) for an object in the directory fd,
+ * rp->name, ->nfc, ->sp & ->coll set as by pnfd_fix_dir() and nfc_sp
+ * the NFC object's status for collisions. Moves use rp->to, or a unique
+ * name (valid until the next call) if NULL. The NFC name is checked
+ * to be free right before PNFD_ACT_RENAME_NFD. -1 with rp->error (and
+ * errno) set if it fails.
+ */
+extern int
+pnfd_fix_object(PNFD *pp,
+		int fd,
+		PNFD_RESULT *rp,
+		const struct stat *nfc_sp);
+
+/* 1 if a was modified after b, 0 if at the same time, else -1 */
+extern int
+pnfd_newer(const struct stat *a,
+	   const struct stat *b);
+
+/* Candidate i for a unique name for an object named name - "aaa (0).doc" */
+extern int
+pnfd_unique(const char *name,
+	    int isdir,
+	    unsigned int i,
+	    char *buf,
+	    size_t size);
+
+#endif
@@ -0,0 +1,233 @@
+/*
+ * pnfdfix.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Example libpnfd program - checks (and fixes) the names in directory
+ * trees with pnfd_fix_dir(), like pnfdscan does with -a/-aa/-r/-n
+ * but much simpler (one thread, plain readdir(), no caching). Used
+ * by "make check-lib" to compare the library with pnfdscan.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "pnfd.h"
+
+
+char *argv0 = "pnfdfix";
+
+int f_verbose = 0;
+int f_summary = 0;
+
+unsigned long n_errors = 0;
+
+
+static const char *
+action_name(int action) {
+    switch (action) {
+    case PNFD_ACT_RENAME_NFD:
+	return "Renamed NFD";
+    case PNFD_ACT_MOVE_NFD:
+	return "Moved NFD";
+    case PNFD_ACT_REMOVE_NFD:
+	return "Removed NFD";
+    case PNFD_ACT_MOVE_NFC:
+	return "Moved NFC & Renamed NFD";
+    case PNFD_ACT_REPLACE_NFC:
+	return "Replaced NFC";
+    }
+    return NULL;
+}
+
+/* Called by pnfd_fix_dir() for each (non-ASCII, non-NFC) object */
+static void
+report(void *arg,
+       const char *dir,
+       const PNFD_RESULT *rp) {
+    const char *what = action_name(rp->action);
+
+    (void) arg;
+
+    if (rp->error) {
+	fprintf(stderr, "%s: Error: %s/%s: %s%s%s\n",
+		argv0, dir, rp->name,
+		what ? what : "", what ? ": " : "", strerror(rp->error));
+	n_errors++;
+	return;
+    }
+
+    if (what)
+	printf("%s/%s: %s%s%s\n", dir, rp->name, what,
+	       rp->to ? " -> " : "", rp->to ? rp->to : "");
+    else if (f_verbose || rp->cls == PNFD_NFD || rp->cls == PNFD_UTF8 || rp->cls == PNFD_INVALID)
+	printf("%s/%s: %s%s\n", dir, rp->name,
+	       rp->cls == PNFD_ASCII ? "ASCII" :
+	       rp->cls == PNFD_NFC ? "NFC" :
+	       rp->cls == PNFD_INVALID ? "Unknown Encoding" : "NFD",
+	       rp->coll ? " (with NFC collision)" : "");
+}
+
+/* Subdirectories first, as fixing a directory may rename them */
+static void
+fix_tree(PNFD *pp,
+	 const char *path) {
+    DIR *dp;
+    struct dirent *dep;
+    char **subv = NULL;
+    size_t n = 0, i;
+
+
+    dp = opendir(path);
+    if (!dp) {
+	fprintf(stderr, "%s: Error: %s: opendir: %s\n", argv0, path, strerror(errno));
+	n_errors++;
+	return;
+    }
+
+    while ((dep = readdir(dp)) != NULL) {
+	struct stat sb;
+	char *sub;
+
+	if (strcmp(dep->d_name, ".") == 0 || strcmp(dep->d_name, "..") == 0)
+	    continue;
+	if (dep->d_type != DT_DIR &&
+	    (dep->d_type != DT_UNKNOWN ||
+	     fstatat(dirfd(dp), dep->d_name, &sb, AT_SYMLINK_NOFOLLOW) < 0 ||
+	     !S_ISDIR(sb.st_mode)))
+	    continue;
+
+	sub = malloc(strlen(path)+strlen(dep->d_name)+2);
+	subv = realloc(subv, (n+1)*sizeof(*subv));
+	if (!sub || !subv)
+	    abort();
+	sprintf(sub, "%s/%s", path, dep->d_name);
+	subv[n++] = sub;
+    }
+    closedir(dp);
+
+    for (i = 0; i < n; i++) {
+	fix_tree(pp, subv[i]);
+	free(subv[i]);
+    }
+    free(subv);
+
+    if (pnfd_fix_dir(pp, AT_FDCWD, path) < 0) {
+	fprintf(stderr, "%s: Error: %s: %s\n", argv0, path, strerror(errno));
+	n_errors++;
+    }
+}
+
+int
+main(int argc,
+     char *argv[]) {
+    PNFD_OPTIONS o;
+    PNFD_COUNTERS c;
+    PNFD *pp;
+    int i, j;
+
+
+    argv0 = argv[0];
+    memset(&o, 0, sizeof(o));
+
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+	for (j = 1; argv[i][j]; j++) {
+	    switch (argv[i][j]) {
+	    case 'h':
+		printf("Usage:\n  %s [<options>*] <dir>+\n", argv[0]);
+		puts("\nOptions:");
+		puts("  -h          Display this");
+		puts("  -v          Report ASCII & NFC objects too");
+		puts("  -s          Print a summary");
+		puts("  -a          Rename NFD names to NFC (-aa: also collisions)");
+		puts("  -r          Remove the older of colliding objects");
+		puts("  -n          Only report what would have been done");
+		exit(0);
+	    case 'v':
+		f_verbose++;
+		o.all = 1;
+		break;
+	    case 's':
+		f_summary++;
+		break;
+	    case 'a':
+		if (o.fix < 2)
+		    o.fix++;
+		break;
+	    case 'r':
+		o.remove = 1;
+		break;
+	    case 'n':
+		o.dry_run = 1;
+		break;
+	    default:
+		fprintf(stderr, "%s: Error: -%c: Invalid switch\n", argv[0], argv[i][j]);
+		exit(1);
+	    }
+	}
+    }
+
+    if (i >= argc) {
+	fprintf(stderr, "%s: Error: Missing arguments (use -h for help)\n", argv[0]);
+	exit(1);
+    }
+
+    pp = pnfd_create(&o, report, NULL);
+    if (!pp) {
+	fprintf(stderr, "%s: Error: pnfd_create: %s\n", argv[0], strerror(errno));
+	exit(1);
+    }
+
+    for (; i < argc; i++)
+	fix_tree(pp, argv[i]);
+
+    if (f_summary) {
+	pnfd_counters(pp, &c);
+	fprintf(stderr, "[%lu ascii, %lu nfc, %lu nfd, %lu other, %lu unknown & %lu collisions; "
+		"%lu objects, %lu unreadable, %lu renamed & %lu removed]\n",
+		(unsigned long) c.ascii, (unsigned long) c.nfc, (unsigned long) c.nfd,
+		(unsigned long) c.other, (unsigned long) c.unknown, (unsigned long) c.coll,
+		(unsigned long) c.objects, (unsigned long) c.unread,
+		(unsigned long) c.renamed, (unsigned long) c.removed);
+    }
+
+    pnfd_destroy(pp);
+    return n_errors ? 1 : 0;
+}
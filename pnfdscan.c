@@ -44,13 +44,26 @@
 #include <errno.h>
 #include <unistd.h>
 #include <time.h>
-#include <ftw.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
-#include <unicode/utypes.h>
-#include <unicode/unorm2.h>
-#include <unicode/ustring.h>
+#include "pnfdscan.h"
+#include "classify.h"
+#include "walk.h"
+#include "dircache.h"
+#include "uring.h"
+#include "pathlist.h"
+#include "xstat.h"
+#include "output.h"
+#include "metrics.h"
+#include "checkpoint.h"
+#include "throttle.h"
+#include "shard.h"
+#include "index.h"
+#include "watch.h"
+#include "pnfd.h"
 
 
 
@@ -69,6 +82,22 @@ int f_check = 0;
 int f_time = 0;
 int f_file = 0;
 int f_zero = 0;
+int f_stream = 0;
+int f_leaf = 0;
+int f_metrics = 0;
+int f_resume = 0;
+int f_merge = 0;
+int f_watch = 0;
+int f_ckpt_interval = 60;
+
+char *f_cache = NULL;
+char *f_promfile = NULL;
+char *f_ckpt = NULL;
+char *f_partial = NULL;
+char *f_plan = NULL;
+char *f_apply = NULL;
+char *f_index = NULL;
+char *f_query = NULL;
 
 unsigned int n_scanned = 0;
 
@@ -84,11 +113,7 @@ unsigned long n_unread = 0;
 unsigned long n_renamed = 0;
 unsigned long n_removed = 0;
 unsigned long n_errors = 0;
-
-
-const UNormalizer2 *nfd;
-const UNormalizer2 *nfc;
-
+unsigned long n_stale = 0;
 
 
 typedef enum {
@@ -100,708 +125,1570 @@ typedef enum {
 
 typedef struct action {
     ACTION_TYPE type;
-    char *dir;
+    const char *dir;	/* Interned, see ACTDIR */
     struct {
 	struct stat sb;
 	char *name;
     } nfd, nfc;
+    char *unique;	/* Precomputed unique name (to be verified) */
+    int batched;	/* Handled by run_dir_renames() */
+    int resumed;	/* From a checkpoint - may already have been done */
+    int planned;	/* From a plan (-X) - the objects may have changed since */
     struct action *next;
 } ACTION;
 
+
+/* All actions for one directory, in the order they were found */
+typedef struct actdir {
+    char *dir;
+    int depth;
+    ACTION *actions;
+    ACTION **last;
+    struct arena *arena;	/* Memory for the above */
+    struct actdir *hnext;	/* Hash chain */
+} ACTDIR;
+
+
+/*
+ * Actions and their names are allocated from a per-directory arena
+ * (bump allocator) and released in one go when the directory is done.
+ * Chunks start small (most directories have few actions) and grow.
+ */
+typedef struct arena {
+    struct arena *next;
+    size_t size;
+    size_t used;
+    char data[];
+} ARENA;
+
+#define ARENA_MIN	(4*1024)
+#define ARENA_MAX	(256*1024)
+#define ACTDIR_HSIZE	4096
+
 unsigned long n_actions = 0;
-ACTION *actions = NULL;
+unsigned long n_actdirs = 0;
+ACTDIR *actdir_htab[ACTDIR_HSIZE];
+pthread_mutex_t actions_mtx = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t run_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void *
+arena_alloc(ARENA **app,
+	    size_t size) {
+    ARENA *ap = *app;
+    void *p;
+
+    size = (size+15) & ~(size_t) 15;
+    if (!ap || ap->used+size > ap->size) {
+	size_t asize = ap ? ap->size*2 : ARENA_MIN;
+
+	if (asize > ARENA_MAX)
+	    asize = ARENA_MAX;
+	if (asize < size)
+	    asize = size;
+	ap = malloc(sizeof(*ap)+asize);
+	if (!ap)
+	    abort();
+	ap->size = asize;
+	ap->used = 0;
+	ap->next = *app;
+	*app = ap;
+    }
+
+    p = ap->data+ap->used;
+    ap->used += size;
+    return p;
+}
 
+static char *
+arena_strndup(ARENA **app,
+	      const char *s,
+	      size_t len) {
+    char *p = arena_alloc(app, len+1);
 
-void
-add_action(char *dir,
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+
+static uint32_t
+fnv1a(const char *s,
+      size_t len) {
+    uint32_t h = 2166136261U;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+	h ^= (unsigned char) s[i];
+	h *= 16777619U;
+    }
+    return h;
+}
+
+
+/* Find (or create) the action directory entry for the directory part of path */
+static ACTDIR *
+get_actdir(const char *path) {
+    const char *cp = strrchr(path, '/');
+    const char *dir = path;
+    size_t i, len;
+    uint32_t h;
+    ACTDIR *dp;
+
+    if (!cp) {
+	dir = ".";
+	len = 1;
+    } else if (cp == path)
+	len = 1;	/* "/" */
+    else
+	len = cp-path;
+
+    h = fnv1a(dir, len) % ACTDIR_HSIZE;
+    for (dp = actdir_htab[h]; dp; dp = dp->hnext)
+	if (strncmp(dp->dir, dir, len) == 0 && dp->dir[len] == '\0')
+	    return dp;
+
+    dp = malloc(sizeof(*dp));
+    if (!dp)
+	abort();
+    dp->arena = NULL;
+    dp->dir = arena_strndup(&dp->arena, dir, len);
+    dp->depth = 0;
+    for (i = 0; i < len; i++)
+	if (dir[i] == '/')
+	    dp->depth++;
+    dp->actions = NULL;
+    dp->last = &dp->actions;
+
+    dp->hnext = actdir_htab[h];
+    actdir_htab[h] = dp;
+    n_actdirs++;
+
+    return dp;
+}
+
+/* Unlink the action directory entry for dir, if there is one */
+static ACTDIR *
+remove_actdir(const char *dir) {
+    ACTDIR *dp, **dpp;
+
+    for (dpp = &actdir_htab[fnv1a(dir, strlen(dir)) % ACTDIR_HSIZE]; (dp = *dpp) != NULL; dpp = &dp->hnext)
+	if (strcmp(dp->dir, dir) == 0) {
+	    *dpp = dp->hnext;
+	    n_actdirs--;
+	    return dp;
+	}
+
+    return NULL;
+}
+
+static void
+free_actdir(ACTDIR *dp) {
+    while (dp->arena) {
+	ARENA *ap = dp->arena;
+
+	dp->arena = ap->next;
+	free(ap);
+    }
+    free(dp);
+}
+
+
+ACTION *
+add_action(const char *path,
 	   const struct stat *nfd_sp,
 	   const char *nfd_name,
 	   const struct stat *nfc_sp,
 	   const char *nfc_name,
+	   const char *unique,
 	   int type) {
-    ACTION *ap = malloc(sizeof(*ap));
+    ACTDIR *dp;
+    ACTION *ap;
+
+    pthread_mutex_lock(&actions_mtx);
 
-    if (!ap)
-        abort();
+    dp = get_actdir(path);
 
+    ap = arena_alloc(&dp->arena, sizeof(*ap));
     memset(ap, 0, sizeof(*ap));
 
     ap->type = type;
-    ap->dir = dir;
+    ap->dir = dp->dir;
     
     ap->nfd.sb = *nfd_sp;
-    ap->nfd.name = strdup(nfd_name);
+    ap->nfd.name = arena_strndup(&dp->arena, nfd_name, strlen(nfd_name));
     
     if (nfc_sp)
         ap->nfc.sb = *nfc_sp;
     if (nfc_name)
-        ap->nfc.name = strdup(nfc_name);
+        ap->nfc.name = arena_strndup(&dp->arena, nfc_name, strlen(nfc_name));
+    if (unique)
+	ap->unique = arena_strndup(&dp->arena, unique, strlen(unique));
 
-    ap->next = actions;
-    actions = ap;
+    *dp->last = ap;
+    dp->last = &ap->next;
 
     n_actions++;
+    pthread_mutex_unlock(&actions_mtx);
+    return ap;
 }
 
 void
 free_actions(void) {
-    while (actions) {
-	ACTION *cur = actions;
+    int i;
 
-	actions = cur->next;
-	
-	if (cur->nfc.name) {
-	    free(cur->nfc.name);
-	    cur->nfc.name = NULL;
-	}
-	if (cur->nfd.name) {
-	    free(cur->nfd.name);
-	    cur->nfd.name = NULL;
-	}
-	if (cur->dir) {
-	    free(cur->dir);
-	    cur->dir = NULL;
+    for (i = 0; i < ACTDIR_HSIZE; i++)
+	while (actdir_htab[i]) {
+	    ACTDIR *dp = actdir_htab[i];
+
+	    actdir_htab[i] = dp->hnext;
+	    free_actdir(dp);
 	}
-	free(cur);
-    }
+    n_actdirs = 0;
+}
+
+char *
+time2str(time_t t,
+	 char *buf,
+	 size_t bufsize) {
+    struct tm tmb;
+
+    localtime_r(&t, &tmb);
+    strftime(buf, bufsize, "%Y-%m-%d %H:%M:%S", &tmb);
+    return buf;
+}
+
+
+int
+p_time(const struct stat *sp,
+       FILE *fp) {
+  char buf[256];
+  struct tm tmb;
+
+  if (!sp || !localtime_r(&sp->st_mtime, &tmb))
+    return fputs(" [???]", fp);
+  
+  if (strftime(buf, sizeof(buf), "%F %T", &tmb) <= 0)
+    return fputs(" [???]", fp);
+  
+  return fprintf(fp, " [%s]", buf);
 }
 
+
+/*
+ * Report an object - a "path: what [time]" line, or just the path if
+ * what is NULL. Several walker threads may be printing at the same time
+ * so keep the line together.
+ */
 void
-setup(void) {
-    UErrorCode status = U_ZERO_ERROR;
+p_object(const char *path,
+	 const char *what,
+	 int cls,
+	 int coll,
+	 const char *nfc,
+	 const struct stat *sp) {
+    if (out_format != OUT_TEXT) {
+	out_object(path, cls, coll, nfc, sp);
+	return;
+    }
+
+    flockfile(stdout);
+    if (what) {
+	printf("%s: %s", path, what);
+	if (f_time)
+	    p_time(sp, stdout);
+	putchar('\n');
+    } else
+	puts(path);
+    funlockfile(stdout);
+}
 
-    nfd = unorm2_getInstance(NULL, "nfc", UNORM2_DECOMPOSE, &status);
-    nfc = unorm2_getInstance(NULL, "nfc", UNORM2_COMPOSE, &status);
+static const char *action_text[] = {
+    NULL,
+    "Renamed NFD",
+    "Renamed NFD & Kept NFC",
+    "Removed NFD & Kept NFC",
+    "Renamed NFC",
+    "Removed NFC & Renamed NFD",
+};
+
+/* Report an action (OA_xxx) that has been done (or would have been, with -n) */
+static void
+p_action(const char *dir,
+	 const char *name,
+	 const char *to,
+	 int action,
+	 const struct stat *sp) {
+    if (f_watch && f_update && to)
+	watch_ignore(to);
 
-    if (U_FAILURE(status)) {
-        fprintf(stderr, "Failed to get normalization instance: %s\n", u_errorName(status));
-        return;
+    if (out_format != OUT_TEXT) {
+	out_action(dir, name, to, action, f_update, sp);
+	return;
     }
+
+    if (to)
+	printf("%s/%s -> %s: %s%s\n",
+	       dir, name, to, action_text[action], f_update ? "" : " (NOT)");
+    else
+	printf("%s/%s: %s%s\n",
+	       dir, name, action_text[action], f_update ? "" : " (NOT)");
 }
 
 
+void
+merge_counters(const COUNTERS *cp) {
+    n_ascii   += cp->ascii;
+    n_nfd     += cp->nfd;
+    n_nfc     += cp->nfc;
+    n_other   += cp->other;
+    n_unknown += cp->unknown;
+    n_coll    += cp->coll;
+    n_unread  += cp->unread;
+}
+
+/*
+ * Generate a unique name for an object in the directory of op. If the
+ * walker has a name set for the directory then that is used instead of
+ * asking the filesystem (and the generated name is reserved).
+ */
 char *
-time2str(time_t t,
-	 char *buf,
-	 size_t bufsize) {
-    struct tm *tp;
+mkunique(const char *name,
+	 const struct stat *sp,
+	 OBJECT *op) {
+    char *buf;
+    size_t buflen = strlen(name)+16;
+    unsigned int i = 0;
+
+    
+    buf = malloc(buflen);
+    if (!buf)
+	return NULL;
+    
+    do {
+	if (pnfd_unique(name, S_ISDIR(sp->st_mode), i++, buf, buflen) < 0) {
+	    free(buf);
+	    return NULL;
+	}
+    } while (obj_sibling_exists(op, buf));
 
-    tp = localtime(&t);
-    strftime(buf, bufsize, "%Y-%m-%d %H:%M:%S", tp);
+    obj_sibling_add(op, buf);
     return buf;
 }
 
 
+/* What -a/-aa/-r ask the library to do */
+static void
+fix_options(PNFD_OPTIONS *op) {
+    memset(op, 0, sizeof(*op));
+    op->fix = f_autofix;
+    op->remove = f_remove;
+    op->dry_run = !f_update;
+}
+
+
+/* Record a classified object for the index (-y) */
+static void
+p_index(OBJECT *op,
+	int cls,
+	int coll) {
+    if (index_enabled)
+	index_add(op->path, cls, coll, op->sb_valid > 0 ? &op->sb : NULL);
+}
+
 int
-utf8_to_utf16(const char *utf8_input,
-	      UChar utf16_input[8192],
-	      int32_t *utf16_len) {
-    UErrorCode status = U_ZERO_ERROR;
-
-    u_strFromUTF8(utf16_input, 8192, utf16_len, utf8_input, -1, &status);
-    if (U_FAILURE(status)) {
-        fprintf(stderr, "UTF-8 to UTF-16 conversion failed: %s\n", u_errorName(status));
+walker(OBJECT *op,
+       COUNTERS *cp) {
+    const char *path = op->path;
+    const char *name = op->name;
+    const struct stat *sp;
+    struct stat nfc_sb;
+    char nfc_output[NFBUFSIZE], nfd_timebuf[256];
+    char *unique;
+    PNFD_OPTIONS opts;
+    int nc, cls, coll, action, rc;
+    uint64_t t0;
+
+
+    t0 = m_start(MP_CLASSIFY);
+    nc = utf8_class(name, strlen(name));
+    m_stop(MP_CLASSIFY, t0, 1);
+
+    /* The common case - don't stat() unless we really need it */
+    if (nc == NC_ASCII) {
+        if (f_verbose > 1) {
+	    p_object(path, "ASCII", OC_ASCII, OCOLL_NONE, NULL, f_time ? obj_stat(op) : NULL);
+        }
+	
+	p_index(op, OC_ASCII, OCOLL_NONE);
+        cp->ascii++;
+        return 0;
+    }
+
+    if (nc == NC_INVALID) {
+        p_object(path, "Unknown Encoding - Skipping", OC_INVALID, OCOLL_NONE, NULL,
+		 f_time ? obj_stat(op) : NULL);
+	p_index(op, OC_INVALID, OCOLL_NONE);
+        cp->unknown++;
+        return 0;
+    }
+
+    sp = obj_stat(op);
+    if (!sp) {
+        cp->unread++;
+        return 0;
+    }
+
+    t0 = m_start(MP_NORMALIZE);
+    cls = pnfd_utf8_class(name, nfc_output, sizeof(nfc_output));
+    m_stop(MP_NORMALIZE, t0, 1);
+    if (cls < 0) {
+        fprintf(stderr, "%s: Error: %s: Normalizing: %s\n",
+                argv0, path, strerror(errno));
+        cp->unread++;
         return -1;
     }
 
+    if (cls == OC_NFC) {
+        if (f_verbose > 1) {
+	    p_object(path, "NFC", OC_NFC, OCOLL_NONE, NULL, sp);
+	}
+	
+	p_index(op, OC_NFC, OCOLL_NONE);
+        ++cp->nfc;
+        return 0;
+    }
+
+    if (cls == OC_UTF8) {
+        if (f_verbose > 1) {
+	    p_object(path, "UTF8", OC_UTF8, OCOLL_NONE, NULL, sp);
+	}
+	
+        cp->other++;
+    }
+    ++cp->nfd;
+
+    time2str(sp->st_mtime, nfd_timebuf, sizeof(nfd_timebuf));
+
+    /* No need to ask the filesystem if the directory listing says there is no NFC twin */
+    t0 = m_start(MP_COLLISION);
+    if (op->names && !obj_sibling_exists(op, nfc_output)) {
+        rc = -1;
+        errno = ENOENT;
+    } else
+        rc = xstatat(op->dirfd, nfc_output, &nfc_sb, XS_SCAN);
+    m_stop(MP_COLLISION, t0, 1);
+    if (rc < 0 && errno != ENOENT) {
+        /* Better safe than sorry - don't risk overwriting an existing NFC object */
+        fprintf(stderr, "%s: Error: %s: Checking for NFC collision: %s\n",
+                argv0, path, strerror(errno));
+        cp->unread++;
+        return 0;
+    }
+    coll = (rc == 0 ? pnfd_collision(&nfc_sb, sp) : OCOLL_NONE);
+
+    p_index(op, cls, coll);
+
+    fix_options(&opts);
+    action = pnfd_action(&opts, coll);
+
+    if (f_autofix && f_debug) {
+        char nfc_timebuf[256];
+
+        switch (coll) {
+        case OCOLL_NONE:
+            printf("%s: Renaming %s to NFC (%s) [size: %lu]\n",
+                   path,
+                   cls == OC_NFD ? "NFD" : "UTF8",
+                   nfd_timebuf,
+                   sp->st_size);
+            break;
+        case OCOLL_NEWER:
+            time2str(nfc_sb.st_mtime, nfc_timebuf, sizeof(nfc_timebuf));
+            printf("%s: Collision - %s %s & Keep newer NFC (%s > %s) [size: %lu vs %lu]\n",
+                   path,
+                   f_remove ? "Remove" : "Rename",
+                   cls == OC_NFD ? "NFD" : "UTF8",
+                   nfc_timebuf, nfd_timebuf,
+                   nfc_sb.st_size, sp->st_size);
+            break;
+        case OCOLL_OLDER:
+            time2str(nfc_sb.st_mtime, nfc_timebuf, sizeof(nfc_timebuf));
+            printf("%s: Collision - %s older NFC & Rename %s (%s < %s) [size: %lu vs %lu]\n",
+                   path,
+                   f_remove ? "Remove" : "Rename",
+                   cls == OC_NFD ? "NFD" : "UTF8",
+                   nfc_timebuf, nfd_timebuf,
+                   nfc_sb.st_size, sp->st_size);
+            break;
+        }
+    }
+
+    switch (action) {
+    case OA_RENAME_NFD:
+        add_action(path, sp, name, NULL, nfc_output, NULL, ACT_RENAME_NFD);
+        break;
+
+    case OA_MOVE_NFD:
+    case OA_REMOVE_NFD:
+        unique = (action == OA_MOVE_NFD ? mkunique(nfc_output, sp, op) : NULL);
+        add_action(path, sp, name, &nfc_sb, nfc_output, unique, ACT_REMOVE_NFD);
+        free(unique);
+        break;
+
+    case OA_MOVE_NFC:
+    case OA_REPLACE_NFC:
+        unique = (action == OA_MOVE_NFC ? mkunique(nfc_output, &nfc_sb, op) : NULL);
+        add_action(path, sp, name, &nfc_sb, nfc_output, unique, ACT_REMOVE_NFC);
+        free(unique);
+        break;
+
+    default:
+        if (f_autofix) {
+            /* Collisions are only fixed with -aa */
+            if (f_verbose)
+                p_object(path,
+                         coll == OCOLL_NEWER ?
+                         "Collision - NFD (with newer NFC collision) - Not fixing" :
+                         "Collision - NFD (with non-newer NFC collision) - Not fixing",
+                         OC_NFD, coll, nfc_output, sp);
+        } else if (f_verbose)
+            p_object(path,
+                     coll == OCOLL_NONE ? "NFD" :
+                     coll == OCOLL_NEWER ? "NFD (with newer NFC collision)" :
+                     "NFD (with non-newer NFC collision)",
+                     OC_NFD, coll, nfc_output, sp);
+        else
+            p_object(path, NULL, OC_NFD, coll, nfc_output, sp);
+    }
+
+    if (coll != OCOLL_NONE)
+        cp->coll++;
+
     return 0;
 }
 
-char *
-dirname(const char *path,
-	const char **name) {
-    char *cp;
-    size_t len;
+static int
+actdir_cmp(const void *va,
+	   const void *vb) {
+    const ACTDIR *a = *(const ACTDIR **) va;
+    const ACTDIR *b = *(const ACTDIR **) vb;
 
-    cp = strrchr(path, '/');
-    if (!cp) {
-        if (name)
-            *name = path;
+    /* Deepest directories first so we never rename a directory before its contents */
+    if (a->depth != b->depth)
+	return b->depth - a->depth;
+    return strcmp(a->dir, b->dir);
+}
 
-        return strdup(".");
-    }
 
-    len = cp-path;
-    if (name)
-        *name = cp+1;
+/*
+ * Is the object still the one a plan entry was made for - same inode
+ * and, unless it is a directory (whose timestamp changes when the
+ * objects in it are fixed first), same modification time.
+ */
+static int
+plan_current(int dfd,
+	     const char *name,
+	     const struct stat *psp) {
+    struct stat sb;
+    uint64_t t0;
+    int rc;
 
-    return strndup(path, len);
+    t0 = m_start(MP_STAT);
+    rc = xstatat(dfd, name, &sb, XS_SYNC);
+    m_stop(MP_STAT, t0, 1);
+    if (rc < 0)
+	return 0;
 
+    if (sb.st_ino != psp->st_ino || (sb.st_mode & S_IFMT) != (psp->st_mode & S_IFMT))
+	return 0;
+    return (S_ISDIR(sb.st_mode) ||
+	    (sb.st_mtim.tv_sec == psp->st_mtim.tv_sec &&
+	     sb.st_mtim.tv_nsec == psp->st_mtim.tv_nsec));
 }
 
-int
-is_nfd(UChar utf16_input[8192],
-       int32_t utf16_len) {
-    UErrorCode status = U_ZERO_ERROR;
-    UBool r;
-
-    r = unorm2_isNormalized(nfd, utf16_input, utf16_len, &status);
-    if (U_FAILURE(status)) {
-        fprintf(stderr, "NFD Normalization check failed: %s\n", u_errorName(status));
-        return -1;
+static void
+run_action(PNFD *pp,
+	   const PNFD_OPTIONS *op,
+	   int dfd,
+	   ACTION *ap) {
+    PNFD_COUNTERS c0, c1;
+    PNFD_RESULT r;
+    struct stat sb;
+    uint64_t t0 = 0;
+    int rc, hard;
+
+    /* Planned (-X) for objects that have since been changed or replaced? */
+    if (ap->planned &&
+	(!plan_current(dfd, ap->nfd.name, &ap->nfd.sb) ||
+	 (ap->type != ACT_RENAME_NFD && !plan_current(dfd, ap->nfc.name, &ap->nfc.sb)))) {
+	fprintf(stderr, "%s: %s/%s: Changed since the plan was made - Skipping\n",
+		argv0, ap->dir, ap->nfd.name);
+	n_stale++;
+	return;
     }
 
-    return r;
-}
+    /* Interrupted after (part of) it was done? */
+    if (ap->resumed && f_update) {
+	if (xstatat(dfd, ap->nfd.name, &sb, XS_SYNC) < 0 && errno == ENOENT)
+	    return;
+	if (ap->type == ACT_REMOVE_NFC &&
+	    xstatat(dfd, ap->nfc.name, &sb, XS_SYNC) < 0 && errno == ENOENT)
+	    ap->type = ACT_RENAME_NFD;
+    }
 
+    memset(&r, 0, sizeof(r));
+    r.name = ap->nfd.name;
+    r.cls = OC_NFD;
+    r.nfc = ap->nfc.name;
+    r.sp = &ap->nfd.sb;
+    switch (ap->type) {
+    case ACT_REMOVE_NFD:
+	r.coll = OCOLL_NEWER;
+	break;
+    case ACT_REMOVE_NFC:
+	r.coll = OCOLL_OLDER;
+	break;
+    default:
+	r.coll = OCOLL_NONE;
+    }
+    r.action = pnfd_action(op, r.coll);
+
+    /* The unique name was picked when the directory was scanned - use it if still unused */
+    if ((r.action == OA_MOVE_NFD || r.action == OA_MOVE_NFC) && ap->unique &&
+	xstatat(dfd, ap->unique, &sb, XS_SYNC) < 0 && errno == ENOENT)
+	r.to = ap->unique;
+
+    pnfd_counters(pp, &c0);
+    if (f_update)
+	t0 = m_start(MP_RENAME);
+    rc = pnfd_fix_object(pp, dfd, &r, &ap->nfc.sb);
+    if (f_update)
+	m_stop(MP_RENAME, t0, 1);
+    pnfd_counters(pp, &c1);
+    n_renamed += c1.renamed - c0.renamed;
+    n_removed += c1.removed - c0.removed;
+
+    if (rc < 0) {
+	/* Failing after an object has been moved out of the way is fatal */
+	hard = 0;
+	switch (r.action) {
+	case OA_RENAME_NFD:
+	    if (r.error == EEXIST)
+		fprintf(stderr, "%s: Error: %s/%s -> %s: Rename: NFC object has appeared\n",
+			argv0, ap->dir, ap->nfd.name, ap->nfc.name);
+	    else {
+		fprintf(stderr, "%s: Error: %s/%s -> %s: Rename: %s\n",
+			argv0, ap->dir, ap->nfd.name, ap->nfc.name, strerror(r.error));
+		hard = 1;
+	    }
+	    break;
 
+	case OA_MOVE_NFD:
+	case OA_MOVE_NFC:
+	    if (!r.to) {
+		fprintf(stderr, "%s: Error: %s/%s: Unique name: %s\n",
+			argv0, ap->dir, ap->nfc.name, strerror(r.error));
+		break;
+	    }
+	    if (r.action == OA_MOVE_NFD) {
+		fprintf(stderr, "%s: Error: %s/%s -> %s: Rename NFD: %s\n",
+			argv0, ap->dir, ap->nfd.name, r.to, strerror(r.error));
+		break;
+	    }
+	    if (!r.partial) {
+		fprintf(stderr, "%s: Error: %s/%s -> %s: Rename NFC: %s\n",
+			argv0, ap->dir, ap->nfc.name, r.to, strerror(r.error));
+		break;
+	    }
+	    p_action(ap->dir, ap->nfc.name, r.to, OA_MOVE_NFC, &ap->nfc.sb);
+	    /* Fall through */
+	case OA_REPLACE_NFC:
+	    fprintf(stderr, "%s: Error: %s/%s -> %s: Rename NFD: %s\n",
+		    argv0, ap->dir, ap->nfd.name, ap->nfc.name, strerror(r.error));
+	    hard = 1;
+	    break;
 
-int
-is_nfc(UChar utf16_input[8192],
-       int32_t utf16_len) {
-    UErrorCode status = U_ZERO_ERROR;
-    UBool r;
-
-    r = unorm2_isNormalized(nfc, utf16_input, utf16_len, &status);
-    if (U_FAILURE(status)) {
-        fprintf(stderr, "NFC Normalization check failed: %s\n", u_errorName(status));
-        return -1;
+	case OA_REMOVE_NFD:
+	    fprintf(stderr, "%s: Error: %s/%s: Remove NFD: %s\n",
+		    argv0, ap->dir, ap->nfd.name, strerror(r.error));
+	    break;
+	}
+
+	n_errors++;
+	if (hard ? f_watch : f_ignore)
+	    return;
+	exit(1);
     }
 
-    return r;
+    switch (r.action) {
+    case OA_MOVE_NFC:
+	p_action(ap->dir, ap->nfc.name, r.to, OA_MOVE_NFC, &ap->nfc.sb);
+	p_action(ap->dir, ap->nfd.name, ap->nfc.name, OA_RENAME_NFD, &ap->nfd.sb);
+	break;
+    case OA_MOVE_NFD:
+	p_action(ap->dir, ap->nfd.name, r.to, OA_MOVE_NFD, &ap->nfd.sb);
+	break;
+    case OA_REMOVE_NFD:
+	p_action(ap->dir, ap->nfd.name, NULL, OA_REMOVE_NFD, &ap->nfd.sb);
+	break;
+    default:
+	p_action(ap->dir, ap->nfd.name, ap->nfc.name, r.action, &ap->nfd.sb);
+    }
 }
 
 
+/*
+ * Plain NFD -> NFC renames (by far the most common action) done as two
+ * io_uring batches - check that no NFC object has appeared, then rename.
+ * Two names that normalize to the same NFC name are left to
+ * run_action() so the second one is caught by its check. -1 if the
+ * ring has been given up (and destroyed).
+ */
+static int
+run_dir_renames(URING *up,
+		int dfd,
+		ACTDIR *dp) {
+    ACTION *ap, **bv;
+    const char **htab;
+    USTATX *stv;
+    int *srv, *rrv;
+    size_t n, m, i, hsize;
+    int fatal = 0, ret = 0;
+
+
+    for (n = 0, ap = dp->actions; ap; ap = ap->next)
+	if (ap->type == ACT_RENAME_NFD && !ap->resumed && !ap->planned)
+	    n++;
+    if (n == 0)
+	return 0;
 
+    for (hsize = 16; hsize < n*2; hsize *= 2)
+	;
+    htab = calloc(hsize, sizeof(*htab));
+    bv = malloc(n*sizeof(*bv));
+    stv = malloc(n*sizeof(*stv));
+    srv = malloc(n*sizeof(*srv));
+    rrv = malloc(n*sizeof(*rrv));
+    if (!htab || !bv || !stv || !srv || !rrv)
+	abort();
 
-int
-to_nfc(UChar utf16_input[8192],
-       int32_t utf16_len,
-       char utf8_output[8192],
-       int32_t *utf8_output_len) {
-    UErrorCode status = U_ZERO_ERROR;
-    UChar utf16_output[8192];
-    int32_t output_len;
-
-    output_len = unorm2_normalize(nfc, utf16_input, utf16_len, utf16_output, 8192, &status);
-    if (U_FAILURE(status)) {
-        fprintf(stderr, "Normalization to NFC failed: %s\n", u_errorName(status));
-        return -1;
-    }
+    for (n = 0, ap = dp->actions; ap; ap = ap->next) {
+	const char *name = ap->nfc.name;
 
-    // Convert UTF-16 back to UTF-8
-    u_strToUTF8(utf8_output, 8192, utf8_output_len, utf16_output, output_len, &status);
-    if (U_FAILURE(status)) {
-        fprintf(stderr, "UTF-16 to UTF-8 conversion failed: %s\n", u_errorName(status));
-        return -1;
+	if (ap->type != ACT_RENAME_NFD || ap->resumed || ap->planned)
+	    continue;
+
+	for (i = fnv1a(name, strlen(name)) & (hsize-1); htab[i]; i = (i+1) & (hsize-1))
+	    if (strcmp(htab[i], name) == 0)
+		break;
+	if (htab[i])
+	    continue;
+	htab[i] = name;
+
+	ap->batched = 1;
+	bv[n++] = ap;
     }
 
-    return 0;
-}
+    if (f_update) {
+	uint64_t t0;
+	int rc;
 
+	for (i = 0; i < n; i++)
+	    if (uring_statx(up, dfd, bv[i]->nfc.name, AT_SYMLINK_NOFOLLOW|xstat_flags(XS_SYNC),
+			    &stv[i], &srv[i]) < 0)
+		break;
+	t0 = m_start(MP_COLLISION);
+	rc = uring_wait(up);
+	m_stop(MP_COLLISION, t0, i);
+	if (i < n || rc < 0) {
+	    /* Nothing has been renamed yet - let run_action() do it all */
+	    for (i = 0; i < n; i++)
+		bv[i]->batched = 0;
+	    /* Once no statx() is in flight */
+	    if (uring_destroy(up) < 0) {
+		/* The kernel may still write to them - never free them */
+		stv = NULL;
+		srv = NULL;
+	    }
+	    ret = -1;
+	    goto End;
+	}
 
-int
-is_ascii(const char *s) {
-    while (*s) {
-        if (!isascii(*s))
-            return 0;
-        s++;
+	for (i = 0, m = 0; i < n; i++) {
+	    rrv[i] = URING_PENDING;
+	    if (srv[i] == -ENOENT) {
+		uring_renameat(up, dfd, bv[i]->nfd.name, dfd, bv[i]->nfc.name, &rrv[i]);
+		m++;
+	    }
+	}
+	t0 = m_start(MP_RENAME);
+	rc = uring_wait(up);
+	m_stop(MP_RENAME, t0, m);
+	if (rc < 0) {
+	    fprintf(stderr, "%s: Error: %s: io_uring: %s\n",
+		    argv0, dp->dir, strerror(errno));
+	    /* Report what was done once no rename is in flight, then stop */
+	    if (uring_destroy(up) < 0)
+		exit(1);
+	    ret = -1;
+	    fatal = 1;
+	}
     }
-    return 1;
+
+    for (i = 0; i < n; i++) {
+	ap = bv[i];
+
+	if (!f_update) {
+	    p_action(ap->dir, ap->nfd.name, ap->nfc.name, OA_RENAME_NFD, &ap->nfd.sb);
+	} else if (srv[i] != -ENOENT) {
+	    if (srv[i] == 0)
+		fprintf(stderr, "%s: Error: %s/%s -> %s: Rename: NFC object has appeared\n",
+			argv0, ap->dir, ap->nfd.name, ap->nfc.name);
+	    else
+		fprintf(stderr, "%s: Error: %s/%s -> %s: Rename: %s\n",
+			argv0, ap->dir, ap->nfd.name, ap->nfc.name, strerror(-srv[i]));
+	    n_errors++;
+	    if (!f_ignore)
+		fatal = 1;
+	} else if (rrv[i] < 0) {
+	    fprintf(stderr, "%s: Error: %s/%s -> %s: Rename: %s\n",
+		    argv0, ap->dir, ap->nfd.name, ap->nfc.name,
+		    strerror(rrv[i] == URING_PENDING ? EIO : -rrv[i]));
+	    n_errors++;
+	    if (!f_watch)
+		fatal = 1;
+	} else {
+	    n_renamed++;
+	    p_action(ap->dir, ap->nfd.name, ap->nfc.name, OA_RENAME_NFD, &ap->nfd.sb);
+	}
+    }
+
+    /* The rest of the renames in the batch have been reported - now stop */
+    if (fatal)
+	exit(1);
+
+ End:
+    free(htab);
+    free(bv);
+    free(stv);
+    free(srv);
+    free(rrv);
+    return ret;
 }
 
 
-int
-is_valid_utf8(const char *str) {
-    const unsigned char *bytes = (const unsigned char *)str;
-
-    while (*bytes) {
-        if (*bytes <= 0x7F) {
-            // ASCII
-            bytes += 1;
-        } else if ((*bytes & 0xE0) == 0xC0) {
-            // 2-byte sequence
-            if ((bytes[1] & 0xC0) != 0x80) return 0;
-            if (*bytes < 0xC2) return 0; // Overlong encoding
-            bytes += 2;
-        } else if ((*bytes & 0xF0) == 0xE0) {
-            // 3-byte sequence
-            if ((bytes[1] & 0xC0) != 0x80 || (bytes[2] & 0xC0) != 0x80) return 0;
-            if (*bytes == 0xE0 && bytes[1] < 0xA0) return 0; // Overlong
-            if (*bytes == 0xED && bytes[1] >= 0xA0) return 0; // Surrogates
-            bytes += 3;
-        } else if ((*bytes & 0xF8) == 0xF0) {
-            // 4-byte sequence
-            if ((bytes[1] & 0xC0) != 0x80 ||
-                (bytes[2] & 0xC0) != 0x80 ||
-                (bytes[3] & 0xC0) != 0x80) return 0;
-            if (*bytes == 0xF0 && bytes[1] < 0x90) return 0; // Overlong
-            if (*bytes == 0xF4 && bytes[1] > 0x8F) return 0; // Above U+10FFFF
-            if (*bytes > 0xF4) return 0; // Invalid
-            bytes += 4;
-        } else {
-            return 0; // Invalid leading byte
-        }
+/* Run all actions for one directory */
+void
+run_dir_actions(ACTDIR *dp,
+		int start_fd) {
+    static URING *up = NULL;
+    static int up_tried = 0;
+    static PNFD *pp = NULL;
+    static PNFD_OPTIONS opts;
+    ACTION *ap;
+    int dfd;
+
+
+    dfd = open_dir(start_fd, dp->dir, 0);
+    if (dfd < 0) {
+	fprintf(stderr, "%s: Error: %s: open: %s\n",
+		argv0, dp->dir, strerror(errno));
+	n_errors++;
+	/* Probably removed since it was scanned */
+	if (f_watch)
+	    return;
+	exit(1);
+    }
+
+    /* Only ever called by one thread at a time */
+    if (uring_depth > 0 && !up_tried) {
+	up = uring_create(uring_depth);
+	up_tried = 1;
+    }
+    if (up && run_dir_renames(up, dfd, dp) < 0)
+	up = NULL;
+
+    if (!pp) {
+	/* Collisions were already decided on when the actions were added */
+	fix_options(&opts);
+	opts.fix = 2;
+	pp = pnfd_create(&opts, NULL, NULL);
+	if (!pp) {
+	    fprintf(stderr, "%s: Error: pnfd_create: %s\n",
+		    argv0, strerror(errno));
+	    exit(1);
+	}
     }
-    return 1;
+
+    for (ap = dp->actions; ap; ap = ap->next)
+	if (!ap->batched)
+	    run_action(pp, &opts, dfd, ap);
+
+    close(dfd);
 }
 
 
 void
-spin(int last_f) {
-    static time_t first = 0, last;
-    static unsigned long last_n_objects = 0;
-    time_t now;
-    double dt;
+run_actions(void) {
+    ACTDIR **v, *dp;
+    unsigned long i, n;
+    int h;
     
+    metrics_progress(1);
     if (!isatty(fileno(stderr)))
-        return;
+	putc('\n', stderr);
 
-    time(&now);
-    if (!first)
-	first = now;
+    if (!n_actdirs)
+	return;
+
+    /*
+     * The walker threads add actions in whatever order they happen
+     * to visit the tree, so sort the directories into a safe (and
+     * repeatable) order.
+     */
+    v = malloc(n_actdirs*sizeof(*v));
+    if (!v)
+	abort();
+    for (n = 0, h = 0; h < ACTDIR_HSIZE; h++)
+	for (dp = actdir_htab[h]; dp; dp = dp->hnext)
+	    v[n++] = dp;
+    qsort(v, n, sizeof(*v), actdir_cmp);
+
+    /* Action directories are relative to where we started */
+    for (i = 0; i < n; i++)
+	run_dir_actions(v[i], AT_FDCWD);
+
+    free(v);
+}
 
-    if (last_f) {
-	dt = difftime(now,first);
-	if (!dt)
-	    dt = 1;
-	fprintf(stderr, "[%lu scanned, %.0f o/s]       \n", n_objects, n_objects/dt);
-    } else {
-	dt = difftime(now,last);
-	if (dt) {
-	    unsigned long dn = n_objects - last_n_objects;
-	    last_n_objects = n_objects;
-	    
-	    fprintf(stderr, "[%lu scanned, %.0f o/s]       \r", n_objects, dn/dt);
-	    last = now;
+#define LEAF_BATCH	(64*1024)
+
+/*
+ * Classify the listed objects only (-l). Names are collected in batches
+ * (to keep the memory use bounded) and handed to walk_list() which
+ * groups them by directory.
+ */
+static int
+scan_list(PATHLIST *pp) {
+    char *buf = NULL, **v;
+    size_t *ov, bsize = 0, blen = 0, n = 0, i;
+    const char *fname;
+    size_t flen;
+    int rc;
+
+
+    v = malloc(LEAF_BATCH*sizeof(*v));
+    ov = malloc(LEAF_BATCH*sizeof(*ov));
+    if (!v || !ov)
+	abort();
+
+    do {
+	rc = pathlist_next(pp, &fname, &flen);
+	if (rc > 0) {
+	    if (blen+flen+1 > bsize) {
+		bsize = (blen+flen+1)*2;
+		buf = realloc(buf, bsize);
+		if (!buf)
+		    abort();
+	    }
+	    memcpy(buf+blen, fname, flen+1);
+	    ov[n++] = blen;
+	    blen += flen+1;
+	    n_scanned++;
 	}
-    }
-}
 
+	if (n > 0 && (rc <= 0 || n == LEAF_BATCH)) {
+	    for (i = 0; i < n; i++)
+		v[i] = buf+ov[i];
+	    walk_list(v, n);
 
-int
-is_newer(const struct stat *a,
-	 const struct stat *b) {
-    if (a->st_mtim.tv_sec > b->st_mtim.tv_sec ||
-	(a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
-	 a->st_mtim.tv_nsec > b->st_mtim.tv_nsec))
-	return 1;
-    if (a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
-	a->st_mtim.tv_nsec == b->st_mtim.tv_nsec)
-	return 0;
-    return -1;
+	    run_actions();
+	    free_actions();
+	    n = blen = 0;
+	}
+    } while (rc > 0);
+
+    free(buf);
+    free(ov);
+    free(v);
+    return rc;
 }
 
-int
-p_time(const struct stat *sp,
-       FILE *fp) {
-  char buf[256];
-  struct tm *tp;
+/*
+ * Checkpoints (-K). The state file holds the position in the list of
+ * roots, the counters, the actions not yet run and the directories
+ * still queued for scanning, so -R can continue from there.
+ */
+static unsigned long n_roots = 0;	/* Roots done */
+static const char *cur_root = NULL;	/* Root being walked */
+static uint64_t ck_next = 0;
 
-  tp = localtime(&sp->st_mtime);
-  if (!tp)
-    fputs(" [???]", fp);
-  
-  if (strftime(buf, sizeof(buf), "%F %T", tp) <= 0)
-    fputs(" [???]", fp);
-  
-  return fprintf(fp, " [%s]", buf);
+/* Restored by load_checkpoint() */
+static int rs_pending = 0;
+static CKROOT rs_root;
+static char *rs_path = NULL;
+static char **rs_dirs = NULL;
+static uint64_t *rs_devs = NULL;
+static size_t rs_ndirs = 0;
+
+
+static uint64_t
+now_sec(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
 }
 
 int
-walker(const char *path,
-       const struct stat *sp,
-       int flag,
-       struct FTW *fp) {
-    UChar utf16_input[8192];
-    int32_t utf16_len;
-    int rc_nfd, rc_nfc;
+checkpoint_due(void) {
+    return f_ckpt && now_sec() >= __atomic_load_n(&ck_next, __ATOMIC_RELAXED);
+}
 
+static void
+stat2ck(CKSTAT *cp,
+	const struct stat *sp) {
+    cp->ino = sp->st_ino;
+    cp->mode = sp->st_mode;
+    cp->size = sp->st_size;
+    cp->mtime = sp->st_mtim.tv_sec;
+    cp->mtime_ns = sp->st_mtim.tv_nsec;
+}
 
-    ++n_objects;
-    spin(0);
+static void
+ck2stat(struct stat *sp,
+	const CKSTAT *cp) {
+    memset(sp, 0, sizeof(*sp));
+    sp->st_ino = cp->ino;
+    sp->st_mode = cp->mode;
+    sp->st_size = cp->size;
+    sp->st_mtim.tv_sec = cp->mtime;
+    sp->st_mtim.tv_nsec = cp->mtime_ns;
+}
 
-    if (flag == FTW_NS) {
-        n_unread++;
-        return 0;
-    }
+static int
+save_actdir(CKFILE *ckp,
+	    const ACTDIR *dp) {
+    ACTION *ap;
 
-    if (is_ascii(path+fp->base)) {
-        if (f_verbose > 1) {
-	    printf("%s: ASCII", path);
-	    if (f_time)
-	      p_time(sp, stdout);
-	    putchar('\n');
-        }
-	
-        n_ascii++;
-        return 0;
+    for (ap = dp->actions; ap; ap = ap->next) {
+	CKACTION a;
+
+	memset(&a, 0, sizeof(a));
+	a.type = ap->type;
+	stat2ck(&a.nfd, &ap->nfd.sb);
+	stat2ck(&a.nfc, &ap->nfc.sb);
+	if (ap->type != ACT_RENAME_NFD)
+	    a.flags |= CKA_NFC_STAT;
+	if (ap->unique)
+	    a.flags |= CKA_UNIQUE;
+	if (ckpt_put(ckp, CK_ACTION, &a, sizeof(a), 4,
+		     ap->dir, ap->nfd.name, ap->nfc.name, ap->unique) < 0)
+	    return -1;
     }
 
-    if (!is_valid_utf8(path+fp->base)) {
-        printf("%s: Unknown Encoding - Skipping", path);
-	if (f_time)
-	    p_time(sp, stdout);
-	putchar('\n');
-        n_unknown++;
-        return 0;
+    return 0;
+}
+
+static int
+save_actions(CKFILE *ckp) {
+    ACTDIR *dp;
+    int h;
+
+    for (h = 0; h < ACTDIR_HSIZE; h++)
+	for (dp = actdir_htab[h]; dp; dp = dp->hnext)
+	    if (save_actdir(ckp, dp) < 0)
+		return -1;
+
+    return 0;
+}
+
+/* A CK_ACTION record (checkpoint or plan) back into the action table */
+static ACTION *
+load_action(const void *data,
+	    size_t len) {
+    CKACTION a;
+    struct stat nfd_sb, nfc_sb;
+    const char *sv[4];
+    char *path;
+    ACTION *ap;
+
+    if (ckpt_fields(data, len, sizeof(a), sv, 4) < 0)
+	return NULL;
+    memcpy(&a, data, sizeof(a));
+    ck2stat(&nfd_sb, &a.nfd);
+    ck2stat(&nfc_sb, &a.nfc);
+
+    /* add_action() wants the path of the NFD object, as the walker found it */
+    path = malloc(strlen(sv[0])+strlen(sv[1])+2);
+    if (!path)
+	abort();
+    if (strcmp(sv[0], ".") == 0)
+	strcpy(path, sv[1]);
+    else
+	sprintf(path, "%s%s%s", sv[0], strcmp(sv[0], "/") == 0 ? "" : "/", sv[1]);
+
+    ap = add_action(path, &nfd_sb, sv[1],
+		    (a.flags & CKA_NFC_STAT) ? &nfc_sb : NULL, sv[2],
+		    (a.flags & CKA_UNIQUE) ? sv[3] : NULL, a.type);
+    free(path);
+    return ap;
+}
+
+/*
+ * All the totals as a vector, for checkpoints and partial results (-p).
+ * cp has the counters not yet merged by the walker, if any.
+ */
+static void
+get_counters(uint64_t *cv,
+	     const COUNTERS *cp) {
+    memset(cv, 0, CK_NCOUNTERS*sizeof(*cv));
+    cv[0] = n_ascii + (cp ? cp->ascii : 0);
+    cv[1] = n_nfd + (cp ? cp->nfd : 0);
+    cv[2] = n_nfc + (cp ? cp->nfc : 0);
+    cv[3] = n_other + (cp ? cp->other : 0);
+    cv[4] = n_unknown + (cp ? cp->unknown : 0);
+    cv[5] = n_coll + (cp ? cp->coll : 0);
+    cv[6] = n_unread + (cp ? cp->unread : 0);
+    cv[7] = __atomic_load_n(&n_objects, __ATOMIC_RELAXED);
+    cv[8] = n_renamed;
+    cv[9] = n_removed;
+    cv[10] = n_errors;
+}
+
+static void
+set_counters(const uint64_t *cv) {
+    n_ascii = cv[0];
+    n_nfd = cv[1];
+    n_nfc = cv[2];
+    n_other = cv[3];
+    n_unknown = cv[4];
+    n_coll = cv[5];
+    n_unread = cv[6];
+    n_objects = cv[7];
+    n_renamed = cv[8];
+    n_removed = cv[9];
+    n_errors = cv[10];
+}
+
+/*
+ * Save the scan state. walked is set when the current root has been
+ * completely scanned (only its actions are left).
+ */
+void
+checkpoint(int walked) {
+    CKFILE *ckp = NULL;
+    CKROOT r;
+    struct stat sb;
+    COUNTERS c;
+    uint64_t cv[CK_NCOUNTERS];
+    int rc;
+
+
+    if (!f_ckpt)
+	return;
+
+    /*
+     * Everything reported up to here must be in the output before the
+     * checkpoint says so, or a resumed run would never write it.
+     */
+    memset(&r, 0, sizeof(r));
+    r.output = -1;
+    out_flush();
+    if (fflush(stdout) != 0)
+	goto Fail;
+    if (fstat(STDOUT_FILENO, &sb) == 0 && S_ISREG(sb.st_mode)) {
+	if (fsync(STDOUT_FILENO) < 0)
+	    goto Fail;
+	r.output = sb.st_size;
     }
 
-    if (utf8_to_utf16(path+fp->base, utf16_input, &utf16_len) < 0)
-        return -1;
+    ckp = ckpt_create(f_ckpt);
+    if (!ckp)
+	goto Fail;
+
+    r.seq = n_roots;
+    r.walked = walked;
+    if (ckpt_put(ckp, CK_ROOT, &r, sizeof(r), 1, cur_root) < 0)
+	goto Fail;
+
+    pthread_mutex_lock(&actions_mtx);
+    rc = save_actions(ckp);
+    pthread_mutex_unlock(&actions_mtx);
+
+    memset(&c, 0, sizeof(c));
+    if (rc < 0 || walk_save(ckp, &c) < 0)
+	goto Fail;
+
+    get_counters(cv, &c);
+    if (ckpt_put(ckp, CK_COUNTERS, cv, sizeof(cv), 0) < 0)
+	goto Fail;
+
+    rc = ckpt_commit(ckp);
+    ckp = NULL;
+    if (rc < 0)
+	goto Fail;
+
+    if (f_debug)
+	fprintf(stderr, "[checkpoint: %s]\n", f_ckpt);
+    __atomic_store_n(&ck_next, now_sec() + f_ckpt_interval, __ATOMIC_RELAXED);
+    return;
+
+ Fail:
+    /* Keep going - the previous checkpoint is still there */
+    fprintf(stderr, "%s: Error: %s: Writing checkpoint: %s\n",
+	    argv0, f_ckpt, strerror(errno));
+    ckpt_close(ckp);
+    __atomic_store_n(&ck_next, now_sec() + f_ckpt_interval, __ATOMIC_RELAXED);
+}
+
+static int
+load_checkpoint(const char *path) {
+    CKFILE *ckp;
+    const void *data;
+    size_t len;
+    int type, root = 0;
 
-    rc_nfd = is_nfd(utf16_input, utf16_len);
-    if (rc_nfd < 0)
-        return rc_nfd;
 
-    rc_nfc = is_nfc(utf16_input, utf16_len);
-    if (rc_nfc < 0)
-        return rc_nfc;
+    ckp = ckpt_open(path);
+    if (!ckp)
+	return -1;
 
-    if (!rc_nfc && !rc_nfd) {
-        if (f_verbose > 1) {
-	    printf("%s: UTF8", path);
-	    if (f_time)
-	        p_time(sp, stdout);
-	    putchar('\n');
+    while ((type = ckpt_next(ckp, &data, &len)) > 0) {
+	const char *sv[4];
+
+	switch (type) {
+	case CK_ROOT:
+	    if (ckpt_fields(data, len, sizeof(CKROOT), sv, 1) < 0)
+		goto Fail;
+	    memcpy(&rs_root, data, sizeof(rs_root));
+	    rs_path = strdup(sv[0]);
+	    if (!rs_path)
+		abort();
+	    root = 1;
+	    break;
+
+	case CK_COUNTERS: {
+	    uint64_t cv[CK_NCOUNTERS];
+
+	    if (ckpt_fields(data, len, sizeof(cv), sv, 0) < 0)
+		goto Fail;
+	    memcpy(cv, data, sizeof(cv));
+	    set_counters(cv);
+	    break;
 	}
-	
-        n_other++;
-    }
 
-    if (rc_nfc && !rc_nfd) {
-        if (f_verbose > 1) {
-	    printf("%s: NFC", path);
-	    if (f_time)
-	        p_time(sp, stdout);
-	    putchar('\n');
+	case CK_DIR:
+	    if (ckpt_fields(data, len, sizeof(CKDIR), sv, 1) < 0)
+		goto Fail;
+	    if (rs_ndirs % 1024 == 0) {
+		rs_dirs = realloc(rs_dirs, (rs_ndirs+1024)*sizeof(*rs_dirs));
+		rs_devs = realloc(rs_devs, (rs_ndirs+1024)*sizeof(*rs_devs));
+		if (!rs_dirs || !rs_devs)
+		    abort();
+	    }
+	    rs_devs[rs_ndirs] = ((const CKDIR *) data)->dev;
+	    rs_dirs[rs_ndirs] = strdup(sv[0]);
+	    if (!rs_dirs[rs_ndirs])
+		abort();
+	    rs_ndirs++;
+	    break;
+
+	case CK_ACTION: {
+	    ACTION *ap = load_action(data, len);
+
+	    if (!ap)
+		goto Fail;
+	    ap->resumed = 1;
+	    break;
+	}
 	}
-	
-        ++n_nfc;
     }
+    if (type < 0 || !root)
+	goto Fail;
 
-    if ((rc_nfd||1) && !rc_nfc) {
-        char nfc_output[8192];
-        int32_t nfc_len;
-        struct stat nfc_sb;
-        char nfd_timebuf[256];
+    ckpt_close(ckp);
+    rs_pending = 1;
+    return 0;
 
-        ++n_nfd;
+ Fail:
+    ckpt_close(ckp);
+    errno = EINVAL;
+    return -1;
+}
 
-        if (to_nfc(utf16_input, utf16_len, nfc_output, &nfc_len) < 0) {
-            fprintf(stderr, "to_nfc: Error\n");
-            return -1;
-        }
 
-        if (strcmp(nfc_output, path+fp->base) == 0) {
-            fprintf(stderr, "%s: NFC Conversion to Identical String - Skipping\n",
-                    path);
-            return 0;
-        }
+/*
+ * Fix plans. A dry run with -W saves its actions, with the identity of
+ * the objects, and -X later runs them without scanning anything but
+ * the directories they are in.
+ */
+static CKFILE *plan_ckp = NULL;
 
-        time2str(sp->st_mtime, nfd_timebuf, sizeof(nfd_timebuf));
+static int
+plan_create(const char *path) {
+    CKPLAN p;
 
-        if (lstat(nfc_output, &nfc_sb) == 0) {
-            char nfc_timebuf[256];
+    plan_ckp = ckpt_create(path);
+    if (!plan_ckp)
+	return -1;
 
-            time2str(nfc_sb.st_mtime, nfc_timebuf, sizeof(nfc_timebuf));
+    memset(&p, 0, sizeof(p));
+    if (f_remove)
+	p.flags |= CKP_REMOVE;
+    return ckpt_put(plan_ckp, CK_PLAN, &p, sizeof(p), 0);
+}
 
-	    if (is_newer(&nfc_sb, sp) >= 0) {
-                if (f_autofix) {
-                    if (f_debug)
-                        printf("%s: Collision - %s %s & Keep newer NFC (%s > %s) [size: %lu vs %lu]\n",
-                               path,
-			       f_remove ? "Remove" : "Rename",
-                               rc_nfd ? "NFD" : "UTF8",
-                               nfc_timebuf, nfd_timebuf,
-                               nfc_sb.st_size, sp->st_size);
-
-		    if (f_autofix > 1)
-			add_action(dirname(path, NULL), sp, path+fp->base, &nfc_sb, nfc_output, ACT_REMOVE_NFD);
-		    else {
-			if (f_verbose) {
-			    printf("%s: Collision - NFD (with newer NFC collision) - Not fixing", path);
-			    if (f_time)
-				p_time(sp, stdout);
-			    putchar('\n');
-			}
-		    }
-                } else {
-		    if (f_verbose) {
-		        printf("%s: NFD (with newer NFC collision)", path);
-			if (f_time)
- 			    p_time(sp, stdout);
-			putchar('\n');
-		    } else
-                        puts(path);
-                }
-            } else {
-                if (f_autofix) {
-                    if (f_debug)
-                        printf("%s: Collision - %s older NFC & Rename %s (%s < %s) [size: %lu vs %lu]\n",
-                               path,
-			       f_remove ? "Remove" : "Rename",
-                               rc_nfd ? "NFD" : "UTF8",
-                               nfc_timebuf, nfd_timebuf,
-                               nfc_sb.st_size, sp->st_size);
-
-		    if (f_autofix > 1)
-			add_action(dirname(path, NULL), sp, path+fp->base, &nfc_sb, nfc_output, ACT_REMOVE_NFC);
-		    else {
-			if (f_verbose) {
-			    printf("%s: Collision - NFD (with non-newer NFC collision) - Not fixing", path);
-			    if (f_time)
-				p_time(sp, stdout);
-			    putchar('\n');
-			}
-		    }
-                } else {
-		    if (f_verbose) {
-                        printf("%s: NFD (with non-newer NFC collision)", path);
-			if (f_time)
-			    p_time(sp, stdout);
-			putchar('\n');
-		    }
-                    else
-                        puts(path);
-                }
-            }
-            n_coll++;
-
-        } else {
-
-            if (f_autofix) {
-                if (f_debug)
-                    printf("%s: Renaming %s to NFC (%s) [size: %lu]\n",
-                           path,
-                           rc_nfd ? "NFD" : "UTF8",
-                           nfd_timebuf,
-                           sp->st_size);
-
-                add_action(dirname(path, NULL), sp, path+fp->base, NULL, nfc_output, ACT_RENAME_NFD);
-            } else {
-	        if (f_verbose) {
-		    printf("%s: NFD", path);
-		    if (f_time)
-		        p_time(sp, stdout);
-		    putchar('\n');
-		}
-                else
-                    puts(path);
-            }
-        }
+/* Add the actions of one directory, or all (dp = NULL) */
+static void
+plan_save(const ACTDIR *dp) {
+    if ((dp ? save_actdir(plan_ckp, dp) : save_actions(plan_ckp)) < 0) {
+	fprintf(stderr, "%s: Error: %s: Writing plan: %s\n",
+		argv0, f_plan, strerror(errno));
+	exit(1);
     }
-
-    return 0;
 }
 
-char *
-mkunique(const char *name,
-	 const struct stat *sp) {
-    char *buf;
-    size_t buflen = strlen(name)+10;
-    struct stat sb;
-    unsigned int i = 0;
+static int
+load_plan(const char *path) {
+    CKFILE *ckp;
+    const void *data;
+    size_t len;
+    int type, plan = 0;
+
+
+    ckp = ckpt_open(path);
+    if (!ckp)
+	return -1;
+
+    while ((type = ckpt_next(ckp, &data, &len)) > 0) {
+	const char *sv[1];
+	CKPLAN p;
+	ACTION *ap;
+
+	switch (type) {
+	case CK_PLAN:
+	    if (ckpt_fields(data, len, sizeof(p), sv, 0) < 0)
+		goto Fail;
+	    memcpy(&p, data, sizeof(p));
+	    /* Do what was reviewed */
+	    f_remove = (p.flags & CKP_REMOVE) ? 1 : 0;
+	    plan = 1;
+	    break;
 
-    
-    buf = malloc(buflen);
-    if (!buf)
-	return NULL;
-    
-    do {
-	if (S_ISDIR(sp->st_mode)) {
-	    /* aaa -> aaa (0) */
-	    snprintf(buf, buflen, "%s (%u)", name, i);
-	} else {
-	    char *cp = strrchr(name, '.');
-	    if (!cp) {
-		/* aaa -> aaa (0) */
-		snprintf(buf, buflen, "%s (%u)", name, i);
-	    } else {
-		/* aaa.doc -> aaa (0).doc */
-		
-		int len = cp-name;
-		snprintf(buf, buflen, "%.*s (%u)%s", len, name, i, name+len);
-	    }
+	case CK_ACTION:
+	    if (!plan || (ap = load_action(data, len)) == NULL)
+		goto Fail;
+	    ap->planned = 1;
+	    break;
+
+	default:
+	    /* A checkpoint, probably */
+	    goto Fail;
 	}
-	++i;
-    } while (lstat(buf, &sb) == 0);
+    }
+    if (type < 0 || !plan)
+	goto Fail;
 
-    return buf;
-}
+    ckpt_close(ckp);
+    return 0;
 
+ Fail:
+    ckpt_close(ckp);
+    errno = EINVAL;
+    return -1;
+}
 
-int
-get_fname(FILE *fp,
-	  char **namep) {
-    char *buf = NULL;
-    size_t bsize = 0;
-    size_t blen = 0;
-    int c;
 
+/*
+ * Scan one root (argument or -f name) and run its actions. When
+ * resuming, the roots done before the checkpoint are skipped and the
+ * one it was taken in is continued.
+ */
+static void
+scan_root(const char *root) {
+    if (rs_pending && n_roots < rs_root.seq) {
+	n_roots++;
+	return;
+    }
 
-    do {
-	while ((c = getc(fp)) != EOF) {
-	    int at_eol = (c == (f_zero ? '\0' : '\n'));
-	    
-	    if (blen == bsize) {
-		char *nbuf = realloc(buf, bsize += 1024);
-		
-		if (!nbuf) {
-		    if (buf)
-			free(buf);
-		    return -1;
-		}
-		buf = nbuf;
-	    }
-	    
-	    if (at_eol) {
-		buf[blen] = '\0';
-		break;
-	    }
-	    
-	    buf[blen++] = c;
+    cur_root = root;
+    if (rs_pending && *rs_path) {
+	if (strcmp(root, rs_path) != 0) {
+	    fprintf(stderr, "%s: Error: %s: Does not match the checkpoint (%s)\n",
+		    argv0, root, rs_path);
+	    exit(1);
 	}
-	
-	if (c == EOF)
-	    return 0;
-	
-    } while (blen == 0); /* Skip empty lines */
-    
-    *namep = buf;
-    return 1;
+	if (!rs_root.walked)
+	    walk_resume(root, (const char *const *) rs_dirs, rs_devs, rs_ndirs);
+    } else
+	walk_tree(root);
+    rs_pending = 0;
+
+    if (checkpoint_due())
+	checkpoint(1);
+    if (plan_ckp)
+	plan_save(NULL);
+    run_actions();
+    free_actions();
+
+    n_roots++;
+    cur_root = NULL;
+    if (checkpoint_due())
+	checkpoint(0);
+}
+
+
+/*
+ * Watch mode (-w) - classify the names that have appeared (and walk
+ * the directories that have) and fix them right away.
+ */
+static void
+watch_batch(char **names,
+	    size_t nnames,
+	    char **trees,
+	    size_t ntrees) {
+    size_t i;
+
+    if (nnames > 0)
+	walk_list(names, nnames);
+    for (i = 0; i < ntrees; i++)
+	walk_tree(trees[i]);
+
+    if (n_actdirs)
+	run_actions();
+    free_actions();
+
+    out_flush();
+    fflush(stdout);
 }
 
 
+/*
+ * Streaming mode - run the actions for a directory as soon as it and
+ * all directories below it have been scanned, so only the actions for
+ * directories still being worked on are kept in memory. The objects
+ * below it have already been fixed so renaming it is safe.
+ */
 void
-run_actions(void) {
-    ACTION *ap;
-    char *cwd = NULL;
-    
-    spin(1);
-    if (!isatty(fileno(stderr)))
-	putc('\n', stderr);
+dir_done(const char *path) {
+    ACTDIR *dp;
+
+    if (!f_stream || !f_autofix)
+	return;
+
+    pthread_mutex_lock(&actions_mtx);
+    dp = remove_actdir(path);
+    pthread_mutex_unlock(&actions_mtx);
+    if (!dp)
+	return;
+
+    /* Walker threads may finish directories at the same time */
+    pthread_mutex_lock(&run_mtx);
+    if (plan_ckp)
+	plan_save(dp);
+    run_dir_actions(dp, AT_FDCWD);
+    pthread_mutex_unlock(&run_mtx);
+
+    free_actdir(dp);
+}
 
-    for (ap = actions; ap; ap = ap->next) {
-        if (!cwd || strcmp(cwd, ap->dir) != 0) {
-            if (chdir(ap->dir) < 0) {
-                fprintf(stderr, "%s: Error: %s: chdir: %s\n",
-                        argv0, ap->dir, strerror(errno));
-                exit(1);
-            }
 
-            cwd = ap->dir;
-        }
+static void
+p_summary(void) {
+    fprintf(stderr,
+	    "[%lu ascii, %lu nfc, %lu nfd, %lu other, %lu unknown & %lu collisions; %lu objects, %lu unreadable, %lu renamed & %lu removed]\n",
+	    n_ascii, n_nfc, n_nfd, n_other, n_unknown, n_coll,
+	    n_objects, n_unread, n_renamed, n_removed);
+}
 
-	switch (ap->type) {
-	case ACT_RENAME_NFD:
-	    /* No name collision -> just rename to NFC */
-	    if (f_update) {
-		if (rename(ap->nfd.name, ap->nfc.name) < 0) {
-		    fprintf(stderr, "%s: Error: %s/%s -> %s: Rename: %s\n",
-			    argv0, ap->dir, ap->nfd.name, ap->nfc.name, strerror(errno));
-		    exit(1);
-		} 
-		printf("%s/%s -> %s: Renamed NFD\n",
-		       ap->dir, ap->nfd.name, ap->nfc.name);
-	    } else {
-		printf("%s/%s -> %s: Renamed NFD (NOT)\n",
-		       ap->dir, ap->nfd.name, ap->nfc.name);
-	    }
-	    break;
-	    
-	case ACT_REMOVE_NFD:
-	    /* Collision, remove NFD and keep NFC */
-	    
-	    if (!f_remove) {
-		/* Rename NFD to a unique name to avoid collisions */
-		char *new = mkunique(ap->nfc.name, &ap->nfd.sb);
-
-		if (f_update) {
-		    if (rename(ap->nfd.name, new) < 0) {
-			fprintf(stderr, "%s: Error: %s/%s -> %s: Rename NFD: %s\n",
-				argv0, ap->dir, ap->nfd.name, new, strerror(errno));
-			n_errors++;
-			if (f_ignore)
-			    continue;
-			exit(1);
-		    } 
-		    printf("%s/%s -> %s: Renamed NFD & Kept NFC\n",
-			   ap->dir, ap->nfd.name, new);
-		} else {
-		    printf("%s/%s -> %s: Renamed NFD & Kept NFC (NOT)\n",
-			   ap->dir, ap->nfd.name, new);
-		}
-		free(new);
-	    } else {
-		int rc;
-		
-		if (f_update) {
-		    if (S_ISDIR(ap->nfd.sb.st_mode)) 
-			rc = rmdir(ap->nfd.name);
-		    else
-			rc = unlink(ap->nfd.name);
-		    if (rc < 0) {
-			fprintf(stderr, "%s: Error: %s/%s: Remove NFD: %s\n",
-				argv0, ap->dir, ap->nfd.name, strerror(errno));
-			n_errors++;
-			if (f_ignore)
-			    continue;
-			exit(1);
-		    }
-		    printf("%s/%s: Removed NFD & Kept NFC\n",
-			   ap->dir, ap->nfd.name);
-		} else {
-		    printf("%s/%s: Removed NFD & Kept NFC (NOT)\n",
-			   ap->dir, ap->nfd.name);
-		}
-	    }
-	    break;
-	    
-	case ACT_REMOVE_NFC:
-	    /* Collision, remove NFC and rename NFD to NFC */
-	    
-	    if (!f_remove) {
-		/* Rename NFC to a unique name to avoid collisions */
-		char *new = mkunique(ap->nfc.name, &ap->nfc.sb);
-
-		if (f_update) {
-		    if (rename(ap->nfc.name, new) < 0) {
-			fprintf(stderr, "%s: Error: %s/%s -> %s: Rename NFC: %s\n",
-				argv0, ap->dir, ap->nfc.name, new, strerror(errno));
-			n_errors++;
-			if (f_ignore)
-			    continue;
-			exit(1);
-		    } 
-		    printf("%s/%s -> %s: Renamed NFC\n",
-			   ap->dir, ap->nfc.name, new);
-		} else {
-		    printf("%s/%s -> %s: Renamed NFC (NOT)\n",
-			   ap->dir, ap->nfc.name, new);
-		}
-		free(new);
-	    }
-	    
-	    if (f_update) {
-		if (rename(ap->nfd.name, ap->nfc.name) < 0) {
-		    fprintf(stderr, "%s: Error: %s/%s -> %s: Rename NFD: %s\n",
-			    argv0, ap->dir, ap->nfd.name, ap->nfc.name, strerror(errno));
-		    exit(1);
-		} 
-		printf("%s/%s -> %s: %sRenamed NFD\n",
-		       ap->dir, ap->nfd.name, ap->nfc.name,
-		       f_remove ? "Removed NFC & " : "");
-	    } else {
-		printf("%s/%s -> %s: %sRenamed NFD (NOT)\n",
-		       ap->dir, ap->nfd.name, ap->nfc.name,
-		       f_remove ? "Removed NFC & " : "");
-	    }
-	    break;
+
+/* List an object from an index (-q) like the scan would have */
+static void
+q_object(const char *path,
+	 int cls,
+	 int coll,
+	 const struct stat *sp,
+	 void *arg) {
+    const char *what;
+
+    (void) arg;
+    if (f_verbose < 2 && cls != OC_NFD && cls != OC_UTF8 && cls != OC_INVALID)
+	return;
+
+    switch (cls) {
+    case OC_ASCII:
+	what = "ASCII";
+	break;
+    case OC_NFC:
+	what = "NFC";
+	break;
+    case OC_UTF8:
+	what = "UTF8";
+	break;
+    case OC_INVALID:
+	what = "Unknown Encoding - Skipping";
+	break;
+    default:
+	what = (coll == OCOLL_NEWER ? "NFD (with newer NFC collision)" :
+		coll == OCOLL_OLDER ? "NFD (with non-newer NFC collision)" : "NFD");
+    }
+
+    if (cls == OC_NFD || cls == OC_UTF8) {
+	const char *name = strrchr(path, '/');
+	char nfc_output[NFBUFSIZE];
+	int32_t nfc_len;
+
+	if (utf8_to_nfc(name ? name+1 : path, nfc_output, sizeof(nfc_output), &nfc_len) >= 0) {
+	    p_object(path, f_verbose ? what : NULL, cls, coll, nfc_output, sp);
+	    return;
 	}
     }
+    p_object(path, (f_verbose || cls == OC_INVALID) ? what : NULL, cls, coll, NULL, sp);
+}
+
+/*
+ * Answer from an index (-q) instead of scanning - list the objects
+ * below path, or with just -s, only count them.
+ */
+static int
+query_index(IXFILE *ip,
+	    const char *path) {
+    uint64_t counts[IX_NCOUNTS];
+
+    if (index_query(ip, path, counts,
+		    (f_summary && !f_verbose) ? NULL : q_object, NULL) < 0) {
+	fprintf(stderr, "%s: Error: %s: %s\n", argv0, path,
+		errno == ENOENT ? "Not in the index" : strerror(errno));
+	n_errors++;
+	return -1;
+    }
+
+    n_ascii += counts[IX_ASCII];
+    n_nfc += counts[IX_NFC];
+    n_nfd += counts[IX_NFD];
+    n_other += counts[IX_OTHER];
+    n_unknown += counts[IX_UNKNOWN];
+    n_coll += counts[IX_COLL];
+    n_objects += counts[IX_OBJECTS];
+    return 0;
 }
 
 int
 main(int argc,
      char *argv[]) {
     int i, j;
+    char *cp;
 
     
     argv0 = argv[0];
-    setup();
+    if (classify_setup() < 0) {
+	fprintf(stderr, "%s: Error: ICU normalization setup: %s\n", argv[0], strerror(errno));
+	exit(1);
+    }
 
-    for (i = 1; i < argc && argv[i][0] == '-'; ++i)
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
         for (j = 1; argv[i][j]; j++)
             switch (argv[i][j]) {
 	    case 'V':
@@ -843,6 +1730,147 @@ main(int argc,
             case 'x':
                 f_mount++;
                 break;
+	    case 'S':
+		f_stream++;
+		break;
+	    case 'D':
+		f_nosync++;
+		break;
+	    case 'I':
+		f_inode++;
+		break;
+	    case 'm':
+		f_metrics++;
+		metrics_enabled = 1;
+		break;
+	    case 'M':
+		/* -M<file> or -M <file> */
+		f_promfile = argv[i][j+1] ? argv[i]+j+1 : (i+1 < argc ? argv[++i] : NULL);
+		if (!f_promfile) {
+		    fprintf(stderr, "%s: Error: -M: Missing metrics file\n", argv[0]);
+		    exit(1);
+		}
+		metrics_enabled = 1;
+		goto NextArg;
+	    case 'R':
+		f_resume++;
+		break;
+	    case 'T':
+		/* -T<spec> or -T <spec> */
+		cp = argv[i][j+1] ? argv[i]+j+1 : (i+1 < argc ? argv[++i] : NULL);
+		if (!cp || throttle_setup(cp) < 0) {
+		    fprintf(stderr, "%s: Error: -T: Invalid throttle (objects=<n>,ops=<n>,p99=<ms>,idle)\n", argv[0]);
+		    exit(1);
+		}
+		goto NextArg;
+	    case 'P':
+		/* -P<k>/<n>[:<depth>] or -P <k>/<n>[:<depth>] */
+		cp = argv[i][j+1] ? argv[i]+j+1 : (i+1 < argc ? argv[++i] : NULL);
+		if (!cp || shard_setup(cp) < 0) {
+		    fprintf(stderr, "%s: Error: -P: Invalid shard (<k>/<n>[:<depth>])\n", argv[0]);
+		    exit(1);
+		}
+		goto NextArg;
+	    case 'p':
+		/* -p<file> or -p <file> */
+		f_partial = argv[i][j+1] ? argv[i]+j+1 : (i+1 < argc ? argv[++i] : NULL);
+		if (!f_partial) {
+		    fprintf(stderr, "%s: Error: -p: Missing partial result file\n", argv[0]);
+		    exit(1);
+		}
+		goto NextArg;
+	    case 'J':
+		f_merge++;
+		break;
+	    case 'w':
+		f_watch++;
+		break;
+	    case 'W':
+		/* -W<file> or -W <file> */
+		f_plan = argv[i][j+1] ? argv[i]+j+1 : (i+1 < argc ? argv[++i] : NULL);
+		if (!f_plan) {
+		    fprintf(stderr, "%s: Error: -W: Missing plan file\n", argv[0]);
+		    exit(1);
+		}
+		goto NextArg;
+	    case 'X':
+		/* -X<file> or -X <file> */
+		f_apply = argv[i][j+1] ? argv[i]+j+1 : (i+1 < argc ? argv[++i] : NULL);
+		if (!f_apply) {
+		    fprintf(stderr, "%s: Error: -X: Missing plan file\n", argv[0]);
+		    exit(1);
+		}
+		goto NextArg;
+	    case 'y':
+		/* -y<file> or -y <file> */
+		f_index = argv[i][j+1] ? argv[i]+j+1 : (i+1 < argc ? argv[++i] : NULL);
+		if (!f_index) {
+		    fprintf(stderr, "%s: Error: -y: Missing index file\n", argv[0]);
+		    exit(1);
+		}
+		index_enabled = 1;
+		goto NextArg;
+	    case 'q':
+		/* -q<file> or -q <file> */
+		f_query = argv[i][j+1] ? argv[i]+j+1 : (i+1 < argc ? argv[++i] : NULL);
+		if (!f_query) {
+		    fprintf(stderr, "%s: Error: -q: Missing index file\n", argv[0]);
+		    exit(1);
+		}
+		goto NextArg;
+	    case 'K':
+		/* -K<file> or -K <file> */
+		f_ckpt = argv[i][j+1] ? argv[i]+j+1 : (i+1 < argc ? argv[++i] : NULL);
+		if (!f_ckpt) {
+		    fprintf(stderr, "%s: Error: -K: Missing checkpoint file\n", argv[0]);
+		    exit(1);
+		}
+		goto NextArg;
+	    case 'k':
+		/* -k<n> or -k <n> */
+		cp = argv[i][j+1] ? argv[i]+j+1 : (i+1 < argc ? argv[++i] : NULL);
+		if (!cp || sscanf(cp, "%d", &f_ckpt_interval) != 1 || f_ckpt_interval < 1) {
+		    fprintf(stderr, "%s: Error: -k: Invalid checkpoint interval\n", argv[0]);
+		    exit(1);
+		}
+		goto NextArg;
+	    case 'l':
+		f_leaf++;
+		f_file++;
+		break;
+	    case 'j':
+		/* -j<n> or -j <n> */
+		cp = argv[i][j+1] ? argv[i]+j+1 : (i+1 < argc ? argv[++i] : NULL);
+		if (!cp || sscanf(cp, "%d", &n_workers) != 1 || n_workers < 1) {
+		    fprintf(stderr, "%s: Error: -j: Invalid number of threads\n", argv[0]);
+		    exit(1);
+		}
+		goto NextArg;
+	    case 'Q':
+		/* -Q<n> or -Q <n> */
+		cp = argv[i][j+1] ? argv[i]+j+1 : (i+1 < argc ? argv[++i] : NULL);
+		if (!cp || sscanf(cp, "%d", &uring_depth) != 1 || uring_depth < 0) {
+		    fprintf(stderr, "%s: Error: -Q: Invalid queue depth\n", argv[0]);
+		    exit(1);
+		}
+		goto NextArg;
+	    case 'o':
+		/* -o<format> or -o <format> */
+		cp = argv[i][j+1] ? argv[i]+j+1 : (i+1 < argc ? argv[++i] : NULL);
+		if (!cp || out_open(cp) < 0) {
+		    fprintf(stderr, "%s: Error: -o: %s: Invalid output format\n",
+			    argv[0], cp ? cp : "");
+		    exit(1);
+		}
+		goto NextArg;
+	    case 'C':
+		/* -C<file> or -C <file> */
+		f_cache = argv[i][j+1] ? argv[i]+j+1 : (i+1 < argc ? argv[++i] : NULL);
+		if (!f_cache) {
+		    fprintf(stderr, "%s: Error: -C: Missing cache file\n", argv[0]);
+		    exit(1);
+		}
+		goto NextArg;
             case 'h':
                 printf("Usage:\n  %s [<options>*] <path-1> [.. <path-N>]\n", argv[0]);
                 puts("\nOptions:");
@@ -857,15 +1885,40 @@ main(int argc,
 		puts("  -t          Print timestamps");
 		puts("  -f          Read pathnames from the files specified");
 		puts("  -0          Use NUL instead of Newline as pathname separator in files");
+		puts("  -l          Like -f but only check the listed objects (no tree walk)");
 		puts("  -c          Check mode (exit code 1 if NFD found)");
 		puts("  -r          Remove (instead of rename) older colliding objects");
                 puts("  -a          Autofix mode (use -aa to remove collisions)");
                 puts("  -x          Do not cross filesystem boundaries");
+		puts("  -S          Streaming autofix (fix each directory when it has been scanned)");
+                puts("  -j <n>      Number of scanner threads (default: 1)");
+                puts("  -I          Process directory entries in inode order");
+                puts("  -D          Allow cached metadata while scanning (network filesystems)");
+                puts("  -C <file>   Directory cache file (skip unchanged directories)");
+                puts("  -Q <n>      Batch metadata calls via io_uring, <n> in flight (Linux)");
+                puts("  -o <fmt>    Output format: text (default), json (NDJSON) or binary");
+                puts("  -m          Print per-phase metrics at exit (and on SIGUSR1)");
+                puts("  -M <file>   Write metrics to a Prometheus textfile (every 10s & at exit)");
+                puts("  -K <file>   Save the scan state to <file> periodically (removed when done)");
+                puts("  -k <n>      Seconds between checkpoints (default: 60)");
+                puts("  -R          Resume from the -K file, if there is one (same arguments)");
+                puts("  -T <spec>   Throttle: objects=<n>,ops=<n> per second, p99=<ms> stat target, idle");
+                puts("  -P <k>/<n>  Scan shard k of n (split at depth 1, or <k>/<n>:<depth>)");
+                puts("  -p <file>   Write output & counters to a partial result file (for -J)");
+                puts("  -J          Merge partial result files (arguments) into one output & summary");
+                puts("  -W <file>   Save the actions of a dry run (-an) as a plan for -X");
+                puts("  -X <file>   Run the actions of a plan (skipping changed objects), no scan");
+                puts("  -y <file>   Save a queryable index of the scan results");
+                puts("  -q <file>   Query an index (-y) for the paths (default: all), no scan");
+                puts("  -w          Watch the trees and check new names as they appear (until interrupted, implies -i)");
                 exit(0);
             default:
                 fprintf(stderr, "%s: Error: -%c: Invalid switch\n", argv[0], argv[i][j]);
                 exit(1);
             }
+ NextArg:
+	;
+    }
 
     if (f_version) {
 	fprintf(stderr,
@@ -873,23 +1926,169 @@ main(int argc,
 		PACKAGE_VERSION, PACKAGE_URL);
     }
 
-    if (f_file && i == argc) {
-	char *fname = NULL;
+    if (f_merge) {
+	uint64_t cv[CK_NCOUNTERS];
+
+	memset(cv, 0, sizeof(cv));
+	if (shard_merge(argv+i, argc-i, cv, CK_NCOUNTERS) < 0)
+	    exit(1);
+	set_counters(cv);
+	p_summary();
+	return f_check ? ((n_coll > 0 ? 2 : n_nfd > 0)) : (n_errors > 0);
+    }
+
+    if (f_query) {
+	IXFILE *ip = index_open(f_query);
+
+	if (!ip) {
+	    fprintf(stderr, "%s: Error: %s: Opening index: %s\n",
+		    argv[0], f_query, strerror(errno));
+	    exit(1);
+	}
+	if (i == argc)
+	    query_index(ip, "");
+	for (; i < argc; i++)
+	    query_index(ip, argv[i]);
+	out_flush();
+	index_close(ip);
+	if (f_summary)
+	    p_summary();
+	return f_check ? ((n_coll > 0 ? 2 : n_nfd > 0)) : (n_errors > 0);
+    }
+
+    if (f_watch && (i == argc || f_file || f_ckpt || f_cache || f_partial ||
+		    f_plan || f_apply || f_index || shard_n)) {
+	fprintf(stderr, "%s: Error: -w: %s\n", argv[0],
+		i == argc ? "No directories to watch" : "Not supported with -f, -l, -C, -K, -P, -p, -W, -X or -y");
+	exit(1);
+    }
+
+    /* Objects that can't be fixed are reported, but must not end the watch */
+    if (f_watch)
+	f_ignore = 1;
+
+    if (f_index && (f_cache || f_ckpt || f_apply)) {
+	/* Those skip objects the index must have */
+	fprintf(stderr, "%s: Error: -y: Not supported with %s\n", argv[0],
+		f_cache ? "-C" : f_ckpt ? "-K" : "-X");
+	exit(1);
+    }
+
+    if (throttle_start() < 0) {
+	fprintf(stderr, "%s: Error: Setting idle I/O priority: %s\n", argv[0], strerror(errno));
+	exit(1);
+    }
+
+    if (metrics_start(f_promfile) < 0) {
+	fprintf(stderr, "%s: Error: Starting metrics: %s\n", argv[0], strerror(errno));
+	exit(1);
+    }
+
+    if (f_resume && !f_ckpt) {
+	fprintf(stderr, "%s: Error: -R: No checkpoint file (-K) specified\n", argv[0]);
+	exit(1);
+    }
+    if (f_ckpt && f_leaf) {
+	fprintf(stderr, "%s: Error: -K: Not supported with -l\n", argv[0]);
+	exit(1);
+    }
+    if (f_resume && load_checkpoint(f_ckpt) < 0 && errno != ENOENT) {
+	fprintf(stderr, "%s: Error: %s: Loading checkpoint: %s\n",
+		argv[0], f_ckpt, strerror(errno));
+	exit(1);
+    }
+    ck_next = now_sec() + f_ckpt_interval;
+
+    if (f_plan) {
+	if (!f_autofix || f_update) {
+	    fprintf(stderr, "%s: Error: -W: Only with a dry run (-an)\n", argv[0]);
+	    exit(1);
+	}
+	if (f_ckpt || f_apply) {
+	    fprintf(stderr, "%s: Error: -W: Not supported with %s\n", argv[0], f_ckpt ? "-K" : "-X");
+	    exit(1);
+	}
+	if (plan_create(f_plan) < 0) {
+	    fprintf(stderr, "%s: Error: %s: Creating plan: %s\n",
+		    argv[0], f_plan, strerror(errno));
+	    exit(1);
+	}
+    }
+    if (f_apply) {
+	if (i < argc || f_file || f_ckpt) {
+	    fprintf(stderr, "%s: Error: -X: Does not scan - no %s\n",
+		    argv[0], f_ckpt ? "-K" : "paths");
+	    exit(1);
+	}
+	if (load_plan(f_apply) < 0) {
+	    fprintf(stderr, "%s: Error: %s: Loading plan: %s\n",
+		    argv[0], f_apply, strerror(errno));
+	    exit(1);
+	}
+    }
+
+    if (f_partial) {
+	/* An unsharded scan is shard 1/1 */
+	if (!shard_n)
+	    shard_n = 1;
+	if (shard_open(f_partial, out_format, f_resume) < 0) {
+	    fprintf(stderr, "%s: Error: %s: Creating partial result file: %s\n",
+		    argv[0], f_partial, strerror(errno));
+	    exit(1);
+	}
+    }
+
+    /* Output written after the checkpoint will be written again */
+    if (rs_pending && rs_root.output >= 0) {
+	struct stat sb;
+
+	if (fstat(STDOUT_FILENO, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size >= rs_root.output &&
+	    (ftruncate(STDOUT_FILENO, rs_root.output) < 0 ||
+	     lseek(STDOUT_FILENO, rs_root.output, SEEK_SET) < 0)) {
+	    fprintf(stderr, "%s: Error: <stdout>: Truncating to the checkpoint: %s\n",
+		    argv[0], strerror(errno));
+	    exit(1);
+	}
+    }
+
+    if (f_cache) {
+	dircache_enabled = 1;
+	if (dircache_load(f_cache) < 0) {
+	    fprintf(stderr, "%s: Error: %s: Loading directory cache: %s\n",
+		    argv[0], f_cache, strerror(errno));
+	    exit(1);
+	}
+    }
+
+    if (f_apply) {
+	run_actions();
+	free_actions();
+    } else if (f_watch) {
+	if (watch_run(argv+i, argc-i, watch_batch) < 0)
+	    n_errors++;
+    } else if (f_file && i == argc) {
+	PATHLIST *pp;
+	const char *fname;
+	size_t flen;
 	int rc;
 
 	if (isatty(fileno(stdin)) && isatty(fileno(stderr)))
 	    fprintf(stderr, "Enter pathnames:\n");
+
+	pp = pathlist_open(fileno(stdin), f_zero ? '\0' : '\n');
+	if (!pp) {
+	    fprintf(stderr, "%s: Error: <stdin>: %s\n", argv[0], strerror(errno));
+	    exit(1);
+	}
 	
-	while ((rc = get_fname(stdin, &fname)) > 0) {
+	while (!f_leaf && (rc = pathlist_next(pp, &fname, &flen)) > 0) {
 	    if (f_verbose && isatty(fileno(stderr)))
 		fprintf(stderr, "[%u : %s]                  \n", ++n_scanned, fname);
-	    nftw(fname, walker, 9999, FTW_PHYS|FTW_CHDIR|(f_mount ? FTW_MOUNT : 0));
-
-	    run_actions();
-	    free_actions();
-
-	    free(fname);
+	    scan_root(fname);
 	}
+	if (f_leaf)
+	    rc = scan_list(pp);
+	pathlist_close(pp);
 	if (rc < 0) {
 	    fprintf(stderr, "%s: Error: <stdin>: %s\n", argv[0], strerror(errno));
 	    exit(1);
@@ -897,47 +2096,84 @@ main(int argc,
     } else {
 	for (; i < argc; i++) {
 	    if (f_file) {
-		FILE *fp = NULL;
-		char *fname = NULL;
-		int rc;
+		PATHLIST *pp;
+		const char *fname;
+		size_t flen;
+		int fd, rc;
 		
-		fp = fopen(argv[i], "r");
-		if (!fp) {
+		fd = open(argv[i], O_RDONLY|O_CLOEXEC);
+		if (fd < 0 || (pp = pathlist_open(fd, f_zero ? '\0' : '\n')) == NULL) {
 		    fprintf(stderr, "%s: Error: %s: Opening: %s\n",
 			    argv[0], argv[i], strerror(errno));
 		    exit(1);
 		}
 		
-		while ((rc = get_fname(fp, &fname)) > 0) {
+		while (!f_leaf && (rc = pathlist_next(pp, &fname, &flen)) > 0) {
 		    if (f_verbose && isatty(fileno(stderr)))
 			fprintf(stderr, "[%u : %s]                  \n", ++n_scanned, fname);
-		    nftw(fname, walker, 9999, FTW_PHYS|FTW_CHDIR|(f_mount ? FTW_MOUNT : 0));
-		    
-		    run_actions();
-		    free_actions();
-	 	    free(fname);
+		    scan_root(fname);
 		}
+		if (f_leaf)
+		    rc = scan_list(pp);
 		if (rc < 0) {
 		    fprintf(stderr, "%s: Error: %s: %s\n", argv[0], argv[i], strerror(errno));
 		    exit(1);
 		}
 		
-		fclose(fp);
+		pathlist_close(pp);
+		close(fd);
 	    } else {
 		if (f_verbose && isatty(fileno(stderr)))
 		    fprintf(stderr, "[%u : %s]                  \n", ++n_scanned, argv[i]);
-		nftw(argv[i], walker, 9999, FTW_PHYS|FTW_CHDIR|(f_mount ? FTW_MOUNT : 0));
-		run_actions();
-		free_actions();
+		scan_root(argv[i]);
 	    }
 	}
     }
 
+    if (f_cache && dircache_save(f_cache) < 0) {
+	fprintf(stderr, "%s: Error: %s: Saving directory cache: %s\n",
+		argv[0], f_cache, strerror(errno));
+	n_errors++;
+    }
+
+    out_flush();
+
+    if (f_index && index_save(f_index) < 0) {
+	fprintf(stderr, "%s: Error: %s: Writing index: %s\n",
+		argv[0], f_index, strerror(errno));
+	n_errors++;
+    }
+
+    if (plan_ckp && ckpt_commit(plan_ckp) < 0) {
+	fprintf(stderr, "%s: Error: %s: Writing plan: %s\n",
+		argv[0], f_plan, strerror(errno));
+	n_errors++;
+    }
+
+    if (f_partial) {
+	uint64_t cv[CK_NCOUNTERS];
+
+	get_counters(cv, NULL);
+	if (shard_close(cv, CK_NCOUNTERS) < 0) {
+	    fprintf(stderr, "%s: Error: %s: Writing partial result file: %s\n",
+		    argv[0], f_partial, strerror(errno));
+	    n_errors++;
+	}
+    }
+
+    /* Done - nothing to resume */
+    if (f_ckpt && remove(f_ckpt) < 0 && errno != ENOENT) {
+	fprintf(stderr, "%s: Error: %s: Removing checkpoint: %s\n",
+		argv[0], f_ckpt, strerror(errno));
+	n_errors++;
+    }
+
+    metrics_stop();
+    if (f_metrics)
+	metrics_dump();
+
     if (f_summary)
-        fprintf(stderr,
-	      "[%lu ascii, %lu nfc, %lu nfd, %lu other, %lu unknown & %lu collisions; %lu objects, %lu unreadable, %lu renamed & %lu removed]\n",
-	       n_ascii, n_nfc, n_nfd, n_other, n_unknown, n_coll,
-	       n_objects, n_unread, n_renamed, n_removed);
+	p_summary();
 
     return f_check ? ((n_coll > 0 ? 2 : n_nfd > 0)) : (n_errors > 0);
 }
@@ -0,0 +1,119 @@
+/*
+ * pnfdscan.h
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PNFDSCAN_H
+#define PNFDSCAN_H 1
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+extern char *argv0;
+
+extern int f_verbose;
+extern int f_debug;
+extern int f_mount;
+extern int f_time;
+
+extern unsigned long n_objects;
+extern unsigned long n_errors;
+
+
+/*
+ * Classification counters. Each walker thread keeps its own set
+ * and they are added to the global totals when a walk is done.
+ */
+typedef struct counters {
+    unsigned long ascii;
+    unsigned long nfd;
+    unsigned long nfc;
+    unsigned long other;
+    unsigned long unknown;
+    unsigned long coll;
+    unsigned long unread;
+} COUNTERS;
+
+
+/* Names in a directory, built when it is read */
+typedef struct nameset NAMESET;
+
+
+/*
+ * An object found by the tree walker. The stat() information is only
+ * fetched on demand (see obj_stat()) since most names can be classified
+ * from the name alone.
+ */
+typedef struct object {
+    int dirfd;			/* Open parent directory */
+    const char *path;		/* Full path */
+    const char *name;		/* Last component of path */
+    NAMESET *names;		/* Names in the parent directory, or NULL */
+    int type;			/* DT_xxx from readdir() or DT_UNKNOWN */
+    int sb_valid;		/* 0 = not fetched, 1 = valid, -1 = stat failed */
+    struct stat sb;
+} OBJECT;
+
+
+extern const struct stat *
+obj_stat(OBJECT *op);
+
+extern int
+obj_sibling_exists(OBJECT *op,
+		   const char *name);
+
+extern void
+obj_sibling_add(OBJECT *op,
+		const char *name);
+
+extern int
+walker(OBJECT *op,
+       COUNTERS *cp);
+
+/* Called when a directory and everything below it has been scanned */
+extern void
+dir_done(const char *path);
+
+extern void
+merge_counters(const COUNTERS *cp);
+
+/*
+ * Save the scan state (-K). Called by the walker, with all its threads
+ * paused, whenever checkpoint_due() (cheap) says it is time.
+ */
+extern int
+checkpoint_due(void);
+
+extern void
+checkpoint(int walked);
+
+#endif
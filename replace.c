@@ -0,0 +1,123 @@
+/*
+ * replace.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "replace.h"
+
+
+char *
+replace_tmpname(const char *path) {
+    size_t plen = strlen(path);
+    char *tmp;
+
+    tmp = malloc(plen+5);
+    if (!tmp)
+	abort();
+    memcpy(tmp, path, plen);
+    strcpy(tmp+plen, ".tmp");
+    return tmp;
+}
+
+
+/* Make the rename itself durable - not all filesystems can, so errors are ignored */
+static void
+sync_dir(const char *path) {
+    const char *cp = strrchr(path, '/');
+    char *dir;
+    int fd;
+
+    if (!cp)
+	dir = strdup(".");
+    else
+	dir = strndup(path, cp == path ? 1 : (size_t) (cp-path));
+    if (!dir)
+	abort();
+
+    fd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd >= 0) {
+	(void) fsync(fd);
+	close(fd);
+    }
+    free(dir);
+}
+
+static int
+replace_finish(int rc,
+	       const char *tmp,
+	       const char *path) {
+    int err;
+
+    if (rc == 0 && rename(tmp, path) == 0) {
+	sync_dir(path);
+	return 0;
+    }
+
+    err = errno;
+    remove(tmp);
+    errno = err;
+    return -1;
+}
+
+int
+replace_fclose(FILE *fp,
+	       const char *tmp,
+	       const char *path) {
+    int rc = 0;
+
+    if (fflush(fp) != 0 || fsync(fileno(fp)) < 0)
+	rc = -1;
+    if (fclose(fp) != 0)
+	rc = -1;
+    return replace_finish(rc, tmp, path);
+}
+
+int
+replace_close(int fd,
+	      const char *tmp,
+	      const char *path) {
+    int rc = 0;
+
+    if (fsync(fd) < 0)
+	rc = -1;
+    if (close(fd) < 0)
+	rc = -1;
+    return replace_finish(rc, tmp, path);
+}
@@ -0,0 +1,377 @@
+/*
+ * shard.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "pnfdscan.h"
+#include "output.h"
+#include "shard.h"
+#include "replace.h"
+
+
+/*
+ * Partial result file: a header followed by the output of the shard,
+ * exactly as it would have been written to stdout. The header is
+ * rewritten with the counters when the shard is done.
+ */
+#define SH_MAGIC	"PNFDPRT\n"
+#define SH_VERSION	1
+#define SH_ORDER	0x01020304	/* Byte order check */
+#define SH_NCOUNTERS	16
+
+typedef struct shhdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t order;
+    uint32_t k;
+    uint32_t n;
+    uint32_t depth;
+    uint32_t format;	/* OUT_xxx */
+    uint32_t complete;
+    uint32_t reserved;
+    uint64_t counters[SH_NCOUNTERS];
+} SHHDR;
+
+
+unsigned int shard_k = 0;
+unsigned int shard_n = 0;
+unsigned int shard_depth = 1;
+
+static int sh_fd = -1;
+static int sh_stdout = -1;
+static char *sh_path = NULL;
+static char *sh_tmp = NULL;
+static SHHDR sh_hdr;
+
+
+/* "k/n" or "k/n:depth", k = 1..n */
+int
+shard_setup(const char *spec) {
+    unsigned int k, n, depth = 1;
+    char c;
+
+    if (sscanf(spec, "%u/%u%c", &k, &n, &c) == 2 ||
+	(sscanf(spec, "%u/%u:%u%c", &k, &n, &depth, &c) == 3)) {
+	if (n < 1 || k < 1 || k > n || depth < 1)
+	    return -1;
+	shard_k = k-1;
+	shard_n = n;
+	shard_depth = depth;
+	return 0;
+    }
+    return -1;
+}
+
+/* FNV-1a - has to give the same answer everywhere */
+int
+shard_owns(const char *path) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (*path)
+	h = (h ^ (unsigned char) *path++) * 0x100000001b3ULL;
+    return h % shard_n == shard_k;
+}
+
+
+static int
+hdr_check(const SHHDR *hp) {
+    return (memcmp(hp->magic, SH_MAGIC, sizeof(hp->magic)) == 0 &&
+	    hp->version == SH_VERSION && hp->order == SH_ORDER);
+}
+
+int
+shard_open(const char *path,
+	   int format,
+	   int resume) {
+    SHHDR h;
+
+
+    sh_path = strdup(path);
+    if (!sh_path)
+	abort();
+    sh_tmp = replace_tmpname(path);
+
+    memset(&sh_hdr, 0, sizeof(sh_hdr));
+    memcpy(sh_hdr.magic, SH_MAGIC, sizeof(sh_hdr.magic));
+    sh_hdr.version = SH_VERSION;
+    sh_hdr.order = SH_ORDER;
+    sh_hdr.k = shard_k;
+    sh_hdr.n = shard_n;
+    sh_hdr.depth = shard_depth;
+    sh_hdr.format = format;
+
+    /* Continue the output of the interrupted run */
+    if (resume && (sh_fd = open(sh_tmp, O_RDWR|O_CLOEXEC)) >= 0) {
+	if (read(sh_fd, &h, sizeof(h)) != sizeof(h) || !hdr_check(&h) ||
+	    h.k != sh_hdr.k || h.n != sh_hdr.n || h.depth != sh_hdr.depth ||
+	    h.format != sh_hdr.format || lseek(sh_fd, 0, SEEK_END) < 0) {
+	    close(sh_fd);
+	    sh_fd = -1;
+	}
+    }
+
+    if (sh_fd < 0) {
+	sh_fd = open(sh_tmp, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+	if (sh_fd < 0)
+	    return -1;
+	if (write(sh_fd, &sh_hdr, sizeof(sh_hdr)) != sizeof(sh_hdr))
+	    goto Fail;
+    }
+
+    fflush(stdout);
+    sh_stdout = dup(STDOUT_FILENO);
+    if (sh_stdout < 0 || dup2(sh_fd, STDOUT_FILENO) < 0)
+	goto Fail;
+    return 0;
+
+ Fail:
+    close(sh_fd);
+    sh_fd = -1;
+    remove(sh_tmp);
+    return -1;
+}
+
+int
+shard_close(const uint64_t *cv,
+	    unsigned int ncv) {
+    int rc = 0;
+
+    if (sh_fd < 0)
+	return 0;
+
+    if (fflush(stdout) != 0)
+	rc = -1;
+    if (dup2(sh_stdout, STDOUT_FILENO) < 0)
+	rc = -1;
+    close(sh_stdout);
+
+    memcpy(sh_hdr.counters, cv, (ncv < SH_NCOUNTERS ? ncv : SH_NCOUNTERS)*sizeof(*cv));
+    sh_hdr.complete = 1;
+    if (pwrite(sh_fd, &sh_hdr, sizeof(sh_hdr), 0) != sizeof(sh_hdr))
+	rc = -1;
+
+    /* Unless complete, the output is kept for a resumed run */
+    if (rc == 0)
+	rc = replace_close(sh_fd, sh_tmp, sh_path);
+    else
+	close(sh_fd);
+    sh_fd = -1;
+    free(sh_path);
+    free(sh_tmp);
+    return rc;
+}
+
+
+static int
+write_all(const char *buf,
+	  size_t len) {
+    while (len > 0) {
+	ssize_t n = write(STDOUT_FILENO, buf, len);
+
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	buf += n;
+	len -= n;
+    }
+    return 0;
+}
+
+/* Binary output - the records, without the OUT_MAGIC (one per resumed run) */
+static int
+copy_binary(const char *buf,
+	    size_t len) {
+    size_t pos = 0;
+    const size_t mlen = sizeof(OUT_MAGIC)-1;
+
+    while (pos < len) {
+	uint32_t rlen;
+
+	if (len-pos >= mlen && memcmp(buf+pos, OUT_MAGIC, mlen) == 0) {
+	    pos += mlen;
+	    continue;
+	}
+	if (len-pos < sizeof(OUTBIN))
+	    break;
+	memcpy(&rlen, buf+pos, sizeof(rlen));
+	if (rlen < sizeof(OUTBIN) || rlen > len-pos)
+	    break;
+	if (write_all(buf+pos, rlen) < 0)
+	    return -1;
+	pos += rlen;
+    }
+
+    if (pos < len) {
+	errno = EINVAL;
+	return -1;
+    }
+    return 0;
+}
+
+int
+shard_merge(char *const *paths,
+	    int n,
+	    uint64_t *cv,
+	    unsigned int ncv) {
+    SHHDR *hv;
+    unsigned char *seen = NULL;
+    int i, fd = -1;
+    unsigned int k, j;
+    struct stat sb;
+    char *buf = NULL;
+
+
+    if (n < 1) {
+	fprintf(stderr, "%s: Error: -J: No partial result files\n", argv0);
+	return -1;
+    }
+
+    hv = calloc(n, sizeof(*hv));
+    if (!hv)
+	abort();
+
+    /* Check that they are a complete and consistent set before writing anything */
+    for (i = 0; i < n; i++) {
+	fd = open(paths[i], O_RDONLY|O_CLOEXEC);
+	if (fd < 0 || read(fd, &hv[i], sizeof(hv[i])) != sizeof(hv[i]) || !hdr_check(&hv[i])) {
+	    fprintf(stderr, "%s: Error: %s: %s\n", argv0, paths[i],
+		    fd < 0 ? strerror(errno) : "Not a partial result file");
+	    goto Fail;
+	}
+	close(fd);
+	fd = -1;
+
+	if (hv[i].n == 0 || hv[i].k >= hv[i].n) {
+	    fprintf(stderr, "%s: Error: %s: Invalid shard %u/%u\n",
+		    argv0, paths[i], hv[i].k+1, hv[i].n);
+	    goto Fail;
+	}
+	if (!hv[i].complete) {
+	    fprintf(stderr, "%s: Error: %s: Shard %u/%u did not finish\n",
+		    argv0, paths[i], hv[i].k+1, hv[i].n);
+	    goto Fail;
+	}
+	if (hv[i].n != hv[0].n || hv[i].depth != hv[0].depth || hv[i].format != hv[0].format) {
+	    fprintf(stderr, "%s: Error: %s: Shard %u/%u:%u does not match %s (%u/%u:%u)\n",
+		    argv0, paths[i], hv[i].k+1, hv[i].n, hv[i].depth,
+		    paths[0], hv[0].k+1, hv[0].n, hv[0].depth);
+	    goto Fail;
+	}
+    }
+
+    seen = calloc(hv[0].n, 1);
+    if (!seen)
+	abort();
+    for (i = 0; i < n; i++) {
+	if (seen[hv[i].k]++) {
+	    fprintf(stderr, "%s: Error: %s: Shard %u/%u given twice\n",
+		    argv0, paths[i], hv[i].k+1, hv[i].n);
+	    goto Fail;
+	}
+    }
+    for (k = 0; k < hv[0].n; k++)
+	if (!seen[k]) {
+	    fprintf(stderr, "%s: Error: Shard %u/%u missing\n", argv0, k+1, hv[0].n);
+	    goto Fail;
+	}
+
+    if (hv[0].format == OUT_BINARY &&
+	write_all(OUT_MAGIC, sizeof(OUT_MAGIC)-1) < 0)
+	goto WriteFail;
+
+    for (i = 0; i < n; i++) {
+	size_t len;
+	int rc;
+
+	fd = open(paths[i], O_RDONLY|O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &sb) < 0) {
+	    fprintf(stderr, "%s: Error: %s: %s\n", argv0, paths[i], strerror(errno));
+	    goto Fail;
+	}
+
+	len = sb.st_size - sizeof(SHHDR);
+	if (len > 0) {
+	    buf = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	    if (buf == MAP_FAILED) {
+		fprintf(stderr, "%s: Error: %s: mmap: %s\n", argv0, paths[i], strerror(errno));
+		buf = NULL;
+		goto Fail;
+	    }
+
+	    if (hv[i].format == OUT_BINARY)
+		rc = copy_binary(buf+sizeof(SHHDR), len);
+	    else
+		rc = write_all(buf+sizeof(SHHDR), len);
+	    munmap(buf, sb.st_size);
+	    buf = NULL;
+	    if (rc < 0) {
+		if (errno == EINVAL) {
+		    fprintf(stderr, "%s: Error: %s: Invalid binary output\n", argv0, paths[i]);
+		    goto Fail;
+		}
+		goto WriteFail;
+	    }
+	}
+	close(fd);
+	fd = -1;
+
+	for (j = 0; j < ncv && j < SH_NCOUNTERS; j++)
+	    cv[j] += hv[i].counters[j];
+    }
+
+    free(seen);
+    free(hv);
+    return 0;
+
+ WriteFail:
+    fprintf(stderr, "%s: Error: <stdout>: %s\n", argv0, strerror(errno));
+ Fail:
+    if (fd >= 0)
+	close(fd);
+    free(seen);
+    free(hv);
+    return -1;
+}
@@ -0,0 +1,87 @@
+/*
+ * shard.h
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SHARD_H
+#define SHARD_H 1
+
+#include <stdint.h>
+
+/*
+ * Sharded scans (-P k/n[:depth]).
+ *
+ * Every object at the shard depth below a root (default 1, the entries
+ * of the root directory) is assigned to one of n shards by a hash of
+ * its path relative to the root, and everything below it goes with it.
+ * Directories above the shard depth are read by all shards but each
+ * object is only reported and counted by one of them, so the results
+ * of shards 1..n add up to those of a plain scan - also when they are
+ * run on different hosts, as long as the tree is the same.
+ *
+ * With -p a shard writes its output (in the -o format) and counters
+ * to a partial result file, and -J merges such files into the output
+ * and summary of a single scan.
+ */
+
+extern unsigned int shard_k;		/* 0 .. shard_n-1 */
+extern unsigned int shard_n;		/* 0 = not sharded */
+extern unsigned int shard_depth;
+
+extern int
+shard_setup(const char *spec);
+
+/* Does this shard own the object at path (relative to the root)? */
+extern int
+shard_owns(const char *path);
+
+/*
+ * Send standard output to a partial result file (written to path.tmp
+ * and renamed by shard_close()). When resuming (-R) an unfinished one
+ * is appended to.
+ */
+extern int
+shard_open(const char *path,
+	   int format,
+	   int resume);
+
+extern int
+shard_close(const uint64_t *cv,
+	    unsigned int ncv);
+
+/* Copy the output of the partial result files to stdout and add up their counters */
+extern int
+shard_merge(char *const *paths,
+	    int n,
+	    uint64_t *cv,
+	    unsigned int ncv);
+
+#endif
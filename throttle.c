@@ -0,0 +1,324 @@
+/*
+ * throttle.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
+#include "pnfdscan.h"
+#include "metrics.h"
+#include "throttle.h"
+
+
+#define T_BURST		0.1		/* Seconds of tokens a bucket may save up */
+#define T_WINDOW_NS	250000000ULL	/* Shortest latency window */
+#define T_WINDOW_MAX_NS	2000000000ULL	/* Longest, if stat()s are few */
+#define T_MIN_SAMPLES	32
+#define T_SAMPLES	1024		/* Latest stat() latencies in a window */
+#define T_MIN_RATE	10.0		/* Never go below this many ops/s */
+
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_CLASS_IDLE	3
+#define IOPRIO_WHO_PROCESS	1
+
+
+typedef struct bucket {
+    pthread_mutex_t mtx;
+    double rate;	/* Tokens per second, 0 = unlimited */
+    double tokens;
+    uint64_t last;
+} BUCKET;
+
+int throttle_enabled = 0;
+
+static BUCKET t_objects = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 };
+static BUCKET t_ops = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 };
+
+static double t_ops_max = 0;	/* -T ops=, 0 = none */
+static double t_target = 0;	/* -T p99= in ns, 0 = fixed rates */
+static int t_idle = 0;
+
+/* Current latency window */
+static pthread_mutex_t t_mtx = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t t_win_start = 0;
+static uint64_t t_win_ops = 0;
+static unsigned int t_nsamples = 0;
+static uint64_t t_samples[T_SAMPLES];
+
+
+static uint64_t
+now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void
+sleep_ns(uint64_t ns) {
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+	;
+}
+
+/*
+ * Take n tokens, going into debt if there aren't enough, and sleep
+ * until the debt would have been paid. Threads that come along while
+ * the bucket is in debt will sleep for that too, so the rate holds
+ * however many threads there are.
+ */
+static void
+bucket_take(BUCKET *bp,
+	    double n) {
+    uint64_t now, wait = 0;
+    double burst;
+
+    pthread_mutex_lock(&bp->mtx);
+    if (bp->rate > 0) {
+	now = now_ns();
+	if (bp->last)
+	    bp->tokens += (now - bp->last) * bp->rate / 1e9;
+	bp->last = now;
+
+	burst = bp->rate * T_BURST;
+	if (burst < 1)
+	    burst = 1;
+	if (bp->tokens > burst)
+	    bp->tokens = burst;
+
+	bp->tokens -= n;
+	if (bp->tokens < 0)
+	    wait = (uint64_t) (-bp->tokens / bp->rate * 1e9);
+    }
+    pthread_mutex_unlock(&bp->mtx);
+
+    if (wait)
+	sleep_ns(wait);
+}
+
+static void
+bucket_set(BUCKET *bp,
+	   double rate) {
+    pthread_mutex_lock(&bp->mtx);
+    if (rate > 0 && bp->rate <= 0) {
+	bp->tokens = 0;
+	bp->last = now_ns();
+    }
+    bp->rate = rate;
+    pthread_mutex_unlock(&bp->mtx);
+}
+
+
+static int
+cmp_u64(const void *a,
+	const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * End of a latency window (t_mtx held). AIMD-like: cut the rate to 70%
+ * of what we actually did when the p99 is above the target, raise it
+ * by 10% when comfortably below. Without an ops= ceiling the limit is
+ * dropped again once it is well above what the scan achieves anyway.
+ */
+static void
+t_adjust(uint64_t now) {
+    double secs = (now - t_win_start) / 1e9;
+    double done = t_win_ops / secs;
+    double rate = t_ops.rate, p99;
+    unsigned int n = t_nsamples < T_SAMPLES ? t_nsamples : T_SAMPLES;
+
+    qsort(t_samples, n, sizeof(t_samples[0]), cmp_u64);
+    p99 = t_samples[(n*99)/100];
+
+    if (p99 > t_target) {
+	if (rate <= 0 || done < rate)
+	    rate = done;
+	rate *= 0.7;
+	if (rate < T_MIN_RATE)
+	    rate = T_MIN_RATE;
+    } else if (rate > 0 && p99 < 0.8*t_target) {
+	rate *= 1.1;
+	if (t_ops_max > 0 && rate > t_ops_max)
+	    rate = t_ops_max;
+	else if (t_ops_max <= 0 && rate > 4*done)
+	    rate = 0;
+    }
+
+    if (rate != t_ops.rate) {
+	if (f_debug)
+	    fprintf(stderr, "*** throttle: stat p99 %.3fms (target %.3fms), %.0f ops/s -> %s%.0f\n",
+		    p99/1e6, t_target/1e6, done, rate > 0 ? "" : "unlimited ", rate);
+	bucket_set(&t_ops, rate);
+    }
+
+    t_win_start = now;
+    t_win_ops = 0;
+    t_nsamples = 0;
+}
+
+void
+throttle_ops(int phase,
+	     unsigned int n,
+	     uint64_t ns) {
+    uint64_t now;
+
+    if (t_target <= 0 && t_ops_max <= 0)
+	return;
+
+    if (t_target > 0) {
+	pthread_mutex_lock(&t_mtx);
+	t_win_ops += n;
+	/* Batched stat()s complete together - only single ones say anything */
+	if (phase == MP_STAT && ns && n == 1)
+	    t_samples[t_nsamples++ % T_SAMPLES] = ns;
+
+	now = now_ns();
+	if (!t_win_start)
+	    t_win_start = now;
+	else if ((now - t_win_start >= T_WINDOW_NS && t_nsamples >= T_MIN_SAMPLES) ||
+		 (now - t_win_start >= T_WINDOW_MAX_NS && t_nsamples > 0))
+	    t_adjust(now);
+	pthread_mutex_unlock(&t_mtx);
+    }
+
+    bucket_take(&t_ops, n);
+}
+
+void
+throttle_objects(unsigned int n) {
+    if (throttle_enabled && n)
+	bucket_take(&t_objects, n);
+}
+
+
+/* "20000", "20k", "1.5M" */
+static int
+get_rate(const char *s,
+	 double *rp) {
+    char *end;
+    double v;
+
+    v = strtod(s, &end);
+    if (end == s)
+	return -1;
+    if (*end == 'k' || *end == 'K') {
+	v *= 1e3;
+	end++;
+    } else if (*end == 'm' || *end == 'M') {
+	v *= 1e6;
+	end++;
+    }
+    if (*end || v <= 0)
+	return -1;
+
+    *rp = v;
+    return 0;
+}
+
+int
+throttle_setup(const char *spec) {
+    char *buf, *cp, *key, *val;
+    double v;
+    int rc = 0;
+
+    buf = strdup(spec);
+    if (!buf)
+	return -1;
+
+    for (cp = buf; rc == 0 && (key = strsep(&cp, ",")) != NULL; ) {
+	if (!*key)
+	    continue;
+	val = strchr(key, '=');
+	if (val)
+	    *val++ = '\0';
+
+	if (strcmp(key, "idle") == 0 && !val)
+	    t_idle = 1;
+	else if (!val || get_rate(val, &v) < 0)
+	    rc = -1;
+	else if (strcmp(key, "objects") == 0)
+	    t_objects.rate = v;
+	else if (strcmp(key, "ops") == 0)
+	    t_ops.rate = t_ops_max = v;
+	else if (strcmp(key, "p99") == 0)
+	    t_target = v * 1e6;
+	else
+	    rc = -1;
+    }
+    free(buf);
+
+    if (rc < 0)
+	return -1;
+
+    throttle_enabled = (t_objects.rate > 0 || t_ops.rate > 0 || t_target > 0);
+
+    /* The latency target needs the stat() calls timed */
+    if (t_target > 0)
+	metrics_enabled = 1;
+    return 0;
+}
+
+/*
+ * Set the idle I/O scheduling class. Called before any threads are
+ * started, they inherit it.
+ */
+int
+throttle_start(void) {
+    if (!t_idle)
+	return 0;
+
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    return syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+		   IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) < 0 ? -1 : 0;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
@@ -0,0 +1,71 @@
+/*
+ * throttle.h
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef THROTTLE_H
+#define THROTTLE_H 1
+
+#include <stdint.h>
+
+/*
+ * Rate control for scanning live file servers (-T).
+ *
+ * Token buckets limit the number of objects scanned per second and
+ * the number of metadata operations (directory reads, stat()s,
+ * renames) per second, shared by all threads. A thread that takes
+ * more than is available sleeps until the bucket has refilled.
+ *
+ * With a latency target the metadata rate adapts: it is cut whenever
+ * the p99 of our own stat() latency rises above the target and slowly
+ * raised again while it stays below.
+ */
+
+extern int throttle_enabled;
+
+/* Parse a -T spec ("objects=N,ops=N,p99=MS,idle"), -1 if invalid */
+extern int
+throttle_setup(const char *spec);
+
+/* Set the idle I/O priority if asked for, -1 (errno) on failure */
+extern int
+throttle_start(void);
+
+extern void
+throttle_objects(unsigned int n);
+
+/* n metadata operations of a metrics phase (MP_xxx) done, ns = latency or 0 */
+extern void
+throttle_ops(int phase,
+	     unsigned int n,
+	     uint64_t ns);
+
+#endif
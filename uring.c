@@ -0,0 +1,410 @@
+/*
+ * uring.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "uring.h"
+#include "xstat.h"
+
+
+int uring_depth = 0;
+
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_SYS_SYSCALL_H)
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/io_uring.h>
+
+
+struct uring {
+    int fd;
+    unsigned int depth;
+
+    /* Submission queue */
+    void *sq_ptr;
+    size_t sq_size;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    /* Completion queue */
+    void *cq_ptr;
+    size_t cq_size;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    unsigned int queued;	/* Not yet submitted */
+    unsigned int inflight;	/* Submitted, not yet completed */
+};
+
+
+static int
+sys_io_uring_setup(unsigned int entries,
+		   struct io_uring_params *p) {
+    return (int) syscall(SYS_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd,
+		   unsigned int to_submit,
+		   unsigned int min_complete,
+		   unsigned int flags) {
+    return (int) syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int
+sys_io_uring_register(int fd,
+		      unsigned int opcode,
+		      void *arg,
+		      unsigned int nr_args) {
+    return (int) syscall(SYS_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+/* Make sure the kernel knows about all the operations we use */
+static int
+uring_probe(URING *up) {
+    static const int ops[] = { IORING_OP_STATX, IORING_OP_RENAMEAT };
+    struct io_uring_probe *pp;
+    size_t psize = sizeof(*pp) + 256*sizeof(struct io_uring_probe_op);
+    unsigned int i;
+    int rc = 0;
+
+    pp = calloc(1, psize);
+    if (!pp)
+	abort();
+
+    if (sys_io_uring_register(up->fd, IORING_REGISTER_PROBE, pp, 256) < 0)
+	rc = -1;
+    else
+	for (i = 0; i < sizeof(ops)/sizeof(ops[0]); i++)
+	    if (ops[i] > pp->last_op || !(pp->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+		rc = -1;
+
+    free(pp);
+    return rc;
+}
+
+
+URING *
+uring_create(unsigned int depth) {
+    struct io_uring_params p;
+    URING *up;
+
+
+    up = calloc(1, sizeof(*up));
+    if (!up)
+	abort();
+
+    memset(&p, 0, sizeof(p));
+    up->fd = sys_io_uring_setup(depth, &p);
+    if (up->fd < 0) {
+	free(up);
+	return NULL;
+    }
+    /* The kernel may round it up, but we never have more than this in flight */
+    up->depth = p.sq_entries < depth ? p.sq_entries : depth;
+
+    up->sq_size = p.sq_off.array + p.sq_entries*sizeof(unsigned int);
+    up->cq_size = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	if (up->cq_size > up->sq_size)
+	    up->sq_size = up->cq_size;
+	up->cq_size = up->sq_size;
+    }
+
+    up->sq_ptr = mmap(NULL, up->sq_size, PROT_READ|PROT_WRITE,
+		      MAP_SHARED|MAP_POPULATE, up->fd, IORING_OFF_SQ_RING);
+    if (up->sq_ptr == MAP_FAILED)
+	goto Fail;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+	up->cq_ptr = up->sq_ptr;
+    else {
+	up->cq_ptr = mmap(NULL, up->cq_size, PROT_READ|PROT_WRITE,
+			  MAP_SHARED|MAP_POPULATE, up->fd, IORING_OFF_CQ_RING);
+	if (up->cq_ptr == MAP_FAILED) {
+	    up->cq_ptr = NULL;
+	    goto Fail;
+	}
+    }
+
+    up->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    up->sqes = mmap(NULL, up->sqes_size, PROT_READ|PROT_WRITE,
+		    MAP_SHARED|MAP_POPULATE, up->fd, IORING_OFF_SQES);
+    if (up->sqes == MAP_FAILED) {
+	up->sqes = NULL;
+	goto Fail;
+    }
+
+    up->sq_head  = (unsigned int *) ((char *) up->sq_ptr + p.sq_off.head);
+    up->sq_tail  = (unsigned int *) ((char *) up->sq_ptr + p.sq_off.tail);
+    up->sq_mask  = (unsigned int *) ((char *) up->sq_ptr + p.sq_off.ring_mask);
+    up->sq_array = (unsigned int *) ((char *) up->sq_ptr + p.sq_off.array);
+
+    up->cq_head  = (unsigned int *) ((char *) up->cq_ptr + p.cq_off.head);
+    up->cq_tail  = (unsigned int *) ((char *) up->cq_ptr + p.cq_off.tail);
+    up->cq_mask  = (unsigned int *) ((char *) up->cq_ptr + p.cq_off.ring_mask);
+    up->cqes     = (struct io_uring_cqe *) ((char *) up->cq_ptr + p.cq_off.cqes);
+
+    if (uring_probe(up) < 0)
+	goto Fail;
+
+    return up;
+
+ Fail:
+    uring_destroy(up);
+    return NULL;
+}
+
+
+/* Collect finished operations */
+static void
+uring_reap(URING *up) {
+    unsigned int head = *up->cq_head;
+    unsigned int tail = __atomic_load_n(up->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+	struct io_uring_cqe *cqe = &up->cqes[head & *up->cq_mask];
+
+	*(int *) (uintptr_t) cqe->user_data = cqe->res;
+	up->inflight--;
+	head++;
+    }
+    __atomic_store_n(up->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Operations still in flight go on writing into the caller's buffers
+ * even after the ring is closed, so wait for them first. -1 if that
+ * fails - the ring is then left open and the buffers must be too.
+ */
+int
+uring_destroy(URING *up) {
+    if (!up)
+	return 0;
+
+    while (up->inflight > 0) {
+	if (sys_io_uring_enter(up->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+	    errno != EINTR && errno != EAGAIN && errno != EBUSY)
+	    return -1;
+	uring_reap(up);
+    }
+
+    if (up->sqes)
+	munmap(up->sqes, up->sqes_size);
+    if (up->cq_ptr && up->cq_ptr != up->sq_ptr)
+	munmap(up->cq_ptr, up->cq_size);
+    if (up->sq_ptr && up->sq_ptr != MAP_FAILED)
+	munmap(up->sq_ptr, up->sq_size);
+    close(up->fd);
+    free(up);
+    return 0;
+}
+
+
+/* Submit everything queued and wait for at least min_complete operations */
+static int
+uring_enter(URING *up,
+	    unsigned int min_complete) {
+    int rc;
+
+    do {
+	rc = sys_io_uring_enter(up->fd, up->queued, min_complete,
+				min_complete ? IORING_ENTER_GETEVENTS : 0);
+    } while (rc < 0 && errno == EINTR);
+    if (rc < 0)
+	return -1;
+
+    up->inflight += rc;
+    up->queued -= rc;
+    uring_reap(up);
+    return 0;
+}
+
+static struct io_uring_sqe *
+uring_get_sqe(URING *up,
+	      int *resp) {
+    struct io_uring_sqe *sqe;
+    unsigned int tail;
+
+    /* Never more than depth in flight so the completion queue can't overflow */
+    while (up->queued + up->inflight >= up->depth)
+	if (uring_enter(up, 1) < 0)
+	    return NULL;
+
+    tail = *up->sq_tail;
+    sqe = &up->sqes[tail & *up->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (uintptr_t) resp;
+    *resp = URING_PENDING;
+
+    up->sq_array[tail & *up->sq_mask] = tail & *up->sq_mask;
+    __atomic_store_n(up->sq_tail, tail+1, __ATOMIC_RELEASE);
+    up->queued++;
+    return sqe;
+}
+
+
+int
+uring_statx(URING *up,
+	    int dfd,
+	    const char *name,
+	    int flags,
+	    USTATX *bp,
+	    int *resp) {
+    struct io_uring_sqe *sqe = uring_get_sqe(up, resp);
+
+    if (!sqe)
+	return -1;
+
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = dfd;
+    sqe->addr = (uintptr_t) name;
+    sqe->len = xstat_mask() ? xstat_mask() : STATX_BASIC_STATS;
+    sqe->off = (uintptr_t) &bp->stx;
+    sqe->statx_flags = flags;
+    return 0;
+}
+
+int
+uring_renameat(URING *up,
+	       int olddfd,
+	       const char *oldname,
+	       int newdfd,
+	       const char *newname,
+	       int *resp) {
+    struct io_uring_sqe *sqe = uring_get_sqe(up, resp);
+
+    if (!sqe)
+	return -1;
+
+    sqe->opcode = IORING_OP_RENAMEAT;
+    sqe->fd = olddfd;
+    sqe->addr = (uintptr_t) oldname;
+    sqe->len = newdfd;
+    sqe->addr2 = (uintptr_t) newname;
+    return 0;
+}
+
+
+/* Wait for all queued operations to finish */
+int
+uring_wait(URING *up) {
+    while (up->queued + up->inflight > 0)
+	if (uring_enter(up, up->queued + up->inflight) < 0)
+	    return -1;
+    return 0;
+}
+
+
+void
+ustatx_to_stat(const USTATX *bp,
+	       struct stat *sp) {
+    const struct statx *xp = &bp->stx;
+
+    /* Only what xstatat() promises (see xstat.h) */
+    memset(sp, 0, sizeof(*sp));
+    sp->st_dev = makedev(xp->stx_dev_major, xp->stx_dev_minor);
+    sp->st_ino = xp->stx_ino;
+    sp->st_mode = xp->stx_mode;
+    sp->st_size = xp->stx_size;
+    sp->st_mtim.tv_sec = xp->stx_mtime.tv_sec;
+    sp->st_mtim.tv_nsec = xp->stx_mtime.tv_nsec;
+}
+
+#else
+
+/* No io_uring here - everything is done synchronously */
+
+URING *
+uring_create(unsigned int depth) {
+    return NULL;
+}
+
+int
+uring_destroy(URING *up) {
+    return 0;
+}
+
+int
+uring_statx(URING *up,
+	    int dfd,
+	    const char *name,
+	    int flags,
+	    USTATX *bp,
+	    int *resp) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+uring_renameat(URING *up,
+	       int olddfd,
+	       const char *oldname,
+	       int newdfd,
+	       const char *newname,
+	       int *resp) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int
+uring_wait(URING *up) {
+    return 0;
+}
+
+void
+ustatx_to_stat(const USTATX *bp,
+	       struct stat *sp) {
+    memset(sp, 0, sizeof(*sp));
+}
+
+#endif
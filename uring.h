@@ -0,0 +1,101 @@
+/*
+ * uring.h
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef URING_H
+#define URING_H 1
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/stat.h>
+#endif
+
+/*
+ * Minimal io_uring wrapper for batching metadata operations (Linux).
+ *
+ * Operations are queued with uring_xxx() and complete in any order.
+ * Their result (0 or -errno) is stored in the int supplied by the caller
+ * (set to URING_PENDING while in flight), and the names and buffers
+ * passed in must stay valid until uring_wait() has returned.
+ *
+ * uring_create() returns NULL if io_uring is not available, and the
+ * callers then fall back to the synchronous system calls.
+ */
+
+#define URING_PENDING	1
+
+typedef struct uring URING;
+
+/* statx() result buffer */
+typedef struct ustatx {
+#ifdef HAVE_LINUX_IO_URING_H
+    struct statx stx;
+#else
+    int dummy;
+#endif
+} USTATX;
+
+
+extern int uring_depth;
+
+extern URING *
+uring_create(unsigned int depth);
+
+/* -1 if operations are still in flight (keep their buffers) */
+extern int
+uring_destroy(URING *up);
+
+extern int
+uring_statx(URING *up,
+	    int dfd,
+	    const char *name,
+	    int flags,
+	    USTATX *bp,
+	    int *resp);
+
+extern int
+uring_renameat(URING *up,
+	       int olddfd,
+	       const char *oldname,
+	       int newdfd,
+	       const char *newname,
+	       int *resp);
+
+extern int
+uring_wait(URING *up);
+
+extern void
+ustatx_to_stat(const USTATX *bp,
+	       struct stat *sp);
+
+#endif
@@ -0,0 +1,1347 @@
+/*
+ * walk.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Need d_type & DT_xxx (and syscall() on Linux) */
+#define _DEFAULT_SOURCE 1
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
+#include "pnfdscan.h"
+#include "classify.h"
+#include "walk.h"
+#include "dircache.h"
+#include "uring.h"
+#include "xstat.h"
+#include "metrics.h"
+#include "checkpoint.h"
+#include "throttle.h"
+#include "shard.h"
+
+
+int n_workers = 1;
+int f_inode = 0;
+
+
+#ifndef DT_UNKNOWN
+#define DT_UNKNOWN	0
+#define DT_DIR		4
+#endif
+
+#if defined(__linux__) && defined(SYS_getdents64)
+#define USE_GETDENTS64 1
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+#define DBUFSIZE	(64*1024)
+
+/* A directory entry read by read_dir() */
+typedef struct entry {
+    size_t name;	/* Offset into the worker's name buffer */
+    ino_t ino;
+    unsigned char type;
+    unsigned char descend;	/* Subdirectory to visit (-I) */
+} ENTRY;
+
+
+/*
+ * Hash set of the names in a directory, used to check for NFC twins
+ * and to generate unique names without having to ask the filesystem.
+ * Open addressing with linear probing; slots hold entry index + 1.
+ */
+struct nameset {
+    const char *nbuf;
+    const ENTRY *ev;
+    uint32_t *tab;
+    size_t size;	/* Power of 2 */
+
+    /* Names generated (and reserved) after the directory was read */
+    char **xv;
+    size_t xv_size;
+    size_t xv_len;
+};
+
+
+/*
+ * A directory to scan. It is kept around (and keeps its parent around)
+ * until it and all directories below it have been scanned, so that
+ * dir_done() can be called in post-order.
+ */
+typedef struct work {
+    char *path;
+    dev_t dev;
+    struct work *parent;
+    unsigned int refs;	/* 1 for the scan itself + 1 per subdirectory */
+    unsigned int depth;	/* Below the root */
+} WORK;
+
+typedef struct deque {
+    pthread_mutex_t mtx;
+    WORK **v;
+    size_t size;
+    size_t head;	/* Oldest entry, stolen by other workers */
+    size_t len;
+} DEQUE;
+
+typedef struct worker {
+    int id;
+    pthread_t tid;
+    DEQUE dq;
+    COUNTERS c;
+    char *pbuf;
+    size_t pbufsize;
+
+    /* Entries of the directory currently being scanned */
+    ENTRY *ev;
+    size_t ev_size;
+    size_t ev_len;
+    char *nbuf;
+    size_t nbuf_size;
+    size_t nbuf_len;
+#ifdef USE_GETDENTS64
+    char *dbuf;
+#endif
+    NAMESET ns;
+
+    /* Subdirectory names of the current directory, for the directory cache */
+    char *sbuf;
+    size_t sbuf_size;
+    size_t sbuf_len;
+    unsigned int nsubs;
+
+    /* Batched stat() of the current directory's entries (io_uring) */
+    URING *ring;
+    USTATX *stv;
+    int *strv;
+    size_t st_size;
+} WORKER;
+
+
+static WORKER *workers = NULL;
+
+/* Number of queued + in-progress directories */
+static unsigned long w_pending = 0;
+
+/* Number of queued directories */
+static unsigned long w_queued = 0;
+
+/* Length of the root path, without trailing slashes (for -P) */
+static size_t w_rootlen = 0;
+
+static unsigned int w_idle = 0;
+static pthread_mutex_t w_idle_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t w_idle_cv = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Checkpoints. Workers park between directories when w_pause is set,
+ * and the last one to do so has the walk state to itself until it
+ * clears it. All protected by w_idle_mtx.
+ */
+static int w_pause = 0;
+static unsigned long w_pause_gen = 0;
+static unsigned int w_parked = 0;
+static unsigned int w_running = 0;
+
+
+
+static void
+deque_push(DEQUE *dp,
+	   WORK *wp) {
+    pthread_mutex_lock(&dp->mtx);
+    if (dp->len == dp->size) {
+	size_t nsize = dp->size ? dp->size*2 : 64;
+	WORK **nv = malloc(nsize*sizeof(*nv));
+	size_t i;
+
+	if (!nv)
+	    abort();
+
+	for (i = 0; i < dp->len; i++)
+	    nv[i] = dp->v[(dp->head+i) % dp->size];
+	free(dp->v);
+	dp->v = nv;
+	dp->size = nsize;
+	dp->head = 0;
+    }
+    dp->v[(dp->head+dp->len++) % dp->size] = wp;
+    pthread_mutex_unlock(&dp->mtx);
+}
+
+/* Owner end - newest entry */
+static WORK *
+deque_pop(DEQUE *dp) {
+    WORK *wp = NULL;
+
+    pthread_mutex_lock(&dp->mtx);
+    if (dp->len > 0)
+	wp = dp->v[(dp->head + --dp->len) % dp->size];
+    pthread_mutex_unlock(&dp->mtx);
+    return wp;
+}
+
+/* Thief end - oldest entry */
+static WORK *
+deque_steal(DEQUE *dp) {
+    WORK *wp = NULL;
+
+    if (!__atomic_load_n(&dp->len, __ATOMIC_RELAXED))
+	return NULL;
+
+    if (pthread_mutex_trylock(&dp->mtx) != 0)
+	return NULL;
+    if (dp->len > 0) {
+	wp = dp->v[dp->head];
+	dp->head = (dp->head+1) % dp->size;
+	dp->len--;
+    }
+    pthread_mutex_unlock(&dp->mtx);
+    return wp;
+}
+
+
+/* Path relative to the root */
+static const char *
+rel_path(const char *path) {
+    path += w_rootlen;
+    while (*path == '/')
+	path++;
+    return path;
+}
+
+static unsigned int
+rel_depth(const char *path) {
+    unsigned int depth = 0;
+
+    for (path = rel_path(path); *path; depth++) {
+	path = strchr(path, '/');
+	if (!path)
+	    return depth+1;
+	while (*path == '/')
+	    path++;
+    }
+    return depth;
+}
+
+static void
+work_add(WORKER *wp,
+	 const char *path,
+	 dev_t dev,
+	 WORK *parent) {
+    WORK *w = malloc(sizeof(*w));
+
+    if (!w)
+	abort();
+    w->path = strdup(path);
+    if (!w->path)
+	abort();
+    w->dev = dev;
+    w->parent = parent;
+    w->refs = 1;
+    w->depth = parent ? parent->depth+1 : rel_depth(path);
+    if (parent)
+	__atomic_add_fetch(&parent->refs, 1, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&w_pending, 1, __ATOMIC_SEQ_CST);
+    deque_push(&wp->dq, w);
+    __atomic_add_fetch(&w_queued, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&w_idle, __ATOMIC_SEQ_CST) > 0) {
+	pthread_mutex_lock(&w_idle_mtx);
+	pthread_cond_signal(&w_idle_cv);
+	pthread_mutex_unlock(&w_idle_mtx);
+    }
+}
+
+/* Wait for a checkpoint to be taken, or take it if we're the last worker to stop */
+static void
+walk_park(void) {
+    unsigned long gen;
+
+    pthread_mutex_lock(&w_idle_mtx);
+    if (!w_pause) {
+	pthread_mutex_unlock(&w_idle_mtx);
+	return;
+    }
+
+    gen = w_pause_gen;
+    if (++w_parked == w_running) {
+	checkpoint(0);
+	w_pause = 0;
+	w_parked = 0;
+	w_pause_gen++;
+	pthread_cond_broadcast(&w_idle_cv);
+    } else {
+	while (gen == w_pause_gen)
+	    pthread_cond_wait(&w_idle_cv, &w_idle_mtx);
+    }
+    pthread_mutex_unlock(&w_idle_mtx);
+}
+
+/* Ask all workers to stop for a checkpoint if it's time for one */
+static void
+walk_ckpt_check(void) {
+    if (!checkpoint_due())
+	return;
+
+    pthread_mutex_lock(&w_idle_mtx);
+    if (!w_pause && checkpoint_due()) {
+	w_pause = 1;
+	/* Idle workers have to park too */
+	pthread_cond_broadcast(&w_idle_cv);
+    }
+    pthread_mutex_unlock(&w_idle_mtx);
+}
+
+static WORK *
+work_get(WORKER *wp) {
+    WORK *w;
+    int i;
+
+    for (;;) {
+	if (__atomic_load_n(&w_pause, __ATOMIC_SEQ_CST))
+	    walk_park();
+
+	w = deque_pop(&wp->dq);
+	for (i = 1; !w && i < n_workers; i++)
+	    w = deque_steal(&workers[(wp->id+i) % n_workers].dq);
+	if (w) {
+	    __atomic_sub_fetch(&w_queued, 1, __ATOMIC_SEQ_CST);
+	    return w;
+	}
+
+	pthread_mutex_lock(&w_idle_mtx);
+	__atomic_add_fetch(&w_idle, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&w_pending, __ATOMIC_SEQ_CST) == 0) {
+	    __atomic_sub_fetch(&w_idle, 1, __ATOMIC_SEQ_CST);
+	    w_running--;
+	    if (w_pause) {
+		/* Nothing left to save - let the parked workers finish too */
+		w_pause = 0;
+		w_parked = 0;
+		w_pause_gen++;
+		pthread_cond_broadcast(&w_idle_cv);
+	    }
+	    pthread_mutex_unlock(&w_idle_mtx);
+	    return NULL;
+	}
+	if (__atomic_load_n(&w_queued, __ATOMIC_SEQ_CST) == 0 && !w_pause)
+	    pthread_cond_wait(&w_idle_cv, &w_idle_mtx);
+	__atomic_sub_fetch(&w_idle, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&w_idle_mtx);
+    }
+}
+
+/* Drop a reference, completing directories bottom-up */
+static void
+work_release(WORK *w) {
+    while (w && __atomic_sub_fetch(&w->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+	WORK *parent = w->parent;
+
+	dir_done(w->path);
+	free(w->path);
+	free(w);
+	w = parent;
+    }
+}
+
+static void
+work_done(WORK *w) {
+    /* Must be done before w_pending can reach 0 */
+    work_release(w);
+
+    if (__atomic_sub_fetch(&w_pending, 1, __ATOMIC_SEQ_CST) == 0) {
+	/* Wake everyone up so they notice we're done */
+	pthread_mutex_lock(&w_idle_mtx);
+	pthread_cond_broadcast(&w_idle_cv);
+	pthread_mutex_unlock(&w_idle_mtx);
+    }
+}
+
+
+static char *
+mkpath(WORKER *wp,
+       const char *dir,
+       const char *name) {
+    size_t dlen = strlen(dir);
+    size_t nlen = strlen(name);
+
+    if (dlen+nlen+2 > wp->pbufsize) {
+	wp->pbufsize = dlen+nlen+2+256;
+	wp->pbuf = realloc(wp->pbuf, wp->pbufsize);
+	if (!wp->pbuf)
+	    abort();
+    }
+
+    memcpy(wp->pbuf, dir, dlen);
+    if (dlen == 0 || dir[dlen-1] != '/')
+	wp->pbuf[dlen++] = '/';
+    memcpy(wp->pbuf+dlen, name, nlen+1);
+    return wp->pbuf;
+}
+
+
+const struct stat *
+obj_stat(OBJECT *op) {
+    if (!op->sb_valid) {
+	uint64_t t0 = m_start(MP_STAT);
+
+	op->sb_valid = (xstatat(op->dirfd, op->name, &op->sb, XS_SCAN) < 0 ? -1 : 1);
+	m_stop(MP_STAT, t0, 1);
+    }
+
+    return op->sb_valid > 0 ? &op->sb : NULL;
+}
+
+
+static uint32_t
+name_hash(const char *s) {
+    uint32_t h = 2166136261U;
+
+    /* FNV-1a */
+    while (*s) {
+	h ^= (unsigned char) *s++;
+	h *= 16777619U;
+    }
+    return h;
+}
+
+
+static void
+nameset_build(NAMESET *nsp,
+	      const char *nbuf,
+	      const ENTRY *ev,
+	      size_t n) {
+    size_t i, size = 64;
+
+    while (size < 2*n)
+	size <<= 1;
+
+    if (size > nsp->size) {
+	free(nsp->tab);
+	nsp->tab = malloc(size*sizeof(*nsp->tab));
+	if (!nsp->tab)
+	    abort();
+    }
+    nsp->size = size;
+    memset(nsp->tab, 0, size*sizeof(*nsp->tab));
+
+    nsp->nbuf = nbuf;
+    nsp->ev = ev;
+
+    for (i = 0; i < n; i++) {
+	size_t h = name_hash(nbuf+ev[i].name) & (size-1);
+
+	while (nsp->tab[h])
+	    h = (h+1) & (size-1);
+	nsp->tab[h] = i+1;
+    }
+
+    while (nsp->xv_len > 0)
+	free(nsp->xv[--nsp->xv_len]);
+}
+
+static int
+nameset_lookup(const NAMESET *nsp,
+	       const char *name) {
+    size_t h = name_hash(name) & (nsp->size-1);
+    size_t i;
+
+    for (; nsp->tab[h]; h = (h+1) & (nsp->size-1))
+	if (strcmp(nsp->nbuf+nsp->ev[nsp->tab[h]-1].name, name) == 0)
+	    return 1;
+
+    for (i = 0; i < nsp->xv_len; i++)
+	if (strcmp(nsp->xv[i], name) == 0)
+	    return 1;
+
+    return 0;
+}
+
+static void
+nameset_free(NAMESET *nsp) {
+    while (nsp->xv_len > 0)
+	free(nsp->xv[--nsp->xv_len]);
+    free(nsp->xv);
+    free(nsp->tab);
+}
+
+
+/*
+ * Check if a name exists in the same directory as an object. Uses the
+ * directory's name set if we have one, else asks the filesystem.
+ */
+int
+obj_sibling_exists(OBJECT *op,
+		   const char *name) {
+    struct stat sb;
+
+    if (op->names)
+	return nameset_lookup(op->names, name);
+
+    return xstatat(op->dirfd, name, &sb, XS_SCAN) == 0;
+}
+
+/* Reserve a (generated) name in the object's directory name set */
+void
+obj_sibling_add(OBJECT *op,
+		const char *name) {
+    NAMESET *nsp = op->names;
+
+    if (!nsp)
+	return;
+
+    if (nsp->xv_len == nsp->xv_size) {
+	nsp->xv_size = nsp->xv_size ? nsp->xv_size*2 : 16;
+	nsp->xv = realloc(nsp->xv, nsp->xv_size*sizeof(*nsp->xv));
+	if (!nsp->xv)
+	    abort();
+    }
+    nsp->xv[nsp->xv_len] = strdup(name);
+    if (!nsp->xv[nsp->xv_len])
+	abort();
+    nsp->xv_len++;
+}
+
+
+static void
+add_entry(WORKER *wp,
+	  const char *name,
+	  ino_t ino,
+	  unsigned char type) {
+    size_t len;
+    ENTRY *ep;
+
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+	return;
+
+    len = strlen(name)+1;
+    if (wp->nbuf_len+len > wp->nbuf_size) {
+	wp->nbuf_size = (wp->nbuf_size ? wp->nbuf_size*2 : 64*1024) + len;
+	wp->nbuf = realloc(wp->nbuf, wp->nbuf_size);
+	if (!wp->nbuf)
+	    abort();
+    }
+
+    if (wp->ev_len == wp->ev_size) {
+	wp->ev_size = wp->ev_size ? wp->ev_size*2 : 1024;
+	wp->ev = realloc(wp->ev, wp->ev_size*sizeof(*wp->ev));
+	if (!wp->ev)
+	    abort();
+    }
+
+    ep = &wp->ev[wp->ev_len++];
+    ep->name = wp->nbuf_len;
+    ep->ino = ino;
+    ep->type = type;
+    ep->descend = 0;
+
+    memcpy(wp->nbuf+wp->nbuf_len, name, len);
+    wp->nbuf_len += len;
+}
+
+
+/*
+ * Read all entries of a directory into the worker's entry buffer.
+ * On Linux we call getdents64() directly with a large buffer, elsewhere
+ * we go via readdir(). Either way we get the name, inode number and
+ * (on most filesystems) the object type without having to stat() it.
+ */
+static int
+read_dir(WORKER *wp,
+	 int fd) {
+    wp->ev_len = 0;
+    wp->nbuf_len = 0;
+
+#ifdef USE_GETDENTS64
+    if (!wp->dbuf) {
+	wp->dbuf = malloc(DBUFSIZE);
+	if (!wp->dbuf)
+	    abort();
+    }
+
+    for (;;) {
+	long n = syscall(SYS_getdents64, fd, wp->dbuf, DBUFSIZE);
+	long off;
+
+	if (n < 0)
+	    return -1;
+	if (n == 0)
+	    break;
+
+	for (off = 0; off < n; ) {
+	    struct linux_dirent64 *dep = (struct linux_dirent64 *) (wp->dbuf+off);
+
+	    add_entry(wp, dep->d_name, dep->d_ino, dep->d_type);
+	    off += dep->d_reclen;
+	}
+    }
+#else
+    {
+	int dfd;
+	DIR *dp;
+	struct dirent *dep;
+
+	/* closedir() will close the descriptor, and we need ours for fstatat() */
+	dfd = dup(fd);
+	if (dfd < 0)
+	    return -1;
+
+	dp = fdopendir(dfd);
+	if (!dp) {
+	    close(dfd);
+	    return -1;
+	}
+
+	errno = 0;
+	while ((dep = readdir(dp)) != NULL) {
+#ifdef HAVE_STRUCT_DIRENT_D_TYPE
+	    add_entry(wp, dep->d_name, dep->d_ino, dep->d_type);
+#else
+	    add_entry(wp, dep->d_name, dep->d_ino, DT_UNKNOWN);
+#endif
+	}
+	if (errno) {
+	    int rc = errno;
+
+	    closedir(dp);
+	    errno = rc;
+	    return -1;
+	}
+	closedir(dp);
+    }
+#endif
+
+    return 0;
+}
+
+
+static void
+add_sub(WORKER *wp,
+	const char *name) {
+    size_t len = strlen(name)+1;
+
+    if (wp->sbuf_len+len > wp->sbuf_size) {
+	wp->sbuf_size = (wp->sbuf_len+len)*2;
+	wp->sbuf = realloc(wp->sbuf, wp->sbuf_size);
+	if (!wp->sbuf)
+	    abort();
+    }
+    memcpy(wp->sbuf+wp->sbuf_len, name, len);
+    wp->sbuf_len += len;
+    wp->nsubs++;
+}
+
+
+/*
+ * Fetch the stat() information for all entries that are going to need
+ * it in one go, instead of one blocking call at a time from walker().
+ * Entries that weren't fetched are left as URING_PENDING.
+ */
+static int
+prefetch_stats(WORKER *wp,
+	       int fd) {
+    size_t i, n = 0;
+    int rc = 0;
+    uint64_t t0;
+
+    if (wp->ev_len > wp->st_size) {
+	wp->st_size = wp->ev_len*2;
+	free(wp->stv);
+	free(wp->strv);
+	wp->stv = malloc(wp->st_size*sizeof(*wp->stv));
+	wp->strv = malloc(wp->st_size*sizeof(*wp->strv));
+	if (!wp->stv || !wp->strv)
+	    abort();
+    }
+
+    for (i = 0; i < wp->ev_len; i++) {
+	ENTRY *ep = &wp->ev[i];
+	const char *name = wp->nbuf+ep->name;
+
+	wp->strv[i] = URING_PENDING;
+	if (rc == 0 &&
+	    (ep->type == DT_UNKNOWN || (f_mount && ep->type == DT_DIR) ||
+	     f_time || utf8_class(name, strlen(name)) == NC_UTF8)) {
+	    rc = uring_statx(wp->ring, fd, name, AT_SYMLINK_NOFOLLOW|xstat_flags(XS_SCAN),
+			     &wp->stv[i], &wp->strv[i]);
+	    n++;
+	}
+    }
+
+    /* The whole batch is timed as one operation */
+    t0 = m_start(MP_STAT);
+    rc = uring_wait(wp->ring);
+    m_stop(MP_STAT, t0, n);
+    if (rc < 0) {
+	/* Give up on io_uring (once nothing is in flight) */
+	if (f_debug)
+	    fprintf(stderr, "%s: Error: io_uring: %s - disabled\n", argv0, strerror(errno));
+	if (uring_destroy(wp->ring) < 0) {
+	    /* The kernel may still write to them - never reuse or free them */
+	    wp->stv = NULL;
+	    wp->strv = NULL;
+	    wp->st_size = 0;
+	}
+	wp->ring = NULL;
+	return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+entry_ino_cmp(const void *va,
+	      const void *vb) {
+    const ENTRY *a = (const ENTRY *) va;
+    const ENTRY *b = (const ENTRY *) vb;
+
+    return a->ino < b->ino ? -1 : a->ino > b->ino;
+}
+
+
+/* Unchanged since the last scan - just account for it and visit its subdirectories */
+static void
+scan_cached(WORKER *wp,
+	    WORK *w,
+	    int fd,
+	    const DCREC *rp) {
+    const char *name = DCREC_SUBS(rp);
+    unsigned int i;
+
+    for (i = 0; i < rp->nsubs; i++, name += strlen(name)+1) {
+	if (f_mount) {
+	    struct stat sb;
+
+	    if (xstatat(fd, name, &sb, XS_SCAN) == 0 && sb.st_dev != w->dev)
+		continue;
+	}
+	work_add(wp, mkpath(wp, w->path, name), w->dev, w);
+    }
+
+    wp->c.ascii += rp->ascii;
+    wp->c.nfc += rp->nfc;
+    wp->c.other += rp->other;
+
+    dircache_keep(rp);
+
+    __atomic_add_fetch(&n_objects, rp->objects, __ATOMIC_RELAXED);
+    throttle_objects(rp->objects);
+}
+
+/*
+ * open() a directory, relative to start_fd. Paths too long for the
+ * kernel (deep trees) are opened a piece at a time with openat().
+ */
+int
+open_dir(int start_fd,
+	 const char *path,
+	 int flags) {
+    char buf[PATH_MAX];
+    int fd, dfd, rc;
+    const char *end;
+    size_t len;
+
+    fd = openat(start_fd, path, O_RDONLY|O_DIRECTORY|O_CLOEXEC|flags);
+    if (fd >= 0 || errno != ENAMETOOLONG)
+	return fd;
+
+    dfd = start_fd;
+    if (*path == '/') {
+	dfd = open("/", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (dfd < 0)
+	    return -1;
+	while (*path == '/')
+	    path++;
+    }
+
+    for (;;) {
+	len = strlen(path);
+	if (len >= sizeof(buf)) {
+	    /* Split at the last slash that fits */
+	    for (end = path+sizeof(buf)-1; end > path && *end != '/'; --end)
+		;
+	    if (end == path) {
+		if (dfd != start_fd)
+		    close(dfd);
+		errno = ENAMETOOLONG;
+		return -1;
+	    }
+	    len = end-path;
+	}
+
+	memcpy(buf, path, len);
+	buf[len] = '\0';
+	path += len;
+	while (*path == '/')
+	    path++;
+
+	/* Only the last piece is subject to the caller's flags */
+	fd = openat(dfd, buf, O_RDONLY|O_DIRECTORY|O_CLOEXEC|(*path ? 0 : flags));
+	if (dfd != start_fd) {
+	    rc = errno;
+	    close(dfd);
+	    errno = rc;
+	}
+	if (fd < 0 || !*path)
+	    break;
+	dfd = fd;
+    }
+
+    return fd;
+}
+
+
+static void
+scan_dir(WORKER *wp,
+	 WORK *w) {
+    int fd, rc;
+    size_t i;
+    struct stat dsb;
+    int use_cache = 0, prefetched = 0;
+    COUNTERS c0;
+    uint64_t t0;
+    /* Above the shard depth - some of the entries belong to other shards */
+    int partial = (shard_n > 0 && w->depth < shard_depth);
+    size_t owned = 0;
+
+
+    fd = open_dir(AT_FDCWD, w->path, O_NOFOLLOW);
+    if (fd < 0) {
+	fprintf(stderr, "%s: Error: %s: open: %s\n",
+		argv0, w->path, strerror(errno));
+	wp->c.unread++;
+	__atomic_add_fetch(&n_errors, 1, __ATOMIC_RELAXED);
+	return;
+    }
+
+    /* Before reading it, so any later change shows up in the timestamps */
+    if (dircache_enabled && !partial && fstat(fd, &dsb) == 0) {
+	/* Everything has to be listed with -vv */
+	const DCREC *rp = (f_verbose < 2 ? dircache_lookup(&dsb) : NULL);
+
+	if (rp) {
+	    scan_cached(wp, w, fd, rp);
+	    close(fd);
+	    return;
+	}
+	use_cache = 1;
+    }
+
+    t0 = m_start(MP_READDIR);
+    rc = read_dir(wp, fd);
+    m_stop(MP_READDIR, t0, 1);
+    if (rc < 0) {
+	fprintf(stderr, "%s: Error: %s: Reading directory: %s\n",
+		argv0, w->path, strerror(errno));
+	wp->c.unread++;
+	__atomic_add_fetch(&n_errors, 1, __ATOMIC_RELAXED);
+	/* Process whatever we got */
+    }
+
+    /*
+     * Stat and descend in inode order, which usually follows the on-disk
+     * inode table (readdir order on hashed directories is random).
+     */
+    if (f_inode)
+	qsort(wp->ev, wp->ev_len, sizeof(*wp->ev), entry_ino_cmp);
+
+    nameset_build(&wp->ns, wp->nbuf, wp->ev, wp->ev_len);
+
+    if (wp->ring)
+	prefetched = (prefetch_stats(wp, fd) == 0);
+
+    c0 = wp->c;
+    wp->sbuf_len = 0;
+    wp->nsubs = 0;
+
+    for (i = 0; i < wp->ev_len; i++) {
+	ENTRY *ep = &wp->ev[i];
+	OBJECT o;
+	const struct stat *sp;
+	unsigned long unread;
+
+	o.dirfd = fd;
+	o.names = &wp->ns;
+	o.name = wp->nbuf+ep->name;
+	o.type = ep->type;
+	o.sb_valid = 0;
+
+	if (prefetched && wp->strv[i] != URING_PENDING) {
+	    if (wp->strv[i] == 0) {
+		ustatx_to_stat(&wp->stv[i], &o.sb);
+		o.sb_valid = 1;
+	    } else
+		o.sb_valid = -1;
+	}
+
+	o.path = mkpath(wp, w->path, o.name);
+	if (partial && !shard_owns(rel_path(o.path))) {
+	    /* Another shard's, but ours may be below it */
+	    if (w->depth+1 < shard_depth &&
+		((o.type == DT_DIR && !f_mount) ||
+		 ((o.type == DT_DIR || o.type == DT_UNKNOWN) &&
+		  (sp = obj_stat(&o)) != NULL && S_ISDIR(sp->st_mode) &&
+		  (!f_mount || sp->st_dev == w->dev))))
+		work_add(wp, o.path, w->dev, w);
+	    continue;
+	}
+	owned++;
+
+	/* Like nftw(FTW_MOUNT) - don't even report objects on other filesystems */
+	if (f_mount && (o.type == DT_DIR || o.type == DT_UNKNOWN) &&
+	    (sp = obj_stat(&o)) != NULL && sp->st_dev != w->dev) {
+	    /* Still remembered, in case a later scan is run without -x */
+	    if (use_cache && S_ISDIR(sp->st_mode))
+		add_sub(wp, o.name);
+	    continue;
+	}
+
+	unread = wp->c.unread;
+	walker(&o, &wp->c);
+
+	if (o.type == DT_UNKNOWN) {
+	    sp = obj_stat(&o);
+	    if (!sp) {
+		/* Unless walker() already counted it */
+		if (wp->c.unread == unread)
+		    wp->c.unread++;
+		continue;
+	    }
+	    if (S_ISDIR(sp->st_mode))
+		o.type = DT_DIR;
+	}
+
+	if (o.type == DT_DIR) {
+	    if (f_inode)
+		ep->descend = 1;
+	    else
+		work_add(wp, o.path, w->dev, w);
+	    if (use_cache)
+		add_sub(wp, o.name);
+	}
+    }
+
+    /* We pop the newest work first, so push the highest inode first */
+    if (f_inode)
+	for (i = wp->ev_len; i-- > 0; )
+	    if (wp->ev[i].descend)
+		work_add(wp, mkpath(wp, w->path, wp->nbuf+wp->ev[i].name), w->dev, w);
+
+    close(fd);
+
+    if (use_cache && rc == 0) {
+	COUNTERS dc;
+
+	dc.ascii = wp->c.ascii - c0.ascii;
+	dc.nfd = wp->c.nfd - c0.nfd;
+	dc.nfc = wp->c.nfc - c0.nfc;
+	dc.other = wp->c.other - c0.other;
+	dc.unknown = wp->c.unknown - c0.unknown;
+	dc.coll = wp->c.coll - c0.coll;
+	dc.unread = wp->c.unread - c0.unread;
+	dircache_add(&dsb, &dc, wp->ev_len, wp->sbuf, wp->sbuf_len, wp->nsubs);
+    }
+
+    if (!partial)
+	owned = wp->ev_len;
+    __atomic_add_fetch(&n_objects, owned, __ATOMIC_RELAXED);
+    throttle_objects(owned);
+}
+
+
+static void *
+worker_main(void *vp) {
+    WORKER *wp = (WORKER *) vp;
+    WORK *w;
+
+    while ((w = work_get(wp)) != NULL) {
+	scan_dir(wp, w);
+	work_done(w);
+	walk_ckpt_check();
+    }
+
+    return NULL;
+}
+
+
+static void
+walk_start(void) {
+    int i;
+
+    workers = calloc(n_workers, sizeof(*workers));
+    if (!workers)
+	abort();
+
+    for (i = 0; i < n_workers; i++) {
+	workers[i].id = i;
+	pthread_mutex_init(&workers[i].dq.mtx, NULL);
+	if (uring_depth > 0) {
+	    workers[i].ring = uring_create(uring_depth);
+	    if (!workers[i].ring && f_debug)
+		fprintf(stderr, "%s: io_uring not available - using synchronous calls\n", argv0);
+	}
+    }
+
+    w_running = n_workers;
+    w_pause = 0;
+    w_parked = 0;
+}
+
+/* Scan everything queued by walk_start()'s caller, then clean up */
+static void
+walk_run(void) {
+    int i;
+
+    for (i = 1; i < n_workers; i++) {
+	int rc = pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]);
+
+	if (rc != 0) {
+	    fprintf(stderr, "%s: Error: pthread_create: %s\n", argv0, strerror(rc));
+	    exit(1);
+	}
+    }
+
+    worker_main(&workers[0]);
+
+    for (i = 0; i < n_workers; i++) {
+	if (i > 0)
+	    pthread_join(workers[i].tid, NULL);
+	merge_counters(&workers[i].c);
+	pthread_mutex_destroy(&workers[i].dq.mtx);
+	free(workers[i].dq.v);
+	free(workers[i].pbuf);
+	free(workers[i].ev);
+	free(workers[i].nbuf);
+	nameset_free(&workers[i].ns);
+	free(workers[i].sbuf);
+	uring_destroy(workers[i].ring);
+	free(workers[i].stv);
+	free(workers[i].strv);
+#ifdef USE_GETDENTS64
+	free(workers[i].dbuf);
+#endif
+    }
+
+    free(workers);
+    workers = NULL;
+}
+
+
+int
+walk_tree(const char *root) {
+    OBJECT o;
+    const char *name;
+    char *dir, *tmp = NULL;
+    size_t len;
+    COUNTERS c;
+
+
+    if (n_workers < 1)
+	n_workers = 1;
+
+    /* Locate the last path component, ignoring trailing slashes */
+    len = strlen(root);
+    while (len > 1 && root[len-1] == '/')
+	--len;
+    for (name = root+len; name > root && name[-1] != '/'; --name)
+	;
+    dir = (name > root ? strndup(root, name > root+1 ? name-root-1 : 1) : strdup("."));
+    if (!dir)
+	abort();
+
+    memset(&o, 0, sizeof(o));
+    o.dirfd = open_dir(AT_FDCWD, dir, 0);
+    free(dir);
+
+    o.path = root;
+    o.name = name;
+    if (len > (size_t) (name-root) && root[len] == '/') {
+	/* Strip trailing slashes from the name we classify */
+	o.name = tmp = strndup(name, root+len-name);
+	if (!tmp)
+	    abort();
+    }
+
+    /* We always need to know if the root is a directory */
+    o.type = DT_UNKNOWN;
+    o.sb_valid = (xstatat(AT_FDCWD, root, &o.sb, XS_SCAN) < 0 ? -1 : 1);
+
+    /* The root itself goes with the first shard */
+    if (shard_n == 0 || shard_k == 0) {
+	memset(&c, 0, sizeof(c));
+	if (o.sb_valid < 0)
+	    c.unread++;
+	else
+	    walker(&o, &c);
+
+	__atomic_add_fetch(&n_objects, 1, __ATOMIC_RELAXED);
+	throttle_objects(1);
+	merge_counters(&c);
+    }
+
+    if (o.dirfd >= 0)
+	close(o.dirfd);
+    free(tmp);
+
+    if (o.sb_valid < 0 || !S_ISDIR(o.sb.st_mode))
+	return 0;
+
+    walk_start();
+    w_rootlen = len;
+
+    /* Without trailing slashes so that paths below it are built the same way */
+    tmp = strndup(root, len);
+    if (!tmp)
+	abort();
+    work_add(&workers[0], tmp, o.sb.st_dev, NULL);
+    free(tmp);
+
+    walk_run();
+    return 0;
+}
+
+
+/*
+ * Continue a walk from a checkpoint - scan the directories that were
+ * still queued, and everything below them.
+ */
+int
+walk_resume(const char *root,
+	    const char *const *paths,
+	    const uint64_t *devs,
+	    size_t n) {
+    size_t i;
+
+    if (n_workers < 1)
+	n_workers = 1;
+    if (n == 0)
+	return 0;
+
+    walk_start();
+    for (w_rootlen = strlen(root); w_rootlen > 1 && root[w_rootlen-1] == '/'; w_rootlen--)
+	;
+    for (i = 0; i < n; i++)
+	work_add(&workers[i % n_workers], paths[i], (dev_t) devs[i], NULL);
+    walk_run();
+    return 0;
+}
+
+
+/*
+ * Save the directories still to be scanned, and add up the workers'
+ * counters. Only called from checkpoint() while all workers are parked.
+ */
+int
+walk_save(CKFILE *ckp,
+	  COUNTERS *cp) {
+    int i;
+    size_t k;
+
+    for (i = 0; workers && i < n_workers; i++) {
+	DEQUE *dp = &workers[i].dq;
+	int rc = 0;
+
+	pthread_mutex_lock(&dp->mtx);
+	for (k = 0; rc == 0 && k < dp->len; k++) {
+	    WORK *w = dp->v[(dp->head+k) % dp->size];
+	    CKDIR d;
+
+	    d.dev = w->dev;
+	    rc = ckpt_put(ckp, CK_DIR, &d, sizeof(d), 1, w->path);
+	}
+	pthread_mutex_unlock(&dp->mtx);
+	if (rc < 0)
+	    return -1;
+
+	cp->ascii += workers[i].c.ascii;
+	cp->nfd += workers[i].c.nfd;
+	cp->nfc += workers[i].c.nfc;
+	cp->other += workers[i].c.other;
+	cp->unknown += workers[i].c.unknown;
+	cp->coll += workers[i].c.coll;
+	cp->unread += workers[i].c.unread;
+    }
+
+    return 0;
+}
+
+
+/* A listed object (-l), split into directory and name */
+typedef struct leaf {
+    const char *dir;
+    size_t dlen;
+    const char *name;
+    const char *path;
+} LEAF;
+
+static int
+leaf_cmp(const void *va,
+	 const void *vb) {
+    const LEAF *a = (const LEAF *) va;
+    const LEAF *b = (const LEAF *) vb;
+    int rc = memcmp(a->dir, b->dir, a->dlen < b->dlen ? a->dlen : b->dlen);
+
+    if (rc)
+	return rc;
+    if (a->dlen != b->dlen)
+	return a->dlen < b->dlen ? -1 : 1;
+    return strcmp(a->name, b->name);
+}
+
+
+/*
+ * Classify a list of objects without walking below them. The list is
+ * sorted so that each parent directory only is opened once, and an
+ * object listed more than once is only looked at once. Trailing
+ * slashes are stripped in place.
+ */
+int
+walk_list(char **paths,
+	  size_t n) {
+    LEAF *lv;
+    size_t i, j;
+    COUNTERS c;
+
+
+    lv = malloc(n*sizeof(*lv));
+    if (!lv)
+	abort();
+
+    for (i = 0; i < n; i++) {
+	char *path = paths[i];
+	size_t len = strlen(path);
+	const char *name;
+	LEAF *lp = &lv[i];
+
+	while (len > 1 && path[len-1] == '/')
+	    path[--len] = '\0';
+	for (name = path+len; name > path && name[-1] != '/'; --name)
+	    ;
+
+	lp->path = path;
+	lp->name = name;
+	if (name == path) {
+	    lp->dir = ".";
+	    lp->dlen = 1;
+	} else if (!*name) {
+	    /* "/" */
+	    lp->dir = lp->name = "/";
+	    lp->dlen = 1;
+	} else {
+	    lp->dir = path;
+	    for (lp->dlen = name-path; lp->dlen > 1 && path[lp->dlen-1] == '/'; lp->dlen--)
+		;
+	}
+    }
+
+    qsort(lv, n, sizeof(*lv), leaf_cmp);
+
+    memset(&c, 0, sizeof(c));
+    for (i = 0; i < n; i = j) {
+	char *dir;
+	int dfd;
+
+	/* All objects in the same directory */
+	for (j = i+1; j < n && lv[j].dlen == lv[i].dlen &&
+		 memcmp(lv[j].dir, lv[i].dir, lv[i].dlen) == 0; j++)
+	    ;
+
+	dir = strndup(lv[i].dir, lv[i].dlen);
+	if (!dir)
+	    abort();
+	dfd = open_dir(AT_FDCWD, dir, 0);
+	/* Gone is just unreadable (-w lists names that may have been removed again) */
+	if (dfd < 0 && (f_debug || errno != ENOENT)) {
+	    int err = errno;
+
+	    fprintf(stderr, "%s: Error: %s: open: %s\n",
+		    argv0, dir, strerror(err));
+	    if (err != ENOENT)
+		__atomic_add_fetch(&n_errors, 1, __ATOMIC_RELAXED);
+	}
+	free(dir);
+
+	for (; i < j; i++) {
+	    OBJECT o;
+
+	    if (i > 0 && leaf_cmp(&lv[i-1], &lv[i]) == 0)
+		continue;
+	    if (shard_n > 0 && !shard_owns(lv[i].path))
+		continue;
+
+	    memset(&o, 0, sizeof(o));
+	    o.dirfd = dfd;
+	    o.path = lv[i].path;
+	    o.name = lv[i].name;
+	    o.type = DT_UNKNOWN;
+
+	    /* Like walk_tree() - always make sure the object is there */
+	    if (dfd < 0 || !obj_stat(&o))
+		c.unread++;
+	    else
+		walker(&o, &c);
+	    __atomic_add_fetch(&n_objects, 1, __ATOMIC_RELAXED);
+	    throttle_objects(1);
+	}
+
+	if (dfd >= 0)
+	    close(dfd);
+    }
+
+    merge_counters(&c);
+    free(lv);
+    return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * walk.h
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WALK_H
+#define WALK_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pnfdscan.h"
+#include "checkpoint.h"
+
+/*
+ * Parallel directory tree walker.
+ *
+ * Directories are queued on per-thread deques. A worker pops work from
+ * the bottom of its own deque (depth first) and, when it runs dry, steals
+ * from the top of the other workers' deques (breadth first, which tends
+ * to hand out large subtrees).
+ *
+ * Each directory is reported to dir_done() once it and all directories
+ * below it have been scanned (post-order).
+ *
+ * When checkpoint_due() says so the workers are paused (between
+ * directories) and checkpoint() is called to save the state, which
+ * includes walk_save() - the directories still queued.
+ */
+
+extern int n_workers;
+extern int f_inode;
+
+extern int
+open_dir(int start_fd,
+	 const char *path,
+	 int flags);
+
+extern int
+walk_tree(const char *root);
+
+extern int
+walk_list(char **paths,
+	  size_t n);
+
+extern int
+walk_resume(const char *root,
+	    const char *const *paths,
+	    const uint64_t *devs,
+	    size_t n);
+
+extern int
+walk_save(CKFILE *ckp,
+	  COUNTERS *cp);
+
+#endif
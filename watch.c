@@ -0,0 +1,830 @@
+/*
+ * watch.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Need open_by_handle_at() */
+#define _GNU_SOURCE 1
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+#ifdef HAVE_SYS_FANOTIFY_H
+#include <sys/fanotify.h>
+#include <sys/vfs.h>
+#endif
+
+#include "pnfdscan.h"
+#include "watch.h"
+
+#if defined(HAVE_SYS_FANOTIFY_H) && defined(FAN_REPORT_DFID_NAME)
+#define W_FANOTIFY 1
+#endif
+#if defined(HAVE_SYS_INOTIFY_H) && defined(IN_ONLYDIR)
+#define W_INOTIFY 1
+#endif
+
+
+#define W_DELAY_MS	100		/* Quiet time before a batch is handed over */
+#define W_MAX_DELAY_MS	1000		/* ... but no longer than this after its first event */
+#define W_BATCH		(64*1024)	/* ... or when it has this many paths */
+#define W_BUFSIZE	(64*1024)
+
+static volatile sig_atomic_t w_stop = 0;
+
+
+/* Paths for the next batch, in one buffer */
+typedef struct plist {
+    char *buf;
+    size_t size;
+    size_t len;
+    size_t *ov;		/* Offsets in buf */
+    size_t n;
+    size_t ovsize;
+} PLIST;
+
+static PLIST w_names;
+static PLIST w_trees;
+static size_t w_deferred = 0;	/* Events not in the lists yet (see resolve()) */
+static PLIST w_ignore;		/* Names we have renamed things to */
+
+static char *const *w_roots = NULL;
+static int w_nroots = 0;
+
+
+static void
+w_signal(int sig) {
+    (void) sig;
+    w_stop = 1;
+}
+
+static uint64_t
+now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000ULL + ts.tv_nsec/1000000;
+}
+
+/* dir/name (without a double slash) */
+static char *
+w_join(const char *dir,
+       const char *name) {
+    size_t dlen = strlen(dir);
+    char *path = malloc(dlen+strlen(name)+2);
+
+    if (!path)
+	abort();
+    if (!*name)
+	return strcpy(path, dir);
+    memcpy(path, dir, dlen);
+    if (dlen > 0 && dir[dlen-1] == '/' && *name == '/')
+	name++;
+    else if (dlen > 0 && dir[dlen-1] != '/' && *name != '/')
+	path[dlen++] = '/';
+    strcpy(path+dlen, name);
+    return path;
+}
+
+static void
+pl_add(PLIST *pp,
+       const char *path) {
+    size_t len = strlen(path)+1;
+
+    if (pp->len+len > pp->size) {
+	pp->size = (pp->len+len)*2;
+	pp->buf = realloc(pp->buf, pp->size);
+	if (!pp->buf)
+	    abort();
+    }
+    if (pp->n == pp->ovsize) {
+	pp->ovsize = pp->ovsize ? pp->ovsize*2 : 1024;
+	pp->ov = realloc(pp->ov, pp->ovsize*sizeof(*pp->ov));
+	if (!pp->ov)
+	    abort();
+    }
+
+    memcpy(pp->buf+pp->len, path, len);
+    pp->ov[pp->n++] = pp->len;
+    pp->len += len;
+}
+
+static int
+str_cmp(const void *va,
+	const void *vb) {
+    return strcmp(*(char *const *) va, *(char *const *) vb);
+}
+
+/* Is path (or, with self = 0, only a directory above it) in the sorted trees? */
+static int
+in_trees(char **tv,
+	 size_t nt,
+	 char *path,
+	 int self) {
+    char *cp;
+    int found = 0;
+
+    if (self && bsearch(&path, tv, nt, sizeof(*tv), str_cmp))
+	return 1;
+    for (cp = strchr(path+1, '/'); cp && !found; cp = strchr(cp+1, '/')) {
+	*cp = '\0';
+	found = bsearch(&path, tv, nt, sizeof(*tv), str_cmp) != NULL;
+	*cp = '/';
+    }
+    return found;
+}
+
+void
+watch_ignore(const char *name) {
+    pl_add(&w_ignore, name);
+}
+
+/*
+ * Hand the batch over - without what is in it twice (walking a tree
+ * covers all below it) or the names our fixes in the last batch gave
+ * things. Those are all NFC so there's nothing more to do with them,
+ * wherever they are.
+ */
+static void
+flush_batch(WATCH_FN *fn) {
+    char **nv, **tv, **iv;
+    size_t i, nn, nt;
+
+    if (!w_names.n && !w_trees.n) {
+	w_ignore.n = w_ignore.len = 0;
+	return;
+    }
+
+    nv = malloc((w_names.n+1)*sizeof(*nv));
+    tv = malloc((w_trees.n+1)*sizeof(*tv));
+    iv = malloc((w_ignore.n+1)*sizeof(*iv));
+    if (!nv || !tv || !iv)
+	abort();
+
+    for (i = 0; i < w_ignore.n; i++)
+	iv[i] = w_ignore.buf+w_ignore.ov[i];
+    qsort(iv, w_ignore.n, sizeof(*iv), str_cmp);
+
+    for (i = 0; i < w_trees.n; i++)
+	tv[i] = w_trees.buf+w_trees.ov[i];
+    qsort(tv, w_trees.n, sizeof(*tv), str_cmp);
+    for (nt = 0, i = 0; i < w_trees.n; i++)
+	if (nt == 0 || strcmp(tv[nt-1], tv[i]) != 0)
+	    tv[nt++] = tv[i];
+    /* Sorted still, so the ones kept can be searched as we go */
+    for (nn = nt, nt = 0, i = 0; i < nn; i++)
+	if (!in_trees(tv, nt, tv[i], 0))
+	    tv[nt++] = tv[i];
+
+    for (nn = 0, i = 0; i < w_names.n; i++) {
+	char *path = w_names.buf+w_names.ov[i];
+	char *name = strrchr(path, '/');
+
+	name = name ? name+1 : path;
+	if (!in_trees(tv, nt, path, 1) &&
+	    !bsearch(&name, iv, w_ignore.n, sizeof(*iv), str_cmp))
+	    nv[nn++] = path;
+    }
+    free(iv);
+    w_ignore.n = w_ignore.len = 0;
+
+    if (nn > 0 || nt > 0) {
+	if (f_debug)
+	    fprintf(stderr, "*** watch: %lu names & %lu trees\n",
+		    (unsigned long) nn, (unsigned long) nt);
+	fn(nv, nn, tv, nt);
+    }
+
+    free(nv);
+    free(tv);
+    w_names.n = w_names.len = 0;
+    w_trees.n = w_trees.len = 0;
+}
+
+/* Rescan everything - events have been lost */
+static void
+lost_events(void) {
+    int i;
+
+    fprintf(stderr, "%s: Warning: Event queue overflow - rescanning\n", argv0);
+    for (i = 0; i < w_nroots; i++)
+	pl_add(&w_trees, w_roots[i]);
+}
+
+
+/*
+ * Wait for events and collect them with handle(), handing them over
+ * in batches when there's a pause (or the batch has grown big or old).
+ * idle() is called when there's a pause and resolve() before a batch
+ * is handed over.
+ */
+static int
+w_loop(int fd,
+       int (*handle)(int fd),
+       void (*idle)(void),
+       void (*resolve)(void),
+       WATCH_FN *fn) {
+    struct pollfd pfd;
+    uint64_t first = 0;
+    int rc;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while (!w_stop) {
+	rc = poll(&pfd, 1, first ? W_DELAY_MS : 1000);
+	if (rc < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+
+	if (rc > 0) {
+	    if (handle(fd) < 0)
+		return -1;
+	    if (!first)
+		first = now_ms();
+	    if (w_names.n+w_trees.n+w_deferred < W_BATCH && now_ms()-first < W_MAX_DELAY_MS)
+		continue;
+	} else if (idle)
+	    idle();
+
+	if (resolve)
+	    resolve();
+	flush_batch(fn);
+	first = 0;
+    }
+
+    if (resolve)
+	resolve();
+    flush_batch(fn);
+    return 0;
+}
+
+
+#ifdef W_FANOTIFY
+/*
+ * fanotify - a mark on each filesystem reports the directory (as a
+ * file handle) and name of everything created or moved there, so no
+ * state is needed, but it needs CAP_SYS_ADMIN (and to open the handles,
+ * CAP_DAC_READ_SEARCH). Events from our own renames are ignored.
+ */
+typedef struct fanroot {
+    const char *name;	/* As given */
+    char *real;		/* Absolute, no symlinks */
+    int fd;		/* For open_by_handle_at() */
+    fsid_t fsid;
+} FANROOT;
+
+static FANROOT *fan_roots = NULL;
+
+/* Check that we can open the root by its handle, else we'd see nothing */
+static int
+fan_openable(const FANROOT *rp) {
+    union {
+	struct file_handle fh;
+	char buf[sizeof(struct file_handle)+MAX_HANDLE_SZ];
+    } h;
+    int mnt, fd;
+
+    h.fh.handle_bytes = MAX_HANDLE_SZ;
+    if (name_to_handle_at(rp->fd, "", &h.fh, &mnt, AT_EMPTY_PATH) < 0)
+	return -1;
+    fd = open_by_handle_at(rp->fd, &h.fh, O_PATH|O_CLOEXEC);
+    if (fd < 0)
+	return -1;
+    close(fd);
+    return 0;
+}
+
+static void
+fan_event(const struct fanotify_event_metadata *mp) {
+    const struct fanotify_event_info_fid *fip = (const struct fanotify_event_info_fid *) (mp+1);
+    struct file_handle *hp;
+    const char *name;
+    char lbuf[64], dir[PATH_MAX], *sub, *path;
+    ssize_t len;
+    int i, dfd = -1;
+
+
+    if ((const char *) (fip+1) > (const char *) mp + mp->event_len ||
+	fip->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+	return;
+    hp = (struct file_handle *) fip->handle;
+    name = (const char *) hp->f_handle + hp->handle_bytes;
+    if (strcmp(name, ".") == 0)
+	return;
+
+    for (i = 0; i < w_nroots; i++) {
+	FANROOT *rp = &fan_roots[i];
+	size_t rlen = strlen(rp->real);
+
+	if (memcmp(&fip->fsid, &rp->fsid, sizeof(fip->fsid)) != 0)
+	    continue;
+
+	if (dfd < 0) {
+	    dfd = open_by_handle_at(rp->fd, hp, O_PATH|O_CLOEXEC);
+	    if (dfd < 0)
+		return;	/* Gone already */
+	    snprintf(lbuf, sizeof(lbuf), "/proc/self/fd/%d", dfd);
+	    len = readlink(lbuf, dir, sizeof(dir)-1);
+	    close(dfd);
+	    if (len < 0)
+		return;
+	    dir[len] = '\0';
+	}
+
+	if (strcmp(rp->real, "/") == 0)
+	    rlen = 0;
+	else if (strncmp(dir, rp->real, rlen) != 0 || (dir[rlen] && dir[rlen] != '/'))
+	    continue;
+
+	/* As a path below the root as given. A directory moved here may have things below it */
+	sub = w_join(rp->name, dir+rlen);
+	path = w_join(sub, name);
+	pl_add((mp->mask & (FAN_ONDIR|FAN_MOVED_TO)) == (FAN_ONDIR|FAN_MOVED_TO) ?
+	       &w_trees : &w_names, path);
+	free(path);
+	free(sub);
+	return;
+    }
+}
+
+static int
+fan_handle(int fd) {
+    static char *buf = NULL;
+    const struct fanotify_event_metadata *mp;
+    ssize_t len;
+    pid_t pid = getpid();
+
+    if (!buf && (buf = malloc(W_BUFSIZE)) == NULL)
+	abort();
+
+    len = read(fd, buf, W_BUFSIZE);
+    if (len < 0)
+	return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+
+    for (mp = (const struct fanotify_event_metadata *) buf; FAN_EVENT_OK(mp, len); mp = FAN_EVENT_NEXT(mp, len)) {
+	if (mp->vers != FANOTIFY_METADATA_VERSION) {
+	    errno = EPROTO;
+	    return -1;
+	}
+	if (mp->mask & FAN_Q_OVERFLOW)
+	    lost_events();
+	else if (mp->pid != pid)
+	    fan_event(mp);
+    }
+    return 0;
+}
+
+/* 1 if fanotify can't be used (here) */
+static int
+fan_run(WATCH_FN *fn) {
+    int fd, i, rc = 1;
+    struct statfs sfb;
+
+
+    fd = fanotify_init(FAN_CLASS_NOTIF|FAN_CLOEXEC|FAN_REPORT_DFID_NAME, O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+	return 1;
+
+    fan_roots = calloc(w_nroots, sizeof(*fan_roots));
+    if (!fan_roots)
+	abort();
+    for (i = 0; i < w_nroots; i++)
+	fan_roots[i].fd = -1;
+
+    for (i = 0; i < w_nroots; i++) {
+	FANROOT *rp = &fan_roots[i];
+
+	rp->name = w_roots[i];
+	rp->fd = open(rp->name, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	rp->real = realpath(rp->name, NULL);
+	if (rp->fd < 0 || !rp->real || fstatfs(rp->fd, &sfb) < 0)
+	    goto End;
+	rp->fsid = sfb.f_fsid;
+
+	/* Not on all filesystems (and a handle must be openable) */
+	if (fan_openable(rp) < 0 ||
+	    fanotify_mark(fd, FAN_MARK_ADD|FAN_MARK_FILESYSTEM,
+			  FAN_CREATE|FAN_MOVED_TO|FAN_ONDIR, AT_FDCWD, rp->name) < 0)
+	    goto End;
+    }
+
+    if (f_debug)
+	fprintf(stderr, "*** watch: Using fanotify\n");
+    rc = w_loop(fd, fan_handle, NULL, NULL, fn);
+
+ End:
+    for (i = 0; i < w_nroots; i++) {
+	if (fan_roots[i].fd >= 0)
+	    close(fan_roots[i].fd);
+	free(fan_roots[i].real);
+    }
+    free(fan_roots);
+    fan_roots = NULL;
+    close(fd);
+    return rc;
+}
+#endif
+
+
+#ifdef W_INOTIFY
+/*
+ * inotify - a watch on every directory, with its path by watch
+ * descriptor. Paths are updated as directories are moved around, a
+ * move being an IN_MOVED_FROM & IN_MOVED_TO pair with the same cookie,
+ * so events are kept as directory & name until the batch is handed
+ * over (our own fixes rename directories with events queued in them).
+ */
+#define IN_WMASK	(IN_CREATE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR|IN_DONT_FOLLOW|IN_EXCL_UNLINK)
+
+static int in_fd = -1;
+static char **in_paths = NULL;		/* By watch descriptor */
+static size_t in_size = 0;
+static unsigned long in_nwatch = 0;
+static int in_full = 0;
+
+/* Directory moved away, if not paired with an IN_MOVED_TO */
+static uint32_t in_cookie = 0;
+static char *in_moved = NULL;
+
+typedef struct inevent {
+    int wd;
+    int tree;
+    char *name;
+} INEVENT;
+
+static INEVENT *in_events = NULL;
+static size_t in_size_events = 0;
+
+
+static void
+in_defer(int wd,
+	 const char *name,
+	 int tree) {
+    INEVENT *ep;
+
+    if (w_deferred == in_size_events) {
+	in_size_events = in_size_events ? in_size_events*2 : 1024;
+	in_events = realloc(in_events, in_size_events*sizeof(*in_events));
+	if (!in_events)
+	    abort();
+    }
+    ep = &in_events[w_deferred++];
+    ep->wd = wd;
+    ep->tree = tree;
+    ep->name = strdup(name);
+    if (!ep->name)
+	abort();
+}
+
+/* Events to paths, as things are now. Directories no longer watched are gone */
+static void
+in_resolve(void) {
+    size_t i;
+
+    for (i = 0; i < w_deferred; i++) {
+	INEVENT *ep = &in_events[i];
+
+	if (in_paths[ep->wd]) {
+	    char *path = w_join(in_paths[ep->wd], ep->name);
+
+	    pl_add(ep->tree ? &w_trees : &w_names, path);
+	    free(path);
+	}
+	free(ep->name);
+    }
+    w_deferred = 0;
+}
+
+
+/* Watch a directory and all below it. Returns its watch descriptor */
+static int
+in_add_tree(const char *path,
+	    dev_t dev) {
+    DIR *dp;
+    struct dirent *dep;
+    struct stat sb;
+    int wd, dfd;
+
+
+    wd = inotify_add_watch(in_fd, path, IN_WMASK);
+    if (wd < 0) {
+	if (errno == ENOSPC) {
+	    if (!in_full++)
+		fprintf(stderr, "%s: Error: %s: Too many directories to watch (fs.inotify.max_user_watches)\n",
+			argv0, path);
+	} else if (errno != ENOENT && errno != ENOTDIR)
+	    fprintf(stderr, "%s: Error: %s: inotify_add_watch: %s\n",
+		    argv0, path, strerror(errno));
+	return -1;
+    }
+    if ((size_t) wd >= in_size) {
+	size_t nsize = in_size ? in_size : 1024;
+
+	while (nsize <= (size_t) wd)
+	    nsize *= 2;
+	in_paths = realloc(in_paths, nsize*sizeof(*in_paths));
+	if (!in_paths)
+	    abort();
+	memset(in_paths+in_size, 0, (nsize-in_size)*sizeof(*in_paths));
+	in_size = nsize;
+    }
+    if (in_paths[wd])
+	free(in_paths[wd]);
+    else
+	in_nwatch++;
+    in_paths[wd] = strdup(path);
+    if (!in_paths[wd])
+	abort();
+
+    dfd = open(path, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+    if (dfd < 0)
+	return wd;
+    if (fstat(dfd, &sb) < 0 || (f_mount && dev && sb.st_dev != dev) ||
+	(dp = fdopendir(dfd)) == NULL) {
+	close(dfd);
+	return wd;
+    }
+    if (!dev)
+	dev = sb.st_dev;
+
+    while ((dep = readdir(dp)) != NULL) {
+	char *sub;
+
+	if (strcmp(dep->d_name, ".") == 0 || strcmp(dep->d_name, "..") == 0)
+	    continue;
+	if (dep->d_type != DT_DIR &&
+	    (dep->d_type != DT_UNKNOWN ||
+	     fstatat(dirfd(dp), dep->d_name, &sb, AT_SYMLINK_NOFOLLOW) < 0 ||
+	     !S_ISDIR(sb.st_mode)))
+	    continue;
+
+	sub = w_join(path, dep->d_name);
+	in_add_tree(sub, dev);
+	free(sub);
+    }
+    closedir(dp);
+    return wd;
+}
+
+/* Is path old, or below it? */
+static int
+in_below(const char *path,
+	 const char *old,
+	 size_t olen) {
+    return strncmp(path, old, olen) == 0 && (path[olen] == '\0' || path[olen] == '/');
+}
+
+/* A directory has moved within the trees. Returns 0 if it wasn't watched */
+static int
+in_rename(const char *old,
+	  const char *new) {
+    size_t i, olen = strlen(old), nlen = strlen(new);
+    int n = 0;
+
+    for (i = 0; i < in_size; i++)
+	if (in_paths[i] && in_below(in_paths[i], old, olen)) {
+	    char *path = malloc(nlen+strlen(in_paths[i]+olen)+1);
+
+	    if (!path)
+		abort();
+	    memcpy(path, new, nlen);
+	    strcpy(path+nlen, in_paths[i]+olen);
+	    free(in_paths[i]);
+	    in_paths[i] = path;
+	    n++;
+	}
+    return n;
+}
+
+/* A directory has moved out of the trees - stop watching it */
+static void
+in_moved_out(void) {
+    size_t i, olen;
+
+    if (!in_moved)
+	return;
+
+    olen = strlen(in_moved);
+    for (i = 0; i < in_size; i++)
+	if (in_paths[i] && in_below(in_paths[i], in_moved, olen)) {
+	    inotify_rm_watch(in_fd, i);
+	    free(in_paths[i]);
+	    in_paths[i] = NULL;
+	    in_nwatch--;
+	}
+    free(in_moved);
+    in_moved = NULL;
+}
+
+static int
+in_handle(int fd) {
+    static char *buf = NULL;
+    const struct inotify_event *ep;
+    ssize_t len, pos;
+
+    if (!buf && (buf = malloc(W_BUFSIZE)) == NULL)
+	abort();
+
+    len = read(fd, buf, W_BUFSIZE);
+    if (len < 0)
+	return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+
+    for (pos = 0; pos < len; pos += sizeof(*ep)+ep->len) {
+	char *path;
+	int wd;
+
+	ep = (const struct inotify_event *) (buf+pos);
+	if (ep->mask & IN_Q_OVERFLOW) {
+	    int i;
+
+	    /* And watch any directories we missed */
+	    in_moved_out();
+	    lost_events();
+	    for (i = 0; i < w_nroots; i++)
+		in_add_tree(w_roots[i], 0);
+	    continue;
+	}
+	if (ep->wd < 0 || (size_t) ep->wd >= in_size || !in_paths[ep->wd])
+	    continue;
+	if (ep->mask & IN_IGNORED) {
+	    free(in_paths[ep->wd]);
+	    in_paths[ep->wd] = NULL;
+	    in_nwatch--;
+	    continue;
+	}
+	if (!ep->len)
+	    continue;
+
+	if (in_moved && !((ep->mask & IN_MOVED_TO) && ep->cookie == in_cookie))
+	    in_moved_out();
+
+	path = w_join(in_paths[ep->wd], ep->name);
+	if (ep->mask & IN_MOVED_FROM) {
+	    if (ep->mask & IN_ISDIR) {
+		in_cookie = ep->cookie;
+		in_moved = path;
+		path = NULL;
+	    }
+	} else if ((ep->mask & (IN_MOVED_TO|IN_ISDIR)) == (IN_MOVED_TO|IN_ISDIR) && in_moved &&
+		   in_rename(in_moved, path) > 0) {
+	    /* Moved within the trees - only the name may be new */
+	    free(in_moved);
+	    in_moved = NULL;
+	    in_defer(ep->wd, ep->name, 0);
+	} else if (ep->mask & IN_ISDIR) {
+	    /*
+	     * New, moved in from elsewhere or moved before we got to
+	     * watch it. By its own watch, in case it's renamed.
+	     */
+	    free(in_moved);
+	    in_moved = NULL;
+	    wd = in_add_tree(path, 0);
+	    if (wd >= 0)
+		in_defer(wd, "", 1);
+	    else
+		in_defer(ep->wd, ep->name, 1);
+	} else
+	    in_defer(ep->wd, ep->name, 0);
+	free(path);
+    }
+    return 0;
+}
+
+static int
+in_run(WATCH_FN *fn) {
+    int i, rc;
+    size_t wd;
+
+
+    in_fd = inotify_init1(IN_CLOEXEC|IN_NONBLOCK);
+    if (in_fd < 0)
+	return -1;
+
+    for (i = 0; i < w_nroots; i++)
+	in_add_tree(w_roots[i], 0);
+    if (f_debug)
+	fprintf(stderr, "*** watch: Using inotify (%lu directories)\n", in_nwatch);
+
+    rc = w_loop(in_fd, in_handle, in_moved_out, in_resolve, fn);
+
+    close(in_fd);
+    in_fd = -1;
+    for (wd = 0; wd < in_size; wd++)
+	free(in_paths[wd]);
+    free(in_paths);
+    in_paths = NULL;
+    in_size = in_nwatch = 0;
+    free(in_moved);
+    in_moved = NULL;
+    free(in_events);
+    in_events = NULL;
+    in_size_events = 0;
+    return rc;
+}
+#endif
+
+
+int
+watch_run(char *const *roots,
+	  int nroots,
+	  WATCH_FN *fn) {
+    struct sigaction sa, osa_int, osa_term;
+    struct stat sb;
+    int i, rc = 1;
+
+
+    for (i = 0; i < nroots; i++) {
+	if (stat(roots[i], &sb) < 0) {
+	    fprintf(stderr, "%s: Error: %s: %s\n", argv0, roots[i], strerror(errno));
+	    return -1;
+	}
+	if (!S_ISDIR(sb.st_mode)) {
+	    fprintf(stderr, "%s: Error: %s: Not a directory\n", argv0, roots[i]);
+	    return -1;
+	}
+    }
+    w_roots = roots;
+    w_nroots = nroots;
+
+    /* Stop at a batch boundary */
+    w_stop = 0;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = w_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &osa_int);
+    sigaction(SIGTERM, &sa, &osa_term);
+
+#ifdef W_FANOTIFY
+    rc = fan_run(fn);
+#endif
+#ifdef W_INOTIFY
+    if (rc > 0)
+	rc = in_run(fn);
+#endif
+    if (rc > 0) {
+	fprintf(stderr, "%s: Error: Watching: Neither fanotify nor inotify available\n", argv0);
+	rc = -1;
+    } else if (rc < 0)
+	fprintf(stderr, "%s: Error: Watching: %s\n", argv0, strerror(errno));
+
+    sigaction(SIGINT, &osa_int, NULL);
+    sigaction(SIGTERM, &osa_term, NULL);
+    free(w_names.buf);
+    free(w_names.ov);
+    free(w_trees.buf);
+    free(w_trees.ov);
+    free(w_ignore.buf);
+    free(w_ignore.ov);
+    memset(&w_names, 0, sizeof(w_names));
+    memset(&w_trees, 0, sizeof(w_trees));
+    memset(&w_ignore, 0, sizeof(w_ignore));
+    return rc;
+}
@@ -0,0 +1,65 @@
+/*
+ * watch.h
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef WATCH_H
+#define WATCH_H 1
+
+#include <stddef.h>
+
+/*
+ * Watch mode (-w) - instead of scanning, follow the names being
+ * created in (or moved into) the trees and report them in batches, so
+ * only what has changed gets classified (and fixed).
+ *
+ * fanotify (FAN_REPORT_DFID_NAME, one mark per filesystem) is used if
+ * we are allowed to, else inotify with a watch on every directory.
+ * Directories that appear (or can't be accounted for, after an event
+ * queue overflow) are passed as trees to be walked.
+ */
+
+typedef void (WATCH_FN)(char **names,
+			size_t nnames,
+			char **trees,
+			size_t ntrees);
+
+/* Runs until SIGINT or SIGTERM (returns 0) or an error (-1) */
+extern int
+watch_run(char *const *roots,
+	  int nroots,
+	  WATCH_FN *fn);
+
+/* A name we have renamed something to - don't report it in the next batch */
+extern void
+watch_ignore(const char *name);
+
+#endif
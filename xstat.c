@@ -0,0 +1,126 @@
+/*
+ * xstat.c
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Need statx() */
+#define _GNU_SOURCE 1
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "xstat.h"
+
+
+int f_nosync = 0;
+
+
+#if defined(HAVE_STATX) && defined(STATX_TYPE)
+
+#define XS_MASK		(STATX_TYPE|STATX_MODE|STATX_MTIME|STATX_SIZE)
+
+static int have_statx = 1;
+
+
+unsigned int
+xstat_mask(void) {
+    return XS_MASK;
+}
+
+int
+xstat_flags(int mode) {
+    if (mode == XS_SYNC)
+	return AT_STATX_FORCE_SYNC;
+    return f_nosync ? AT_STATX_DONT_SYNC : AT_STATX_SYNC_AS_STAT;
+}
+
+static void
+xstat_from_statx(const struct statx *xp,
+		 struct stat *sp) {
+    memset(sp, 0, sizeof(*sp));
+    sp->st_dev = makedev(xp->stx_dev_major, xp->stx_dev_minor);
+    sp->st_ino = xp->stx_ino;
+    sp->st_mode = xp->stx_mode;
+    sp->st_size = xp->stx_size;
+    sp->st_mtim.tv_sec = xp->stx_mtime.tv_sec;
+    sp->st_mtim.tv_nsec = xp->stx_mtime.tv_nsec;
+}
+
+int
+xstatat(int dfd,
+	const char *name,
+	struct stat *sp,
+	int mode) {
+    if (have_statx) {
+	struct statx x;
+
+	if (statx(dfd, name, AT_SYMLINK_NOFOLLOW|xstat_flags(mode), XS_MASK, &x) == 0) {
+	    xstat_from_statx(&x, sp);
+	    return 0;
+	}
+	if (errno != ENOSYS)
+	    return -1;
+
+	/* Old kernel */
+	have_statx = 0;
+    }
+
+    return fstatat(dfd, name, sp, AT_SYMLINK_NOFOLLOW);
+}
+
+#else
+
+unsigned int
+xstat_mask(void) {
+    return 0;
+}
+
+int
+xstat_flags(int mode) {
+    return 0;
+}
+
+int
+xstatat(int dfd,
+	const char *name,
+	struct stat *sp,
+	int mode) {
+    return fstatat(dfd, name, sp, AT_SYMLINK_NOFOLLOW);
+}
+
+#endif
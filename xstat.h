@@ -0,0 +1,68 @@
+/*
+ * xstat.h
+ *
+ * Copyright (c) 2026 Peter Eriksson <pen@lysator.liu.se>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef XSTAT_H
+#define XSTAT_H 1
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * Metadata lookups. On Linux statx() is used, asking only for the
+ * fields we actually look at (type, mode, mtime and size - st_dev and
+ * st_ino are always returned), which lets network filesystems skip
+ * fetching the rest. With -D the scan may also be answered from the
+ * client's attribute cache (AT_STATX_DONT_SYNC). Checks done right
+ * before renaming or removing something always revalidate.
+ *
+ * Other fields of the returned struct stat should not be relied upon.
+ */
+
+#define XS_SCAN		0	/* Scanning */
+#define XS_SYNC		1	/* About to change something */
+
+extern int f_nosync;
+
+extern int
+xstatat(int dfd,
+	const char *name,
+	struct stat *sp,
+	int mode);
+
+extern unsigned int
+xstat_mask(void);
+
+extern int
+xstat_flags(int mode);
+
+#endif